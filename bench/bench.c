@@ -0,0 +1,537 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include "symbol_table.h"
+#include "assembler.h"
+#include "utils.h"
+#include "scan.h"
+
+// Benchmark driver. Runs the assembler executable on each input (best of several runs,
+// peak RSS of the child from wait4) and times the hot helpers in-process, then writes
+// everything as JSON so that results from two versions can be diffed. An input is a program
+// or a directory of modules (as written by gen_asm --module-lines), which is assembled in
+// one batch-mode run.
+
+typedef struct InputResult{
+  const char* path;
+  char** files;           // the .asm files of a directory input; NULL for a single program
+  size_t file_count;
+  size_t lines;
+  size_t bytes;
+  double seconds;         // best wall time over all runs
+  long peak_rss_kb;       // largest resident set over all runs
+  bool ok;
+} InputResult;
+
+typedef struct MicroResult{
+  const char* name;
+  size_t ops;
+  double ns_per_op;
+} MicroResult;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool measure_file(const char* path, size_t* bytes, size_t* lines) {
+
+  // String, size_t*, size_t* -> bool
+  // Counts the bytes and lines of an input file
+
+  FILE* fp = fopen(path, "rb");
+  if (!fp) return false;
+
+  char buffer[1 << 16];
+  size_t n;
+  *bytes = 0;
+  *lines = 0;
+  char last = '\n';
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      if (buffer[i] == '\n') (*lines)++;
+    }
+    *bytes += n;
+    last = buffer[n - 1];
+  }
+  if (last != '\n') (*lines)++;
+  fclose(fp);
+  return true;
+}
+
+static int compare_names(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static bool list_modules(InputResult* result) {
+
+  // InputResult* -> bool
+  // Collects the .asm files of a directory input in name order, adding up their sizes.
+  // Returns false when the path is not a directory.
+
+  DIR* dir = opendir(result->path);
+  if (!dir) return false;
+  size_t capacity = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir))) {
+    size_t len = strlen(entry->d_name);
+    if (len < 5 || strcmp(entry->d_name + len - 4, ".asm") != 0) continue;
+    if (result->file_count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      result->files = realloc(result->files, capacity * sizeof(char*));
+    }
+    char* path = malloc(strlen(result->path) + len + 2);
+    if (!result->files || !path) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(1);
+    }
+    sprintf(path, "%s/%s", result->path, entry->d_name);
+    result->files[result->file_count++] = path;
+  }
+  closedir(dir);
+  qsort(result->files, result->file_count, sizeof(char*), compare_names);
+
+  result->bytes = 0;
+  result->lines = 0;
+  for (size_t i = 0; i < result->file_count; i++) {
+    size_t bytes, lines;
+    if (!measure_file(result->files[i], &bytes, &lines)) return false;
+    result->bytes += bytes;
+    result->lines += lines;
+  }
+  return result->file_count > 0;
+}
+
+static bool run_assembler(char** argv, double* seconds, long* peak_rss_kb) {
+
+  // String[], double*, long* -> bool
+  // Runs the assembler as a child process with its output silenced and reports its wall
+  // time and peak resident set size
+
+  fflush(stdout);
+  double start = now();
+  pid_t pid = fork();
+  if (pid < 0) return false;
+  if (pid == 0) {
+    freopen("/dev/null", "w", stdout);
+    execv(argv[0], argv);
+    perror("Error running assembler");
+    _exit(127);
+  }
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0) return false;
+  *seconds = now() - start;
+  *peak_rss_kb = usage.ru_maxrss;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void bench_input(InputResult* result, const char* assembler, char** extra_args, int extra_count,
+                        const char* scratch, const char* jobs, int runs) {
+
+  // InputResult*, String, String[], int, String, String, int -> void
+  // Assembles one input runs times: a program into the scratch output, the modules of a
+  // directory with -j jobs, each next to its source
+
+  struct stat info;
+  bool directory = stat(result->path, &info) == 0 && S_ISDIR(info.st_mode);
+  result->ok = directory ? list_modules(result) : measure_file(result->path, &result->bytes, &result->lines);
+  result->seconds = 0;
+  result->peak_rss_kb = 0;
+  if (!result->ok) return;
+
+  char** argv = malloc((extra_count + result->file_count + 5) * sizeof(char*));
+  if (!argv) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(1);
+  }
+  int argc = 0;
+  argv[argc++] = (char*)assembler;
+  for (int i = 0; i < extra_count; i++) argv[argc++] = extra_args[i];
+  if (directory) {
+    argv[argc++] = "-j";
+    argv[argc++] = (char*)jobs;
+    for (size_t i = 0; i < result->file_count; i++) argv[argc++] = result->files[i];
+  } else {
+    argv[argc++] = (char*)result->path;
+    argv[argc++] = (char*)scratch;
+  }
+  argv[argc] = NULL;
+
+  for (int run = 0; run < runs; run++) {
+    double seconds;
+    long rss;
+    if (!run_assembler(argv, &seconds, &rss)) {
+      result->ok = false;
+      break;
+    }
+    if (run == 0 || seconds < result->seconds) result->seconds = seconds;
+    if (rss > result->peak_rss_kb) result->peak_rss_kb = rss;
+  }
+  free(argv);
+}
+
+// Keeps the compiler from discarding the work being timed
+static volatile size_t sink;
+
+static double micro_symbol_table_add(size_t ops) {
+
+  // size_t -> double
+  // Inserts ops distinct names into a fresh table; returns elapsed seconds
+
+  char name[32];
+  SymbolTable table;
+  symbol_table_init(&table, 16);
+  double start = now();
+  for (size_t i = 0; i < ops; i++) {
+    snprintf(name, sizeof(name), "symbol_%zu", i);
+    symbol_table_add(&table, name, (int)i);
+  }
+  double elapsed = now() - start;
+  sink += table.size;
+  symbol_table_free(&table);
+  return elapsed;
+}
+
+static double micro_symbol_table_lookup(size_t ops, bool use_contains) {
+
+  // size_t, bool -> double
+  // Looks up names in a table of 4096 symbols, half of them present
+
+  enum { TABLE_SIZE = 4096, NAME_COUNT = 8192 };
+  static char names[NAME_COUNT][32];
+  SymbolTable table;
+  symbol_table_init(&table, TABLE_SIZE);
+  for (size_t i = 0; i < NAME_COUNT; i++) {
+    snprintf(names[i], sizeof(names[i]), "LOOP_%zu", i * 7919);
+    if (i % 2 == 0) symbol_table_add(&table, names[i], (int)i);
+  }
+
+  double start = now();
+  size_t found = 0;
+  for (size_t i = 0; i < ops; i++) {
+    const char* name = names[i % NAME_COUNT];
+    int address;
+    if (use_contains) found += symbol_table_contains(&table, name);
+    else found += symbol_table_get_address(&table, name, &address);
+  }
+  double elapsed = now() - start;
+  sink += found;
+  symbol_table_free(&table);
+  return elapsed;
+}
+
+static double micro_clear_line(size_t ops) {
+
+  // size_t -> double
+  // Cleans a rotating set of indented, spaced and commented lines
+
+  static const char* lines[] = {
+    "    D=M", "  M = D+M   // add", "@LOOP", "(END)   // end of program", "   0 ; JMP",
+    "// only a comment", "AM=M-1", "  @SP",
+  };
+  enum { LINE_COUNT = sizeof(lines) / sizeof(lines[0]) };
+  char copies[LINE_COUNT][32];
+  for (size_t i = 0; i < LINE_COUNT; i++) strcpy(copies[i], lines[i]);
+
+  double start = now();
+  for (size_t i = 0; i < ops; i++) {
+    char* cleaned = clear_line(copies[i % LINE_COUNT]);
+    sink += cleaned[0];
+    free(cleaned);
+  }
+  return now() - start;
+}
+
+static double micro_convert_to_binary(size_t ops) {
+
+  // size_t -> double
+  // Converts decimal strings covering the whole A-constant range
+
+  enum { VALUE_COUNT = 1024 };
+  static char values[VALUE_COUNT][8];
+  for (size_t i = 0; i < VALUE_COUNT; i++) {
+    snprintf(values[i], sizeof(values[i]), "%zu", (i * 32749) % 32768);
+  }
+
+  double start = now();
+  for (size_t i = 0; i < ops; i++) {
+    char* binary = convert_to_binary(values[i % VALUE_COUNT]);
+    sink += binary[0];
+    free(binary);
+  }
+  return now() - start;
+}
+
+static double micro_format_hack_text(size_t ops) {
+
+  // size_t -> double
+  // Formats words as .hack text in batches of 4096, as the output stage does
+
+  enum { BATCH = 4096 };
+  static uint16_t words[BATCH];
+  static char text[BATCH * HACK_TEXT_LINE];
+  for (size_t i = 0; i < BATCH; i++) words[i] = (uint16_t)(i * 40503u);
+
+  double start = now();
+  for (size_t done = 0; done < ops; done += BATCH) {
+    format_hack_text(words, BATCH, text);
+    sink += text[done % sizeof(text)];
+  }
+  return now() - start;
+}
+
+static double micro_translate_C_instruction(size_t ops) {
+
+  // size_t -> double
+  // Translates a mix of common and rare C-instructions
+
+  static const char* instructions[] = {
+    "D=M", "M=D", "AM=M-1", "D;JGT", "0;JMP", "M=M+1", "D=D-M", "AMD=D|M;JLE", "A=!A", "MD=-1",
+  };
+  enum { INSTRUCTION_COUNT = sizeof(instructions) / sizeof(instructions[0]) };
+  char copies[INSTRUCTION_COUNT][16];
+  for (size_t i = 0; i < INSTRUCTION_COUNT; i++) strcpy(copies[i], instructions[i]);
+
+  double start = now();
+  for (size_t i = 0; i < ops; i++) {
+    char* binary = translate_C_instruction(copies[i % INSTRUCTION_COUNT]);
+    sink += binary[0];
+    free(binary);
+  }
+  return now() - start;
+}
+
+static double micro_scan_lines(ScanFunction scan, size_t ops) {
+
+  // ScanFunction, size_t -> double
+  // Scans ops lines of typical source text, wrapping around at its end
+
+  static const char* lines[] = {
+    "@SP", "AM=M-1", "D=M", "    @LCL", "    A=M   // local 0", "M=D", "(LOOP_START)",
+    "  D;JGT", "// push constant 7 onto the stack, then add the two topmost values", "",
+    "\t@R13\r", "  M = D + M  // spaced out", "0;JMP",
+  };
+  enum { LINE_COUNT = sizeof(lines) / sizeof(lines[0]), TEXT_SIZE = 1 << 20 };
+  static char text[TEXT_SIZE];
+  static size_t text_size;
+  if (text_size == 0) {
+    for (size_t i = 0; text_size + 128 < TEXT_SIZE; i++) {
+      size_t len = strlen(lines[i % LINE_COUNT]);
+      memcpy(text + text_size, lines[i % LINE_COUNT], len);
+      text[text_size + len] = '\n';
+      text_size += len + 1;
+    }
+  }
+
+  const char* end = text + text_size;
+  const char* p = text;
+  double start = now();
+  for (size_t i = 0; i < ops; i++) {
+    LineScan line;
+    scan(p, end, &line);
+    sink += line.spaces;
+    p = line.end < end ? line.end + 1 : text;
+  }
+  return now() - start;
+}
+
+static void run_micro(MicroResult* results, size_t* count, size_t ops) {
+
+  // MicroResult*, size_t*, size_t -> void
+  // Times every microbenchmark with ops operations each
+
+  struct { const char* name; double seconds; } runs[] = {
+    { "symbol_table_add", micro_symbol_table_add(ops / 4) * 4 },
+    { "symbol_table_contains", micro_symbol_table_lookup(ops, true) },
+    { "symbol_table_get_address", micro_symbol_table_lookup(ops, false) },
+    { "clear_line", micro_clear_line(ops) },
+    { "convert_to_binary", micro_convert_to_binary(ops) },
+    { "translate_C_instruction", micro_translate_C_instruction(ops) },
+    { "format_hack_text", micro_format_hack_text(ops) },
+  };
+
+  *count = sizeof(runs) / sizeof(runs[0]);
+  for (size_t i = 0; i < *count; i++) {
+    results[i].name = runs[i].name;
+    results[i].ops = ops;
+    results[i].ns_per_op = runs[i].seconds * 1e9 / ops;
+  }
+
+  // One entry per scanner variant, e.g. scan_line_avx2
+  static char names[8][32];
+  size_t variant_count;
+  const ScanVariant* variants = scan_variants(&variant_count);
+  for (size_t v = 0; v < variant_count && v < 8; v++) {
+    if (!variants[v].available) continue;
+    snprintf(names[v], sizeof(names[v]), "scan_line_%s", variants[v].name);
+    results[*count].name = names[v];
+    results[*count].ops = ops;
+    results[*count].ns_per_op = micro_scan_lines(variants[v].scan, ops) * 1e9 / ops;
+    (*count)++;
+  }
+}
+
+static void write_json_string(FILE* out, const char* str) {
+  fputc('"', out);
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\') fputc('\\', out);
+    fputc(*str, out);
+  }
+  fputc('"', out);
+}
+
+static bool write_results(const char* path, const char* tag, const InputResult* inputs, size_t input_count,
+                          const MicroResult* micro, size_t micro_count) {
+
+  // String, String, InputResult*, size_t, MicroResult*, size_t -> bool
+  // Writes every result as one JSON document
+
+  FILE* out = fopen(path, "w");
+  if (!out) return false;
+
+  fprintf(out, "{\n  \"tag\": ");
+  write_json_string(out, tag);
+  fprintf(out, ",\n  \"timestamp\": %ld,\n  \"assembler\": [", (long)time(NULL));
+  for (size_t i = 0; i < input_count; i++) {
+    const InputResult* r = &inputs[i];
+    double seconds = r->seconds > 0 ? r->seconds : 1e-9;
+    fprintf(out, "%s\n    {\"input\": ", i ? "," : "");
+    write_json_string(out, r->path);
+    fprintf(out, ", \"ok\": %s, \"lines\": %zu, \"bytes\": %zu, \"seconds\": %.6f, "
+                 "\"lines_per_sec\": %.0f, \"mb_per_sec\": %.2f, \"peak_rss_kb\": %ld}",
+            r->ok ? "true" : "false", r->lines, r->bytes, r->seconds,
+            r->lines / seconds, r->bytes / seconds / 1e6, r->peak_rss_kb);
+  }
+  fprintf(out, "\n  ],\n  \"micro\": [");
+  for (size_t i = 0; i < micro_count; i++) {
+    fprintf(out, "%s\n    {\"name\": \"%s\", \"ops\": %zu, \"ns_per_op\": %.2f}",
+            i ? "," : "", micro[i].name, micro[i].ops, micro[i].ns_per_op);
+  }
+  fprintf(out, "\n  ]\n}\n");
+
+  return fclose(out) == 0;
+}
+
+static void print_usage(FILE* out, const char* program) {
+  fprintf(out, "Usage: %s [--assembler=path] [--runs=N] [--ops=N] [--tag=name] [--scratch=path]\n", program);
+  fprintf(out, "       %*s [--jobs=N] [-o results.json] <input>... [-- assembler options]\n",
+          (int)strlen(program), "");
+}
+
+int main(int argc, char* argv[]) {
+
+  // int, char** -> int
+  // Benchmarks the assembler on every input file, runs the microbenchmarks and writes a
+  // table to standard output and the JSON results to the -o file (bench.json by default).
+  // Arguments after "--" are passed to the assembler, e.g. -- --parallel=4
+
+  const char* assembler = "build/main";
+  const char* output_name = "bench.json";
+  const char* tag = "";
+  const char* scratch = "/tmp/hack_bench_out";
+  const char* jobs = "1";
+  int runs = 3;
+  size_t ops = 2000000;
+
+  static const struct option long_options[] = {
+    { "assembler", required_argument, NULL, 'a' },
+    { "runs", required_argument, NULL, 'r' },
+    { "ops", required_argument, NULL, 'n' },
+    { "tag", required_argument, NULL, 't' },
+    { "scratch", required_argument, NULL, 's' },
+    { "jobs", required_argument, NULL, 'j' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  // Everything after "--" belongs to the assembler; only what comes before it is parsed here
+  int extra_start = argc;
+  int extra_count = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--") == 0) {
+      extra_start = i + 1;
+      extra_count = argc - extra_start;
+      argc = i;
+      break;
+    }
+  }
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "o:", long_options, NULL)) != -1) {
+    switch (opt) {
+      case 'a': assembler = optarg; break;
+      case 'r': runs = atoi(optarg); break;
+      case 'n': ops = strtoull(optarg, NULL, 10); break;
+      case 't': tag = optarg; break;
+      case 's': scratch = optarg; break;
+      case 'j': jobs = optarg; break;
+      case 'o': output_name = optarg; break;
+      case 'h':
+        print_usage(stdout, argv[0]);
+        return 0;
+      default:
+        print_usage(stderr, argv[0]);
+        return 1;
+    }
+  }
+  if (runs < 1) runs = 1;
+  if (ops < 4) ops = 4;
+
+  size_t input_count = argc - optind;
+
+  InputResult* inputs = calloc(input_count ? input_count : 1, sizeof(InputResult));
+  if (!inputs) {
+    fprintf(stderr, "Memory allocation failed\n");
+    return 1;
+  }
+
+  bool ok = true;
+  printf("%-32s %12s %10s %14s %10s %12s\n", "input", "lines", "MB", "lines/sec", "MB/sec", "peak RSS KB");
+  for (size_t i = 0; i < input_count; i++) {
+    inputs[i].path = argv[optind + i];
+    bench_input(&inputs[i], assembler, argv + extra_start, extra_count, scratch, jobs, runs);
+    if (!inputs[i].ok) {
+      fprintf(stderr, "%s: benchmark run failed\n", inputs[i].path);
+      ok = false;
+      continue;
+    }
+    double seconds = inputs[i].seconds > 0 ? inputs[i].seconds : 1e-9;
+    printf("%-32s %12zu %10.1f %14.0f %10.1f %12ld\n", inputs[i].path, inputs[i].lines,
+           inputs[i].bytes / 1e6, inputs[i].lines / seconds, inputs[i].bytes / seconds / 1e6,
+           inputs[i].peak_rss_kb);
+  }
+
+  MicroResult micro[16];
+  size_t micro_count;
+  run_micro(micro, &micro_count, ops);
+  printf("\n%-32s %12s\n", "microbenchmark", "ns/op");
+  for (size_t i = 0; i < micro_count; i++) {
+    printf("%-32s %12.2f\n", micro[i].name, micro[i].ns_per_op);
+  }
+
+  if (!write_results(output_name, tag, inputs, input_count, micro, micro_count)) {
+    perror("Error writing results");
+    ok = false;
+  } else {
+    printf("\nResults written to %s\n", output_name);
+  }
+
+  for (size_t i = 0; i < input_count; i++) {
+    for (size_t f = 0; f < inputs[i].file_count; f++) free(inputs[i].files[f]);
+    free(inputs[i].files);
+  }
+  free(inputs);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "hack_isa.h"
+
+// Writes a synthetic but realistic Hack program for benchmarking. Every knob has a default
+// close to compiled VM code: mostly C-instructions, a label every few dozen lines, a few
+// hundred variables and a sprinkling of comments and indentation. The same seed always
+// produces the same program. Every program fits in the ROM; larger inputs are written as a
+// directory of independent modules (--module-lines), to be assembled together with -j.
+
+typedef struct GenOptions{
+  size_t lines;
+  size_t module_lines;    // 0 for a single program
+  double label_density;   // fraction of lines that define a label
+  size_t variables;       // distinct user variables
+  double comments;        // fraction of instructions followed by a comment
+  double blank;           // fraction of lines that are empty or comment-only
+  double whitespace;      // fraction of instructions that are indented or spaced out
+  double c_mix;           // fraction of instructions that are C-instructions
+  uint64_t seed;
+} GenOptions;
+
+// The forms compiled code uses most, picked most of the time
+static const char* COMMON_C[] = {
+  "D=M", "M=D", "A=M", "D=A", "AM=M-1", "M=M+1", "M=M-1", "D=D-M", "D=D+M", "A=A-1",
+  "M=D+M", "M=M-D", "M=!M", "M=-M", "D;JGT", "D;JEQ", "D;JLT", "D;JNE", "0;JMP", "M=0", "M=-1",
+};
+
+static const char* COMPS[] = {
+  "0", "1", "-1", "D", "A", "!D", "!A", "-D", "-A", "D+1", "A+1", "D-1", "A-1", "D+A", "D-A",
+  "A-D", "D&A", "D|A", "M", "!M", "-M", "M+1", "M-1", "D+M", "D-M", "M-D", "D&M", "D|M",
+};
+static const char* DESTS[] = { "", "M", "D", "MD", "A", "AM", "AD", "AMD" };
+static const char* JUMPS[] = { "", "JGT", "JEQ", "JGE", "JLT", "JNE", "JLE", "JMP" };
+static const char* PREDEFINED[] = {
+  "SP", "LCL", "ARG", "THIS", "THAT", "R0", "R1", "R2", "R13", "R14", "R15", "SCREEN", "KBD",
+};
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+
+static uint64_t rng_state;
+
+static uint64_t next_random(void) {
+
+  // void -> uint64_t
+  // xorshift64*: fast, and identical on every platform for a given seed
+
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double chance(void) {
+  return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static size_t pick(size_t n) {
+  return n ? next_random() % n : 0;
+}
+
+static void write_c_instruction(FILE* out, char* line, bool spaced) {
+
+  // FILE*, char*, bool -> void
+  // Builds one C-instruction into line, optionally with spaces around '=' and ';'
+
+  if (chance() < 0.7) {
+    strcpy(line, COMMON_C[pick(COUNT(COMMON_C))]);
+  } else {
+    const char* dest = DESTS[pick(COUNT(DESTS))];
+    const char* comp = COMPS[pick(COUNT(COMPS))];
+    const char* jump = JUMPS[pick(COUNT(JUMPS))];
+    if (!*dest && !*jump) dest = "D";
+    sprintf(line, "%s%s%s%s%s", dest, *dest ? "=" : "", comp, *jump ? ";" : "", jump);
+  }
+
+  if (!spaced) {
+    fputs(line, out);
+    return;
+  }
+  for (const char* c = line; *c; c++) {
+    if (*c == '=' || *c == ';') fprintf(out, " %c ", *c);
+    else fputc(*c, out);
+  }
+}
+
+static size_t label_count_for(const GenOptions* options, size_t lines) {
+  size_t label_count = (size_t)(lines * options->label_density);
+  return label_count ? label_count : 1;
+}
+
+static bool fits_in_rom(const GenOptions* options, size_t lines) {
+
+  // GenOptions*, size_t -> bool
+  // Every line takes at most one word, and each label still undefined at the end adds a
+  // jump after it
+
+  return lines + label_count_for(options, lines) <= HACK_ROM_SIZE;
+}
+
+static void generate(FILE* out, const GenOptions* options, size_t lines) {
+
+  // FILE*, GenOptions*, size_t -> void
+  // Writes a program of the given number of lines. Labels are referenced both before and
+  // after their definition, and any label not yet defined when the lines run out is defined
+  // at the end.
+
+  size_t label_count = label_count_for(options, lines);
+  size_t labels_defined = 0;
+  char line[64];
+
+  for (size_t i = 0; i < lines; i++) {
+    if (labels_defined < label_count && chance() < options->label_density) {
+      fprintf(out, "(LABEL_%zu)\n", labels_defined++);
+      continue;
+    }
+    if (chance() < options->blank) {
+      fputs(chance() < 0.5 ? "\n" : "// ----\n", out);
+      continue;
+    }
+
+    bool spaced = chance() < options->whitespace;
+    if (spaced) fputs(chance() < 0.5 ? "    " : "  ", out);
+
+    double kind = chance();
+    if (kind < options->c_mix) {
+      write_c_instruction(out, line, spaced);
+    } else {
+      // The A-instructions split between labels, variables, predefined symbols and constants
+      double a_kind = (kind - options->c_mix) / (1.0 - options->c_mix);
+      if (a_kind < 0.3) {
+        fprintf(out, "@LABEL_%zu", pick(label_count));
+      } else if (a_kind < 0.6 && options->variables > 0) {
+        fprintf(out, "@var_%zu", pick(options->variables));
+      } else if (a_kind < 0.75) {
+        fprintf(out, "@%s", PREDEFINED[pick(COUNT(PREDEFINED))]);
+      } else {
+        fprintf(out, "@%zu", pick(32768));
+      }
+    }
+
+    if (chance() < options->comments) fputs("   // generated", out);
+    fputc('\n', out);
+  }
+
+  while (labels_defined < label_count) {
+    fprintf(out, "(LABEL_%zu)\n0;JMP\n", labels_defined++);
+  }
+}
+
+static bool write_program(const char* path, const GenOptions* options, size_t lines, uint64_t seed) {
+
+  // String, GenOptions*, size_t, uint64_t -> bool
+  // Writes one program to path, or to standard output when path is NULL
+
+  FILE* out = path ? fopen(path, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "%s: ", path);
+    perror("Error opening output file");
+    return false;
+  }
+
+  static char buffer[1 << 16];
+  setvbuf(out, buffer, _IOFBF, sizeof(buffer));
+  rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+  generate(out, options, lines);
+
+  bool ok = !ferror(out);
+  if (path && fclose(out) != 0) ok = false;
+  if (!ok) perror("Error writing output file");
+  return ok;
+}
+
+static void print_usage(FILE* out, const char* program) {
+  fprintf(out, "Usage: %s [--lines=N] [--labels=F] [--variables=N] [--comments=F] [--blank=F]\n", program);
+  fprintf(out, "       %*s [--whitespace=F] [--c-mix=F] [--seed=N] [--module-lines=N] [-o output]\n",
+          (int)strlen(program), "");
+}
+
+static void print_help(const char* program) {
+  print_usage(stdout, program);
+  printf("\n"
+         "  --lines=N          lines in total (default 10000)\n"
+         "  --labels=F         fraction of lines that define a label (0.02)\n"
+         "  --variables=N      distinct user variables (200)\n"
+         "  --comments=F       fraction of instructions followed by a comment (0.2)\n"
+         "  --blank=F          fraction of lines that are empty or comment-only (0.1)\n"
+         "  --whitespace=F     fraction of instructions that are indented or spaced out (0.3)\n"
+         "  --c-mix=F          fraction of instructions that are C-instructions (0.6)\n"
+         "  --seed=N           random seed; module i of a directory uses N + i (1)\n"
+         "  --module-lines=N   split the lines into modules of at most N lines, written as\n"
+         "                     module_0000.asm, module_0001.asm, ... into the directory -o\n"
+         "  -o output          output file, or directory with --module-lines (default stdout)\n"
+         "\n"
+         "A single program, or each module, must fit in the %d-word ROM.\n", HACK_ROM_SIZE);
+}
+
+int main(int argc, char* argv[]) {
+
+  // int, char** -> int
+  // Parses the generator knobs (fractions are in 0..1) and writes the program to the
+  // output file, or to standard output when none is given
+
+  GenOptions options = { 10000, 0, 0.02, 200, 0.2, 0.1, 0.3, 0.6, 1 };
+  const char* output_name = NULL;
+
+  static const struct option long_options[] = {
+    { "lines", required_argument, NULL, 'n' },
+    { "labels", required_argument, NULL, 'l' },
+    { "variables", required_argument, NULL, 'v' },
+    { "comments", required_argument, NULL, 'c' },
+    { "blank", required_argument, NULL, 'b' },
+    { "whitespace", required_argument, NULL, 'w' },
+    { "c-mix", required_argument, NULL, 'm' },
+    { "seed", required_argument, NULL, 's' },
+    { "module-lines", required_argument, NULL, 'M' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "o:", long_options, NULL)) != -1) {
+    switch (opt) {
+      case 'n': options.lines = strtoull(optarg, NULL, 10); break;
+      case 'l': options.label_density = atof(optarg); break;
+      case 'v': options.variables = strtoull(optarg, NULL, 10); break;
+      case 'c': options.comments = atof(optarg); break;
+      case 'b': options.blank = atof(optarg); break;
+      case 'w': options.whitespace = atof(optarg); break;
+      case 'm': options.c_mix = atof(optarg); break;
+      case 's': options.seed = strtoull(optarg, NULL, 10); break;
+      case 'M': options.module_lines = strtoull(optarg, NULL, 10); break;
+      case 'o': output_name = optarg; break;
+      case 'h':
+        print_help(argv[0]);
+        return 0;
+      default:
+        print_usage(stderr, argv[0]);
+        return 1;
+    }
+  }
+  if (options.c_mix >= 1.0) options.c_mix = 0.999;
+
+  size_t program_lines = options.module_lines ? options.module_lines : options.lines;
+  if (!fits_in_rom(&options, program_lines)) {
+    fprintf(stderr, "A program of %zu lines may not fit in the %d-word ROM; split it with --module-lines\n",
+            program_lines, HACK_ROM_SIZE);
+    return 1;
+  }
+  if (options.module_lines == 0) {
+    return write_program(output_name, &options, options.lines, options.seed) ? 0 : 1;
+  }
+
+  // A directory of modules, the lines spread evenly over them
+  if (!output_name) {
+    fprintf(stderr, "--module-lines needs an output directory (-o)\n");
+    return 1;
+  }
+  if (mkdir(output_name, 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "%s: ", output_name);
+    perror("Error creating output directory");
+    return 1;
+  }
+  size_t modules = (options.lines + options.module_lines - 1) / options.module_lines;
+  if (modules == 0) modules = 1;
+  size_t path_size = strlen(output_name) + 32;
+  char* path = malloc(path_size);
+  if (!path) {
+    fprintf(stderr, "Memory allocation failed\n");
+    return 1;
+  }
+  bool ok = true;
+  for (size_t i = 0; i < modules && ok; i++) {
+    size_t lines = options.lines / modules + (i < options.lines % modules);
+    snprintf(path, path_size, "%s/module_%04zu.asm", output_name, i);
+    ok = write_program(path, &options, lines, options.seed + i);
+  }
+  free(path);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,33 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator owned by one assembly run. Allocations are never freed one by one: the
+// whole arena is released at once, keeping its regular blocks for the next run. Allocations
+// larger than half a block get a dedicated block so that big growing arrays can be resized
+// in place without leaving copies behind.
+
+typedef struct ArenaBlock{
+  struct ArenaBlock* next;
+  size_t capacity;
+  size_t used;
+} ArenaBlock;
+
+typedef struct Arena{
+  ArenaBlock* first;      // regular blocks; those after current are kept for reuse
+  ArenaBlock* current;
+  ArenaBlock* large;      // dedicated blocks, most recent first
+  size_t block_size;
+} Arena;
+
+void arena_init(Arena* arena, size_t block_size);
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_resize(Arena* arena, void* ptr, size_t old_size, size_t new_size);
+void arena_reset(Arena* arena);
+void arena_free(Arena* arena);
+
+// Doubles a dynamic array held in the arena (grow_array for arena memory)
+void* arena_grow_array(Arena* arena, void* array, size_t* capacity, size_t element_size);
+
+#endif
@@ -3,7 +3,26 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "symbol_table.h"
+#include "output.h"
+#include "lexer.h"
+#include "arena.h"
+
+typedef enum InstructionKind{
+  INSTRUCTION_LABEL,    // (NAME)
+  INSTRUCTION_WORD,     // numeric A-instruction or C-instruction, fully encoded
+  INSTRUCTION_SYMBOL,   // @NAME, whose word depends on the symbol's address
+  INSTRUCTION_EXPRESSION, // @expression over symbols (see expression.h), resolved once labels are known
+  INSTRUCTION_INVALID
+} InstructionKind;
+
+typedef struct AssemblyError{
+  size_t line;            // source line of the offending instruction
+  const char* message;
+  char text[64];          // the instruction, truncated to fit
+  size_t text_len;
+} AssemblyError;
 
 typedef struct CInstructionParts{
   char* dest;
@@ -12,7 +31,48 @@ typedef struct CInstructionParts{
 } CInstructionParts;
 
 // Core assembler
-void assemble(FILE *input, FILE *output);
+bool assemble(FILE *input, FILE *output);
+bool assemble_source(const char *source, size_t size, FILE *output, const OutputOptions *options);
+
+// Reentrant core: table must hold only the predefined symbols on entry; name_prefix prefixes diagnostics
+bool assemble_with_table(SymbolTable *table, const char *name_prefix, const char *source, size_t size,
+                         FILE *output, const OutputOptions *options);
+bool assemble_words(SymbolTable *table, Arena *arena, const char *source, size_t size,
+                    uint16_t **words, size_t *count, AssemblyError *error);
+
+// Instruction classification shared by all engines
+InstructionKind parse_instruction(Slice ins, uint16_t* word, Slice* symbol, const char** error);
+
+// Memo table in front of parse_instruction(). Generated code repeats a small set of lines
+// (@SP, AM=M-1, D=M, ...), so the encoded word of every C-instruction and numeric
+// A-instruction of up to INSTRUCTION_MEMO_KEY bytes is kept in a direct-mapped table keyed
+// by the instruction text. Labels and symbolic references always take the full path: what
+// they mean depends on the symbol table at that point. One memo per thread; it is 16KB.
+#define INSTRUCTION_MEMO_BITS 10
+#define INSTRUCTION_MEMO_KEY 14
+
+typedef struct InstructionMemoEntry{
+  char text[INSTRUCTION_MEMO_KEY];    // zero-padded; empty when text[0] is 0
+  uint16_t word;
+} InstructionMemoEntry;
+
+typedef struct InstructionMemo{
+  InstructionMemoEntry entries[1 << INSTRUCTION_MEMO_BITS];
+  size_t lookups;
+  size_t hits;
+} InstructionMemo;
+
+void instruction_memo_init(InstructionMemo* memo);
+// Moves the hit counters into the --stats of the current thread
+void instruction_memo_flush(InstructionMemo* memo);
+InstructionKind parse_instruction_memo(InstructionMemo* memo, Slice ins, uint16_t* word, Slice* symbol,
+                                       const char** error);
+
+// Diagnostics
+void set_assembly_error(AssemblyError *error, size_t line, const char *message, Slice ins);
+// Like set_assembly_error(), for the instruction that became ROM word number word of source
+void set_word_error(AssemblyError *error, const char *source, size_t size, size_t word, const char *message);
+void print_assembly_error(const char *name, const AssemblyError *error);
 
 // Predefined symbols
 void add_predefined_symbols(SymbolTable *st);
@@ -24,6 +84,7 @@ bool is_label(char* line);
 // Translation functions
 char* translate_A_instruction(char* ins);
 char* translate_C_instruction(char* ins);
+bool encode_C_instruction(const char* ins, size_t len, uint16_t* word);
 CInstructionParts* extract_C_instruction_parts(char* ins);
 char* extract_label(char* line);
 
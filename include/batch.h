@@ -0,0 +1,21 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "output.h"
+
+typedef struct BatchJob{
+  const char* input_path;
+  char* output_path;
+  char* cache_path;     // incremental cache file, or NULL
+  bool optimize;        // run the peephole optimizer
+  bool object;          // write a relocatable object (-c) instead of a ROM
+  size_t size;          // input size in bytes, used to schedule the largest files first
+  bool ok;
+} BatchJob;
+
+// Assembles every job on a pool of worker threads; returns true only if all jobs succeeded
+bool assemble_batch(BatchJob* jobs, size_t count, int threads, const OutputOptions* options);
+
+#endif
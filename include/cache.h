@@ -0,0 +1,30 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "symbol_table.h"
+#include "arena.h"
+#include "assembler.h"
+
+// Incremental reassembly. The source is cut into blocks at content-defined line boundaries,
+// so an edit only changes the blocks around it. For every block the cache file keeps the
+// encoded words, the labels it defines and the symbols it references (with the addresses
+// they had), keyed by a hash of the block's text and stored with that text. A later run takes
+// blocks whose text is unchanged from the cache, patching only references whose address
+// moved, and encodes the rest from scratch.
+// Labels and variables are resolved exactly as in assemble_words(), so the output is
+// identical to a cold build.
+
+// Like assemble_words(), reading and rewriting the cache file at cache_path. A missing or
+// unreadable cache file just means a cold build; failing to write it is reported on stderr
+// but does not fail the assembly.
+bool assemble_words_cached(SymbolTable *table, Arena *arena, const char *source, size_t size,
+                           const char *cache_path, uint16_t **words, size_t *count, AssemblyError *error);
+
+// Returns the cache file for input_path inside cache_dir as a heap string, creating the
+// directory when needed
+char* cache_path_for(const char *cache_dir, const char *input_path);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "lexer.h"
+
+// Compressed files, chosen by extension: NAME.gz is gzip (through zlib, unless built with
+// ZLIB=0) and NAME.zst is zstd (only when built with ZSTD=1). Compressed input is inflated
+// once, in large streaming reads, into the same kind of heap buffer a pipe is read into, so
+// every engine sees plain text and the two passes never decompress anything twice.
+// Compressed output goes through a stdio stream that compresses the bulk writes of
+// output.c as they arrive.
+
+typedef enum Compression{
+  COMPRESSION_NONE,
+  COMPRESSION_GZIP,
+  COMPRESSION_ZSTD
+} Compression;
+
+// The compression asked for by the extension of path
+Compression compression_for_path(const char* path);
+
+// The extension of a compressed format, including the dot; "" for none
+const char* compression_extension(Compression compression);
+
+// Reads and decompresses the whole file at path into a heap buffer released by
+// source_close(). Fails with errno ENOTSUP when the format is not built in and EBADMSG when
+// the data is corrupt.
+bool source_open_compressed(SourceBuffer* source, const char* path, Compression compression);
+
+// Opens path for writing like fopen(), compressing when its extension asks for it. A
+// compressed stream reports a failed write or fclose() like a plain one.
+FILE* output_open(const char* path, bool binary);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Disassembler: .hack text or .hackbin images back to canonical Hack assembly. The comp and
+// jump decoding tables are generated from the X-macro tables in hack_isa.h that the encoder
+// uses, and every possible instruction is formatted once up front, so decoding a word is a
+// table lookup and a fixed-size copy.
+
+typedef struct DisasmError{
+  size_t position;      // .hack line or ROM address, depending on the step that failed
+  const char* message;
+} DisasmError;
+
+// Label and variable names read back from a symbol dump (see hack_asm_write_symbols)
+typedef struct HackSymbols{
+  char* text;                   // the dump, with every name NUL-terminated in place
+  const char** label_at;        // ROM address -> first label defined there, or NULL
+  const char** variable_at;     // RAM address -> variable, or NULL
+  struct LabelDefinition* labels;   // every label, sorted by address
+  size_t label_count;
+} HackSymbols;
+
+// Reads a symbol dump; lines are "label NAME ADDRESS" or "variable NAME ADDRESS".
+// Problems are reported on stderr.
+bool hack_symbols_load(HackSymbols* symbols, const char* path);
+void hack_symbols_free(HackSymbols* symbols);
+
+// Decodes a .hackbin image (recognised by its header) or .hack text into a heap array of
+// words. For text, error->position is the offending line.
+bool decode_rom(const char* data, size_t size, uint16_t** words, size_t* count, DisasmError* error);
+
+// Writes count words as assembly, one instruction per line. With symbols, label definitions
+// are restored and A-instructions that load a known address use its name; without, every
+// A-instruction stays numeric. Variables are named only in order of their addresses, so the
+// output reassembles to the same words. error->position is the ROM address of a word that
+// is not a valid instruction.
+bool disassemble(FILE* output, const uint16_t* words, size_t count, const HackSymbols* symbols,
+                 DisasmError* error);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "hack_isa.h"
+
+// Hack CPU emulator. The ROM is decoded once into an array indexed by the full 16-bit
+// program counter, so execution needs no bounds checks: the ALU is a switch on the 7-bit comp
+// code, and the slots past the program hold an end marker. A program is considered halted
+// when it reaches the usual "(END) @END 0;JMP" loop or runs off the end of its ROM.
+
+#define HACK_RAM_SIZE 32768
+
+typedef struct DecodedInstruction{
+  uint8_t op;           // comp code of a C-instruction, or one of the OP_* codes in emulator.c
+  uint8_t dest;
+  uint8_t jump;
+  uint16_t value;       // loaded value of an A-instruction
+} DecodedInstruction;
+
+typedef struct HackCpu{
+  uint16_t a;
+  uint16_t d;
+  uint16_t pc;
+  bool halted;
+  uint64_t steps;               // instructions executed so far
+  uint16_t* ram;                // HACK_RAM_SIZE words
+  DecodedInstruction* rom;      // 65536 slots
+  size_t rom_words;
+} HackCpu;
+
+typedef struct ProfileLabel{
+  size_t address;
+  const char* name;
+} ProfileLabel;
+
+// Decodes the program into a fresh machine with zeroed RAM and registers. Returns false when
+// it does not fit in the 32K ROM.
+bool hack_cpu_init(HackCpu* cpu, const uint16_t* words, size_t count);
+void hack_cpu_free(HackCpu* cpu);
+
+// Runs until the program halts or limit more instructions have executed. With counts (an
+// array of 65536 entries) the instructions executed at every ROM address are added to it.
+void hack_cpu_run(HackCpu* cpu, uint64_t limit, uint64_t* counts);
+
+// Prints the instructions executed per label region (from a label's address up to the next
+// label), busiest first. labels need not be sorted.
+void print_profile(FILE* output, const uint64_t* counts, size_t rom_words, ProfileLabel* labels,
+                   size_t label_count);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "symbol_table.h"
+#include "lexer.h"
+
+// Assemble-time constant expressions in A-instructions, such as @SCREEN+32*5 or @LOOP+3.
+// Operands are decimal numbers, labels and predefined symbols (never variables, whose
+// addresses depend on allocation order). The operators have C's precedence, from lowest to
+// highest:
+//   |    &    << >>    + -    *    unary -
+// and parentheses group. Arithmetic is done on 64 bits; only the final value must fit in
+// an A-instruction (0..32767). An A-instruction is an expression when its text contains an
+// operator or a parenthesis, none of which can appear in a symbol name.
+
+typedef enum ExpressionResult{
+  EXPRESSION_VALUE,         // *value holds the result
+  EXPRESSION_UNRESOLVED,    // well-formed, but an operand is not (yet) a usable symbol
+  EXPRESSION_INVALID        // *error describes the problem
+} ExpressionResult;
+
+// Whether the text after '@' is an expression rather than a number or a symbol
+bool is_expression(Slice text);
+
+// Evaluates the text after '@'. Only the first symbol_count symbols of table can be operands,
+// and only when they are defined labels or predefined symbols; a NULL table resolves numbers
+// only, which still checks the syntax. Reads the table without changing it, so it is safe
+// to call from several threads at once.
+ExpressionResult evaluate_expression(Slice text, const SymbolTable *table, size_t symbol_count,
+                                     uint16_t *value, const char **error);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef HACK_ASM_H
+#define HACK_ASM_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "output.h"
+#include "optimize.h"
+
+// Embeddable in-memory assembler. A context owns a copy of the predefined symbols and an
+// arena that stay warm between calls, so assembling many small programs costs no file I/O
+// and almost no allocation. A context must only be used by one thread at a time; use one
+// context per thread to assemble concurrently.
+
+typedef struct HackAsmContext HackAsmContext;
+
+typedef struct HackAsmError{
+  size_t line;          // 1-based source line, 0 when the error is not tied to a line
+  char message[160];    // the diagnostic followed by the offending instruction
+} HackAsmError;
+
+// Returns NULL when memory runs out
+HackAsmContext* hack_asm_ctx_create(void);
+void hack_asm_ctx_destroy(HackAsmContext* ctx);
+
+// Drops the result of the previous call and gives its memory back, keeping the context
+// ready for reuse
+void hack_asm_ctx_reset(HackAsmContext* ctx);
+
+// Threads used for large programs (1, the default, keeps everything on the calling thread)
+void hack_asm_ctx_set_threads(HackAsmContext* ctx, int threads);
+
+// Makes the following calls reuse and update the incremental cache file at path (see
+// cache.h); NULL turns caching off. The path is copied.
+bool hack_asm_ctx_set_cache(HackAsmContext* ctx, const char* path);
+
+// Runs the peephole optimizer (see optimize.h) on the following calls. It works on the whole
+// program on the calling thread and takes precedence over threads and the cache.
+void hack_asm_ctx_set_optimize(HackAsmContext* ctx, bool optimize);
+
+// What the optimizer saved on the last successful call; all zero when it did not run
+const OptimizeReport* hack_asm_optimize_report(const HackAsmContext* ctx);
+
+// Assembles len bytes of source. On success *words points to *count machine words owned by
+// the context, valid until the next call on it. On failure err (when not NULL) describes
+// the first error and false is returned.
+bool hack_asm_assemble_buffer(HackAsmContext* ctx, const char* source, size_t len,
+                              const uint16_t** words, size_t* count, HackAsmError* err);
+
+// Assembles len bytes of one module into a relocatable object (see object.h), kept in the
+// context until the next call
+bool hack_asm_assemble_object(HackAsmContext* ctx, const char* source, size_t len, HackAsmError* err);
+
+// Writes the object of the last hack_asm_assemble_object() call
+bool hack_asm_write_object(HackAsmContext* ctx, FILE* output);
+
+// Links the object files at paths, in that order, into one program. *words is owned by the
+// context as with hack_asm_assemble_buffer(). Errors are reported with line 0 and the
+// offending path in the message.
+bool hack_asm_link(HackAsmContext* ctx, const char* const* paths, size_t path_count,
+                   const uint16_t** words, size_t* count, HackAsmError* err);
+
+// Streams a program from input_fd straight into the output file output_fd (a regular file
+// opened read-write) with the pipelined engine in pipeline.h, overlapping reading, encoding
+// and writing. *count receives the number of words written. I/O failures are reported with
+// line 0.
+bool hack_asm_assemble_fd(HackAsmContext* ctx, int input_fd, int output_fd, const OutputOptions* options,
+                          size_t* count, HackAsmError* err);
+
+// Writes the symbols of the last program, one "label NAME ADDRESS" or "variable NAME
+// ADDRESS" line each, in the order they first appear. --disassemble reads this back.
+bool hack_asm_write_symbols(HackAsmContext* ctx, FILE* output);
+
+// Runs words on the built-in emulator (see emulator.h) from a reset machine until the program
+// halts or limit instructions have executed, then prints the instruction count, the speed and
+// the registers to report. With profile the instructions executed per label region of the last
+// program follow, busiest first. Returns false when the words do not fit in the 32K ROM.
+bool hack_asm_run(HackAsmContext* ctx, const uint16_t* words, size_t count, uint64_t limit, bool profile,
+                  FILE* report);
+
+// Writes words in the given format (.hack text when options is NULL)
+bool hack_asm_write(HackAsmContext* ctx, FILE* output, const uint16_t* words, size_t count,
+                    const OutputOptions* options);
+
+#endif
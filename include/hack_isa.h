@@ -0,0 +1,70 @@
+#ifndef HACK_ISA_H
+#define HACK_ISA_H
+
+#include <stdint.h>
+
+// Hack instruction set tables, written once as X-macros so that every encoder and decoder
+// is generated from the same list.
+//
+// C-instruction layout: 111a cccc ccdd djjj
+//   comp (a + c1..c6) occupies bits 12..6, dest bits 5..3, jump bits 2..0
+
+#define HACK_C_PREFIX 0xE000
+#define HACK_COMP_SHIFT 6
+#define HACK_DEST_SHIFT 3
+
+#define HACK_DEST_A 0x4
+#define HACK_DEST_D 0x2
+#define HACK_DEST_M 0x1
+
+// Program memory, and the largest value an A-instruction can load: a label or variable
+// address above it cannot be encoded
+#define HACK_ROM_SIZE 32768
+#define HACK_MAX_ADDRESS 0x7FFF
+
+// Packs up to three mnemonic characters into one switch key
+#define HACK_KEY(c0, c1, c2) \
+  ((uint32_t)(unsigned char)(c0) | ((uint32_t)(unsigned char)(c1) << 8) | ((uint32_t)(unsigned char)(c2) << 16))
+
+// X(mnemonic, c0, c1, c2, comp bits)
+#define HACK_COMP_TABLE(X) \
+  X("0",   '0', 0, 0, 0x2A) \
+  X("1",   '1', 0, 0, 0x3F) \
+  X("-1",  '-', '1', 0, 0x3A) \
+  X("D",   'D', 0, 0, 0x0C) \
+  X("A",   'A', 0, 0, 0x30) \
+  X("!D",  '!', 'D', 0, 0x0D) \
+  X("!A",  '!', 'A', 0, 0x31) \
+  X("-D",  '-', 'D', 0, 0x0F) \
+  X("-A",  '-', 'A', 0, 0x33) \
+  X("D+1", 'D', '+', '1', 0x1F) \
+  X("A+1", 'A', '+', '1', 0x37) \
+  X("D-1", 'D', '-', '1', 0x0E) \
+  X("A-1", 'A', '-', '1', 0x32) \
+  X("D+A", 'D', '+', 'A', 0x02) \
+  X("D-A", 'D', '-', 'A', 0x13) \
+  X("A-D", 'A', '-', 'D', 0x07) \
+  X("D&A", 'D', '&', 'A', 0x00) \
+  X("D|A", 'D', '|', 'A', 0x15) \
+  X("M",   'M', 0, 0, 0x70) \
+  X("!M",  '!', 'M', 0, 0x71) \
+  X("-M",  '-', 'M', 0, 0x73) \
+  X("M+1", 'M', '+', '1', 0x77) \
+  X("M-1", 'M', '-', '1', 0x72) \
+  X("D+M", 'D', '+', 'M', 0x42) \
+  X("D-M", 'D', '-', 'M', 0x53) \
+  X("M-D", 'M', '-', 'D', 0x47) \
+  X("D&M", 'D', '&', 'M', 0x40) \
+  X("D|M", 'D', '|', 'M', 0x55)
+
+// X(mnemonic, c0, c1, c2, jump bits)
+#define HACK_JUMP_TABLE(X) \
+  X("JGT", 'J', 'G', 'T', 1) \
+  X("JEQ", 'J', 'E', 'Q', 2) \
+  X("JGE", 'J', 'G', 'E', 3) \
+  X("JLT", 'J', 'L', 'T', 4) \
+  X("JNE", 'J', 'N', 'E', 5) \
+  X("JLE", 'J', 'L', 'E', 6) \
+  X("JMP", 'J', 'M', 'P', 7)
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "symbol_table.h"
+#include "arena.h"
+#include "assembler.h"
+
+// Instruction IR, built once by pass 1 and shared by the engines that need the whole
+// program before choosing addresses: the optimizer rewrites it and -c turns it into an
+// object. Every instruction is fully parsed and encoded; what is left symbolic is an ID into
+// the interned symbol table, so later passes never look at the source text again.
+// assemble_words() does not build it: patching only the forward references is cheaper than
+// a second pass over every instruction.
+
+typedef enum IrKind{
+  IR_LABEL,         // (NAME): takes no ROM word; only the first definition of a name is kept
+  IR_CONSTANT,      // numeric A-instruction; word is the value
+  IR_SYMBOL,        // @NAME; the address is looked up through symbol once it is final
+  IR_C,             // C-instruction; word is the encoding
+  IR_EXPRESSION,    // @expression over symbols; symbol is its position in HackIr.expressions
+  IR_REMOVED        // deleted by a later pass
+} IrKind;
+
+// 8 bytes per instruction
+typedef struct IrInstruction{
+  uint8_t kind;
+  uint16_t word;
+  uint32_t symbol;      // symbol table position for IR_LABEL and IR_SYMBOL
+} IrInstruction;
+
+// Text of an expression that needs symbols, kept for resolution and diagnostics
+typedef struct IrExpression{
+  Slice instruction;    // the whole instruction, '@' included, copied into the arena
+  size_t line;
+} IrExpression;
+
+typedef struct HackIr{
+  IrInstruction* items;
+  size_t count;
+  size_t word_count;              // instructions that take a ROM word
+  size_t first_program_symbol;    // table positions below this are predefined
+  IrExpression* expressions;
+  size_t expression_count;
+} HackIr;
+
+// Pass 1: tokenizes and encodes the program into IR allocated from arena. Labels get their
+// addresses in table as they are defined; every other name is interned and left undefined.
+// table must start out holding only the predefined symbols.
+bool build_ir(SymbolTable *table, Arena *arena, const char *source, size_t size, HackIr *ir,
+              AssemblyError *error);
+
+// Evaluates every IR_EXPRESSION into an IR_CONSTANT once all labels are defined. With
+// predefined_only, labels cannot be operands: passes that move code (-O) or leave label
+// addresses to the linker (-c) would make an address computed from a label stale.
+bool resolve_ir_expressions(const SymbolTable *table, HackIr *ir, bool predefined_only, AssemblyError *error);
+
+#endif
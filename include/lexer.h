@@ -0,0 +1,41 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "scan.h"
+
+// A (pointer, length) view into the source text; not NUL-terminated
+typedef struct Slice{
+  const char* ptr;
+  size_t len;
+} Slice;
+
+// Whole source text, either memory-mapped or read into a heap buffer
+typedef struct SourceBuffer{
+  const char* data;
+  size_t size;
+  bool mapped;
+} SourceBuffer;
+
+typedef struct Lexer{
+  const char* cursor;
+  const char* end;
+  size_t line_number;   // line of the most recently returned instruction
+  char* scratch;        // holds instructions that contain inner whitespace
+  size_t scratch_capacity;
+  ScanFunction scan;    // line scanner picked for this CPU
+} Lexer;
+
+// Source handling
+bool source_open(SourceBuffer* source, const char* path);
+bool source_read_stream(SourceBuffer* source, FILE* fp);
+void source_close(SourceBuffer* source);
+
+// Tokenizing
+void lexer_init(Lexer* lexer, const char* data, size_t size);
+bool lexer_next(Lexer* lexer, Slice* instruction);
+void lexer_free(Lexer* lexer);
+
+#endif
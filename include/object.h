@@ -0,0 +1,85 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "symbol_table.h"
+#include "arena.h"
+#include "assembler.h"
+
+// Separate compilation. -c assembles one module into a relocatable object (.hackobj) and
+// --link merges objects into a program. Every @NAME that is not a predefined symbol is left
+// as a relocation against the module's symbol list, which holds:
+//   - local labels: names containing '$', the scope separator of VM translator output
+//     (Function$label), visible only inside their module
+//   - exported labels: every other label the module defines
+//   - externals: names the module uses but does not define
+// The linker places modules in command-line order, defines every exported label once,
+// and walks the relocations in the same order. An external that no module exports becomes
+// a variable, allocated from 16 at its first use, unless it names a local label of another
+// module, which fails the link. So when no exported label is defined twice, linking gives the
+// same words as assembling the concatenated sources, except that local labels stay apart; a
+// duplicate fails the link, where the concatenated source would keep the first definition.
+//
+// Object file layout, in host byte order like the cache file:
+//   bytes 0-7    magic "HACKOBJ1"
+//   bytes 8-23   uint32 word count, symbol count, relocation count, name bytes
+//   then         the words (relocated ones hold 0), padded to 8 bytes
+//   then         ObjectSymbolRecord[symbol count], ObjectRelocation[relocation count]
+//   then         the names, back to back
+
+#define OBJECT_EXTENSION ".hackobj"
+#define OBJECT_MAGIC "HACKOBJ1"
+#define OBJECT_HEADER_SIZE 24
+
+typedef enum ObjectSymbolKind{
+  OBJECT_LOCAL,
+  OBJECT_EXPORTED,
+  OBJECT_EXTERNAL
+} ObjectSymbolKind;
+
+typedef struct ObjectSymbol{
+  const char* name;     // not NUL-terminated
+  uint32_t len;
+  uint32_t kind;
+  uint32_t offset;      // module-relative address of a label
+} ObjectSymbol;
+
+typedef struct ObjectRelocation{
+  uint32_t word;        // index of the A-instruction to fill in
+  uint32_t symbol;      // into the module's symbols
+} ObjectRelocation;
+
+typedef struct HackObject{
+  uint16_t* words;
+  uint32_t word_count;
+  ObjectSymbol* symbols;
+  uint32_t symbol_count;
+  ObjectRelocation* relocations;
+  uint32_t relocation_count;
+} HackObject;
+
+typedef struct LinkError{
+  size_t object;        // position of the object the error is about
+  char message[160];
+} LinkError;
+
+// Assembles one module. Its names point into the table, which must start out holding only
+// the predefined symbols.
+bool assemble_object(SymbolTable *table, Arena *arena, const char *source, size_t size,
+                     HackObject *object, AssemblyError *error);
+
+bool write_object(FILE *output, const HackObject *object, Arena *arena);
+
+// Parses an object file image. Names point into data, which must outlive the object.
+// Returns false when the image is malformed.
+bool read_object(HackObject *object, const char *data, size_t size, Arena *arena);
+
+// Links count objects into one program, leaving exported labels and variables in the table.
+// Fails when the program is longer than the ROM or an address does not fit in an A-instruction.
+bool link_objects(SymbolTable *table, Arena *arena, const HackObject *objects, size_t count,
+                  uint16_t **words, size_t *word_count, LinkError *error);
+
+#endif
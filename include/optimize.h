@@ -0,0 +1,37 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "symbol_table.h"
+#include "arena.h"
+#include "assembler.h"
+
+// Peephole optimizer (-O). It works on the pass 1 IR (see ir.h), which keeps label
+// definitions and label references symbolic. Variables are allocated first, in order of first
+// use in the original program, so RAM layout does not change. Then these patterns are removed
+// until none is left:
+//   - an A-instruction immediately followed by another one (its value is never used)
+//   - an A-instruction loading the value A already holds, when no label, A-writing
+//     instruction or unconditional jump lies in between
+//   - code after an unconditional jump, up to the next label
+// Finally label addresses are recomputed and the references to them re-encoded. Code
+// addresses are only assumed to be taken through labels, which is how compiled VM code
+// works; a program that jumps to numeric ROM addresses must not be optimized.
+
+typedef struct OptimizeReport{
+  size_t words_before;
+  size_t words_after;
+  size_t dead_loads;          // A-instructions overwritten before use
+  size_t redundant_loads;     // reloads of the value already in A
+  size_t unreachable;         // instructions after an unconditional jump
+} OptimizeReport;
+
+// Like assemble_words(), with the optimizer run before the words are produced. The table ends
+// up holding the optimized label addresses.
+bool assemble_words_optimized(SymbolTable *table, Arena *arena, const char *source, size_t size,
+                              uint16_t **words, size_t *count, AssemblyError *error,
+                              OptimizeReport *report);
+
+#endif
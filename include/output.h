@@ -0,0 +1,92 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "arena.h"
+
+// Bytes per .hack text line: 16 binary digits and a newline
+#define HACK_TEXT_LINE 17
+
+// Packed binary ROM image (.hackbin):
+//   bytes 0-3   magic "HACK"
+//   byte  4     format version
+//   byte  5     byte order of the following fields: 'L' little-endian, 'B' big-endian
+//   bytes 6-7   reserved, zero
+//   bytes 8-11  uint32 word count
+//   bytes 12-   uint16 words
+#define HACK_BIN_MAGIC "HACK"
+#define HACK_BIN_VERSION 1
+#define HACK_BIN_HEADER_SIZE 12
+
+typedef enum OutputFormat{
+  OUTPUT_TEXT,
+  OUTPUT_BINARY
+} OutputFormat;
+
+typedef enum HackEndian{
+  HACK_ENDIAN_LITTLE,
+  HACK_ENDIAN_BIG
+} HackEndian;
+
+typedef struct OutputOptions{
+  OutputFormat format;
+  HackEndian endian;    // binary format only
+} OutputOptions;
+
+// Binary digits of every nibble, most significant bit first
+extern const char HACK_NIBBLE_DIGITS[16][4];
+
+// Formatting kernel: writes the 16 binary digits of word to out, with no terminator and
+// without allocating. Everything that prints words as text goes through it.
+static inline void format_hack_word(uint16_t word, char* out) {
+  memcpy(out, HACK_NIBBLE_DIGITS[word >> 12], 4);
+  memcpy(out + 4, HACK_NIBBLE_DIGITS[(word >> 8) & 0xF], 4);
+  memcpy(out + 8, HACK_NIBBLE_DIGITS[(word >> 4) & 0xF], 4);
+  memcpy(out + 12, HACK_NIBBLE_DIGITS[word & 0xF], 4);
+}
+
+// Size of the .hack text for count words; the last line has no trailing newline
+size_t hack_text_size(size_t count);
+
+// Formats count words as .hack text into out, which must hold hack_text_size(count) bytes
+void format_hack_text(const uint16_t* words, size_t count, char* out);
+
+// Writes a whole buffer with as few system calls as possible
+bool write_all(FILE* output, const char* data, size_t size);
+
+// Formats and writes count words as .hack text in one bulk write
+bool write_hack_text(FILE* output, const uint16_t* words, size_t count);
+
+// Size of the packed binary image for count words, header included
+size_t hack_binary_size(size_t count);
+
+// Packs count words behind a binary header into out, which must hold hack_binary_size(count) bytes
+void format_hack_binary(const uint16_t* words, size_t count, HackEndian endian, unsigned char* out);
+
+// Writes count words as a packed binary ROM image in one bulk write
+bool write_hack_binary(FILE* output, const uint16_t* words, size_t count, HackEndian endian);
+
+// Writes count words in the requested format; NULL options select .hack text. The output
+// buffer is taken from arena, or from the heap when arena is NULL.
+bool write_output(FILE* output, const uint16_t* words, size_t count, const OutputOptions* options, Arena* arena);
+
+// Size of the complete output for a program of count words
+size_t output_size(size_t count, const OutputOptions* options);
+
+// Writes the format's header (binary only) at the start of out
+void format_output_header(size_t count, const OutputOptions* options, char* out);
+
+// Formats the n words that sit at positions [first, first + n) of a count-word program into
+// their place in out, a buffer of output_size(count) bytes. Disjoint ranges can be formatted
+// concurrently.
+void format_output_range(const uint16_t* words, size_t first, size_t n, size_t count,
+                         const OutputOptions* options, char* out);
+
+// File extension for an output format, including the dot
+const char* output_extension(OutputFormat format);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "symbol_table.h"
+#include "output.h"
+#include "arena.h"
+#include "assembler.h"
+
+// Runs run(ctx, i) for every i in [0, count) on up to threads threads, the caller included
+void run_parallel(int threads, size_t count, void (*run)(void* ctx, size_t index), void* ctx);
+
+// Assembles one program on several threads. The source is split into chunks at line
+// boundaries; the words are identical to assemble_words(), which is used directly when
+// threads <= 1 or the source is too small to be worth splitting.
+bool assemble_words_parallel(SymbolTable *table, Arena *arena, const char *source, size_t size, int threads,
+                             uint16_t **words, size_t *count, AssemblyError *error);
+
+// write_output with the formatting spread over several threads
+bool write_output_parallel(FILE* output, const uint16_t* words, size_t count, const OutputOptions* options,
+                           Arena* arena, int threads);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "symbol_table.h"
+#include "output.h"
+#include "arena.h"
+#include "assembler.h"
+
+// Pipelined assembly for inputs that arrive slowly (pipes, network file systems). A reader
+// thread fills batches of whole lines, the calling thread lexes and encodes them, and a
+// writer thread formats and writes them, each stage handing batches to the next through a
+// bounded single-producer/single-consumer ring. Words that reference a symbol not yet known
+// are written as placeholders and patched in place once the input ends, so output order and
+// variable numbering are exactly those of assemble_words().
+
+typedef enum PipelineResult{
+  PIPELINE_OK,
+  PIPELINE_ASSEMBLY_ERROR,   // error describes the offending instruction
+  PIPELINE_READ_ERROR,       // errno describes the failure
+  PIPELINE_WRITE_ERROR
+} PipelineResult;
+
+// Reads the program from input_fd and writes the complete output file to output_fd, which
+// must be a regular file opened for reading and writing (the placeholders are patched
+// through a shared mapping). table must start out holding the predefined symbols; fixups are
+// allocated from arena.
+PipelineResult assemble_pipelined(SymbolTable *table, Arena *arena, int input_fd, int output_fd,
+                                  const OutputOptions *options, size_t *count, AssemblyError *error);
+
+#endif
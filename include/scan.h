@@ -0,0 +1,42 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Line scanner shared by the lexer and clear_line. One call finds the end of a line, the
+// start of its comment and how much whitespace precedes the comment, looking at 16 (SSE2)
+// or 32 (AVX2) bytes at a time. The variant is picked once at run time from the CPU's
+// features; every variant gives exactly the same results as the scalar one.
+//
+// Whitespace is ' ', '\t' and '\r', so CRLF sources and tab-indented code read the same as
+// plain LF files. A comment starts at the first '/', which no valid instruction contains.
+
+typedef struct LineScan{
+  const char* end;      // the '\n' ending the line, or the end of the text
+  const char* stop;     // start of the comment, or end when there is none
+  size_t spaces;        // whitespace bytes in [line, stop)
+} LineScan;
+
+typedef void (*ScanFunction)(const char* line, const char* end, LineScan* scan);
+
+typedef struct ScanVariant{
+  const char* name;     // "scalar", "sse2" or "avx2"
+  ScanFunction scan;
+  bool available;       // built in and supported by this CPU
+} ScanVariant;
+
+static inline bool scan_is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+// The fastest available variant; HACK_SCAN=scalar|sse2|avx2 in the environment forces one
+ScanFunction scan_select(void);
+
+// Every variant this build knows about, for benchmarks and cross-checks
+const ScanVariant* scan_variants(size_t* count);
+
+// Copies [line, stop) to out without whitespace; returns the number of bytes written
+size_t scan_compact(const char* line, const char* stop, char* out);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "output.h"
+#include "hack_asm.h"
+
+// Persistent assembler daemon on a Unix domain socket. A fixed pool of worker threads, each
+// with its own warm HackAsmContext, accepts connections from the same listening socket. Every
+// connection carries one request:
+//
+//   HACKASM 1
+//   input <path>          program to read (or: source <bytes>, with the text after the headers)
+//   output <path>         file to write
+//   format text|bin
+//   endian little|big
+//   cache <path>          optional incremental cache file (see cache.h)
+//   <empty line>
+//
+// and gets one reply line: "ok <words>" or "error <line> <message>" (line 0 when the error
+// is not tied to a source line). Paths are absolute; the client resolves them.
+
+typedef struct ServerRequest{
+  const char* input_path;     // NULL to send source inline
+  const char* source;
+  size_t source_size;
+  const char* output_path;
+  const char* cache_path;     // NULL for none
+  OutputOptions options;
+} ServerRequest;
+
+// Serves requests on socket_path with the given number of worker threads until SIGINT or
+// SIGTERM, then removes the socket. Returns the process exit status.
+int serve(const char* socket_path, int threads);
+
+// Connects to a daemon; returns -1 when none is listening on socket_path
+int server_connect(const char* socket_path);
+
+// Sends one request on a connected socket and waits for the reply. On failure error
+// describes the problem and false is returned. The socket is closed either way.
+bool server_request(int fd, const ServerRequest* request, HackAsmError* error);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Instrumentation for --stats. The engines record into the AssemblyStats that the current
+// thread has made active with stats_begin(); with none active every counter is a single
+// NULL check. Building with HACK_STATS=0 (make STATS=0) compiles every hook out.
+
+#ifndef HACK_STATS
+#define HACK_STATS 1
+#endif
+
+typedef enum StatsPhase{
+  STATS_READ,
+  STATS_PASS1,      // lexing, encoding and label definition
+  STATS_PASS2,      // reference resolution and variable allocation
+  STATS_OUTPUT,     // formatting and writing
+  STATS_PHASE_COUNT
+} StatsPhase;
+
+typedef struct AssemblyStats{
+  double wall[STATS_PHASE_COUNT];     // seconds
+  double cpu[STATS_PHASE_COUNT];      // process CPU seconds, all threads
+  size_t instructions;
+  size_t labels;
+  size_t variables;
+  size_t lookups;                     // symbol-table searches
+  size_t probes;                      // slots examined by those searches
+  size_t max_probes;
+  size_t allocations;                 // heap allocations and reallocations
+  size_t bytes_allocated;
+  size_t arena_allocations;           // bump allocations served from arenas
+  size_t arena_bytes;
+  size_t cache_hits;                  // --cache blocks taken from the cache
+  size_t cache_misses;                // --cache blocks encoded from their text
+  size_t memo_lookups;                // instructions looked up in the instruction memo
+  size_t memo_hits;                   // of those, answered without parsing
+  long peak_rss_kb;
+} AssemblyStats;
+
+typedef struct StatsTimer{
+  double wall;
+  double cpu;
+} StatsTimer;
+
+// Makes stats (zeroed here) the current thread's target until stats_end()
+void stats_begin(AssemblyStats* stats);
+// Records the peak RSS and detaches the current thread
+void stats_end(void);
+AssemblyStats* stats_current(void);
+void stats_attach(AssemblyStats* stats);
+// Adds every counter of from into into (used to fold worker-thread stats together)
+void stats_merge(AssemblyStats* into, const AssemblyStats* from);
+
+void stats_timer_start(StatsTimer* timer);
+void stats_timer_stop(const StatsTimer* timer, StatsPhase phase);
+void stats_print(FILE* out, const AssemblyStats* stats, bool json);
+
+#if HACK_STATS
+
+extern _Thread_local AssemblyStats* stats_active;
+
+#define STATS_ADD(field, n) do { if (stats_active) stats_active->field += (n); } while (0)
+#define STATS_ALLOC(bytes) do { if (stats_active) { stats_active->allocations++; \
+                                                   stats_active->bytes_allocated += (bytes); } } while (0)
+#define STATS_ARENA_ALLOC(bytes) do { if (stats_active) { stats_active->arena_allocations++; \
+                                                         stats_active->arena_bytes += (bytes); } } while (0)
+#define STATS_PROBES(n) do { if (stats_active) { stats_active->lookups++; stats_active->probes += (n); \
+                             if ((n) > stats_active->max_probes) stats_active->max_probes = (n); } } while (0)
+#define STATS_PHASE_START(timer) StatsTimer timer; stats_timer_start(&timer)
+#define STATS_PHASE_STOP(timer, phase) stats_timer_stop(&timer, phase)
+
+#else
+
+#define STATS_ADD(field, n) ((void)0)
+#define STATS_ALLOC(bytes) ((void)0)
+#define STATS_ARENA_ALLOC(bytes) ((void)0)
+#define STATS_PROBES(n) ((void)0)
+#define STATS_PHASE_START(timer) ((void)0)
+#define STATS_PHASE_STOP(timer, phase) ((void)0)
+
+#endif
+
+#endif
@@ -2,28 +2,65 @@
 #define SYMBOL_TABLE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Address of a symbol that has been referenced but not yet defined
+#define SYMBOL_UNDEFINED (-1)
+
+// Position returned by symbol_table_find() for a missing name
+#define SYMBOL_NOT_FOUND ((size_t)-1)
 
 typedef struct Symbol{
-    const char *name;
+    size_t name_offset;     // offset of the NUL-terminated name inside the string arena
+    uint32_t name_length;
+    uint32_t hash;
     int address;
+    bool variable;          // address allocated to a variable rather than defined by a label
 } Symbol;
 
 typedef struct SymbolTable{
-    Symbol *symbols;
+    Symbol *symbols;        // symbols in insertion order
     size_t size;
     size_t capacity;
+
+    uint32_t *slots;        // open-addressing index: symbol position + 1, 0 marks an empty slot
+    size_t slot_count;      // always a power of two
+
+    char *names;            // string arena holding every interned name
+    size_t names_size;
+    size_t names_capacity;
 } SymbolTable;
 
 // Initialization and cleanup
 void symbol_table_init(SymbolTable *table, size_t initial_capacity);
 void symbol_table_free(SymbolTable *table);
 
+// Replaces the contents of an initialized table with a copy of src, reusing its buffers
+void symbol_table_copy(SymbolTable *table, const SymbolTable *src);
+
 // Symbol operations
 bool symbol_table_contains(SymbolTable *table, const char *name);
 bool symbol_table_get_address(SymbolTable *table, const char *name, int *address);
 bool symbol_table_add(SymbolTable *table, const char *name, int address);
 
+// Looks the name up once and inserts it with the given address when absent.
+// The resolved address is stored in *address; returns true if the symbol was inserted.
+bool symbol_table_get_or_add(SymbolTable *table, const char *name, int new_address, int *address);
+
+// Read-only lookup of a length-byte name; safe to call from several threads at once
+bool symbol_table_lookup(const SymbolTable *table, const char *name, size_t length, int *address);
+
+// Like symbol_table_lookup(), returning the position of the defined symbol or SYMBOL_NOT_FOUND
+size_t symbol_table_find(const SymbolTable *table, const char *name, size_t length);
+
+// Returns the position of the length-byte name, inserting it as SYMBOL_UNDEFINED when absent.
+// Undefined symbols behave as forward references: contains/get_address skip them
+// and add/get_or_add define them in place.
+size_t symbol_table_intern(SymbolTable *table, const char *name, size_t length);
+
 // Utilities
+const char* symbol_table_name(const SymbolTable *table, size_t index);
 void symbol_table_print(SymbolTable *table);
 
-#endif
\ No newline at end of file
+#endif
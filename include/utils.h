@@ -4,6 +4,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+
+// Allocating helpers return heap strings that the caller frees
 
 // String manipulation
 char* append_strings(const char *a, const char *b);
@@ -18,8 +21,10 @@ char* clear_line(char* line);
 // Number conversion
 char* convert_to_binary(char* num);
 char* int_to_string(int num);
+void word_to_binary(uint16_t word, char* out);
 
 // Utilities
 int string_search(const char* str, char c);
+void* grow_array(void* array, size_t* capacity, size_t element_size);
 
 #endif
\ No newline at end of file
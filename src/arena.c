@@ -0,0 +1,167 @@
+#include "arena.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define ARENA_ALIGN (sizeof(max_align_t))
+#define BLOCK_HEADER (((sizeof(ArenaBlock) + ARENA_ALIGN - 1) / ARENA_ALIGN) * ARENA_ALIGN)
+
+static size_t align_up(size_t size) {
+  return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static char* block_data(ArenaBlock* block) {
+  return (char*)block + BLOCK_HEADER;
+}
+
+static ArenaBlock* new_block(size_t capacity) {
+
+  // size_t -> ArenaBlock*
+  // Allocates a block with room for capacity bytes, exiting if memory runs out
+
+  ArenaBlock* block = malloc(BLOCK_HEADER + capacity);
+  STATS_ALLOC(BLOCK_HEADER + capacity);
+  if (!block) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(1);
+  }
+  block->next = NULL;
+  block->capacity = capacity;
+  block->used = 0;
+  return block;
+}
+
+void arena_init(Arena* arena, size_t block_size) {
+
+  // Arena*, size_t -> void
+  // Prepares an empty arena; no memory is taken until the first allocation
+
+  arena->first = NULL;
+  arena->current = NULL;
+  arena->large = NULL;
+  arena->block_size = block_size < 1024 ? 1024 : align_up(block_size);
+}
+
+static void* alloc_large(Arena* arena, size_t size) {
+  ArenaBlock* block = new_block(size);
+  block->used = size;
+  block->next = arena->large;
+  arena->large = block;
+  return block_data(block);
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+
+  // Arena*, size_t -> void*
+  // Returns size bytes of max_align_t-aligned memory that lives until the arena is reset
+
+  size = align_up(size ? size : 1);
+  STATS_ARENA_ALLOC(size);
+  if (size > arena->block_size / 2) {
+    return alloc_large(arena, size);
+  }
+
+  ArenaBlock* block = arena->current;
+  while (!block || block->used + size > block->capacity) {
+    if (block && block->next) {
+      block = block->next;     // reuse a block kept from before a reset
+      block->used = 0;
+    } else {
+      ArenaBlock* fresh = new_block(arena->block_size);
+      if (block) block->next = fresh;
+      else arena->first = fresh;
+      block = fresh;
+    }
+  }
+  arena->current = block;
+
+  void* ptr = block_data(block) + block->used;
+  block->used += size;
+  return ptr;
+}
+
+void* arena_resize(Arena* arena, void* ptr, size_t old_size, size_t new_size) {
+
+  // Arena*, void*, size_t, size_t -> void*
+  // Grows an allocation. The most recent allocation of a block grows in place when it fits,
+  // dedicated blocks are reallocated, and anything else is copied to a new allocation.
+
+  if (!ptr) return arena_alloc(arena, new_size);
+
+  size_t old_aligned = align_up(old_size ? old_size : 1);
+  ArenaBlock* block = arena->current;
+  if (block && (char*)ptr + old_aligned == block_data(block) + block->used) {
+    size_t extra = align_up(new_size) - old_aligned;
+    if (new_size <= arena->block_size / 2 && block->used + extra <= block->capacity) {
+      block->used += extra;
+      return ptr;
+    }
+  }
+
+  ArenaBlock** link = &arena->large;
+  while (*link) {
+    if (block_data(*link) == (char*)ptr) {
+      ArenaBlock* next = (*link)->next;
+      ArenaBlock* grown = realloc(*link, BLOCK_HEADER + align_up(new_size));
+      STATS_ALLOC(BLOCK_HEADER + align_up(new_size));
+      if (!grown) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+      }
+      grown->capacity = grown->used = align_up(new_size);
+      grown->next = next;
+      *link = grown;
+      return block_data(grown);
+    }
+    link = &(*link)->next;
+  }
+
+  void* moved = arena_alloc(arena, new_size);
+  memcpy(moved, ptr, old_size);
+  return moved;
+}
+
+void arena_reset(Arena* arena) {
+
+  // Arena* -> void
+  // Releases every allocation. Dedicated blocks go back to the system; regular blocks are
+  // kept for the next run.
+
+  while (arena->large) {
+    ArenaBlock* next = arena->large->next;
+    free(arena->large);
+    arena->large = next;
+  }
+  arena->current = arena->first;
+  if (arena->current) arena->current->used = 0;
+}
+
+void arena_free(Arena* arena) {
+
+  // Arena* -> void
+  // Returns all of the arena's memory to the system
+
+  arena_reset(arena);
+  ArenaBlock* block = arena->first;
+  while (block) {
+    ArenaBlock* next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->first = NULL;
+  arena->current = NULL;
+}
+
+void* arena_grow_array(Arena* arena, void* array, size_t* capacity, size_t element_size) {
+
+  // Arena*, void*, size_t*, size_t -> void*
+  // Doubles the capacity of a dynamic array held in the arena
+
+  size_t new_capacity = *capacity ? *capacity * 2 : 1024;
+  void* grown = arena_resize(arena, array, *capacity * element_size, new_capacity * element_size);
+  *capacity = new_capacity;
+  return grown;
+}
@@ -3,96 +3,356 @@
 #include <stdlib.h>
 #include "symbol_table.h"
 #include "utils.h"
+#include "lexer.h"
+#include "hack_isa.h"
+#include "output.h"
+#include "arena.h"
+#include "stats.h"
+#include "expression.h"
 #include <stdbool.h>
+#include <stdint.h>
 
-void assemble(FILE *input, FILE *output) {
+bool assemble(FILE *input, FILE *output) {
 
-  // FILE*, FILE* -> void
-  // Main assembler function: reads assembly code from input, translates instructions, and writes binary to output
+  // FILE*, FILE* -> bool
+  // Reads the whole input stream with buffered reads and assembles it into output
+
+  SourceBuffer source;
+  if (!source_read_stream(&source, input)) {
+    fprintf(stderr, "Error reading input\n");
+    return false;
+  }
+  bool ok = assemble_source(source.data, source.size, output, NULL);
+  source_close(&source);
+  return ok;
+}
+
+bool assemble_source(const char *source, size_t size, FILE *output, const OutputOptions *options) {
+
+  // String, size_t, FILE*, OutputOptions* -> bool
+  // Assembles source text into output using a fresh table of predefined symbols
 
   SymbolTable table;
   symbol_table_init(&table, 23);
   add_predefined_symbols(&table);
+  bool ok = assemble_with_table(&table, NULL, source, size, output, options);
+  symbol_table_free(&table);
+  return ok;
+}
 
-  char *line;
-  size_t line_number = 0;
+void set_assembly_error(AssemblyError *error, size_t line, const char *message, Slice ins) {
 
-  // First pass: process labels and add them to the symbol table
-  while((line = read_line(input)) != NULL) {
-    char* cleared_line = clear_line(line);
-    if (strlen(cleared_line) == 0) {
-      free(cleared_line);
-      free(line);
-      continue;
-    }
+  // AssemblyError*, size_t, String, Slice -> void
+  // Records a diagnostic together with a copy of the offending instruction
 
-    if(is_label(cleared_line)) {
-      char* label = extract_label(cleared_line);
-      symbol_table_add(&table, label, line_number);
-      free(label);
-      continue;
+  if (!error) return;
+  error->line = line;
+  error->message = message;
+  error->text_len = ins.len < sizeof(error->text) ? ins.len : sizeof(error->text);
+  memcpy(error->text, ins.ptr, error->text_len);
+}
+
+void set_word_error(AssemblyError *error, const char *source, size_t size, size_t word, const char *message) {
+
+  // AssemblyError*, String, size_t, size_t, String -> void
+  // Records a diagnostic for the instruction that encodes to the given ROM word. Only used
+  // once an engine has failed, so the source is simply read again up to that instruction;
+  // it must already have assembled through pass 1.
+
+  Lexer lexer;
+  lexer_init(&lexer, source, size);
+  Slice ins;
+  size_t count = 0;
+  while (lexer_next(&lexer, &ins)) {
+    if (ins.ptr[0] == '(') continue;
+    if (count++ == word) {
+      set_assembly_error(error, lexer.line_number, message, ins);
+      break;
     }
+  }
+  lexer_free(&lexer);
+}
+
+void print_assembly_error(const char *name, const AssemblyError *error) {
+
+  // String, AssemblyError* -> void
+  // Prints one diagnostic line, prefixed with the source name when there is one
 
-    line_number++;
+  if (name) {
+    fprintf(stderr, "%s: line %zu: %s '%.*s'\n", name, error->line, error->message, (int)error->text_len, error->text);
+  } else {
+    fprintf(stderr, "Line %zu: %s '%.*s'\n", error->line, error->message, (int)error->text_len, error->text);
   }
+}
 
-  fseek(input, 0, SEEK_SET);
-  size_t variable_address = 16;
+bool assemble_with_table(SymbolTable *table, const char *name_prefix, const char *source, size_t size,
+                         FILE *output, const OutputOptions *options) {
 
-  // Second pass: translate instructions
-  while((line = read_line(input)) != NULL) {
-    char* cleared_line = clear_line(line);
-    if (strlen(cleared_line) == 0) {
-      free(cleared_line);
-      free(line);
-      continue;
-    }
+  // SymbolTable*, String, String, size_t, FILE*, OutputOptions* -> bool
+  // Assembles source text and writes the words in the format given by options (.hack text
+  // when NULL). Errors are reported on stderr, prefixed with name_prefix when it is set.
+  // Everything the run allocates comes from one arena that is released in a single step.
+
+  Arena arena;
+  arena_init(&arena, 1 << 16);
+
+  uint16_t *words;
+  size_t word_count;
+  AssemblyError error;
+  bool ok = assemble_words(table, &arena, source, size, &words, &word_count, &error);
+  if (!ok) {
+    print_assembly_error(name_prefix, &error);
+  }
+  else if (!write_output(output, words, word_count, options, &arena)) {
+    perror("Error writing output file");
+    ok = false;
+  }
 
-    if (is_label(cleared_line)) continue;
-
-    if (cleared_line[0] == '@') {  // A-instruction
-      if (is_A_instruction(cleared_line)) {
-        char* translated_instruction = translate_A_instruction(cleared_line);
-        write_instruction_to_file(translated_instruction, output);
-        free(translated_instruction);
-      } 
-      else {  // variable
-        char* variable_name = cleared_line + 1;
-        if (symbol_table_contains(&table, variable_name)) {
-          int address = 0;
-          symbol_table_get_address(&table, variable_name, &address);
-          char* str_address = int_to_string(address);
-          char* binary_address = convert_to_binary(str_address);
-          char* translated_instruction = pad_left(binary_address, 16);
-          write_instruction_to_file(translated_instruction, output);
-          free(str_address);
-          free(binary_address);
-          free(translated_instruction);
+  arena_free(&arena);
+  return ok;
+}
+
+// A reference to a symbol that had no usable address yet when it was read
+typedef struct Fixup{
+  size_t index;
+  size_t symbol;
+} Fixup;
+
+// An expression with a symbol operand, evaluated once every label is known
+typedef struct ExpressionFixup{
+  size_t index;
+  size_t line;
+  Slice instruction;    // '@' included, copied into the arena
+} ExpressionFixup;
+
+bool assemble_words(SymbolTable *table, Arena *arena, const char *source, size_t size,
+                    uint16_t **words_out, size_t *count_out, AssemblyError *error) {
+
+  // SymbolTable*, Arena*, String, size_t, uint16_t**, size_t*, AssemblyError* -> bool
+  // Main assembler function: tokenizes the source text in place and encodes every instruction
+  // in a single pass. References to symbols that are not known yet are recorded as fixups and
+  // patched once all labels are defined, so the text is only read once. The encoded words are
+  // allocated from arena. On an invalid instruction error is filled in and false is returned.
+  // table must start out holding the predefined symbols and ends up holding the program's
+  // symbols; the function keeps no other state, so separate tables can be used concurrently.
+  // The engines that rewrite or relocate code (-O, -c) work on the IR of ir.h instead, which
+  // costs an extra pass over every instruction.
+
+  uint16_t* words = NULL;
+  size_t word_count = 0, word_capacity = 0;
+  Fixup* fixups = NULL;
+  size_t fixup_count = 0, fixup_capacity = 0;
+  ExpressionFixup* expressions = NULL;
+  size_t expression_count = 0, expression_capacity = 0;
+
+  InstructionMemo* memo = arena_alloc(arena, sizeof(InstructionMemo));
+  instruction_memo_init(memo);
+
+  Lexer lexer;
+  lexer_init(&lexer, source, size);
+  bool ok = true;
+
+  STATS_PHASE_START(pass1);
+  Slice ins;
+  while (lexer_next(&lexer, &ins)) {
+    uint16_t word = 0;
+    Slice name;
+    const char* message;
+
+    switch (parse_instruction_memo(memo, ins, &word, &name, &message)) {
+      case INSTRUCTION_LABEL: {
+        size_t symbol = symbol_table_intern(table, name.ptr, name.len);
+        if (table->symbols[symbol].address == SYMBOL_UNDEFINED) {   // first definition wins
+          table->symbols[symbol].address = (int)word_count;
+        }
+        STATS_ADD(labels, 1);
+        continue;
+      }
+      case INSTRUCTION_SYMBOL: {  // label or variable, possibly defined further down
+        size_t symbol = symbol_table_intern(table, name.ptr, name.len);
+        int address = table->symbols[symbol].address;
+        // A label past the end of the ROM is left to pass 2, which reports it
+        if (address != SYMBOL_UNDEFINED && address <= HACK_MAX_ADDRESS) {
+          word = (uint16_t)address;
         }
         else {
-          symbol_table_add(&table, variable_name, variable_address++);
-          int address = 0;
-          symbol_table_get_address(&table, variable_name, &address);
-          char* str_address = int_to_string(address);
-          char* binary_address = convert_to_binary(str_address);
-          char* translated_instruction = pad_left(binary_address, 16);
-          write_instruction_to_file(translated_instruction, output);
-          free(binary_address);
-          free(translated_instruction);
+          if (fixup_count == fixup_capacity) {
+            fixups = arena_grow_array(arena, fixups, &fixup_capacity, sizeof(Fixup));
+          }
+          fixups[fixup_count].index = word_count;
+          fixups[fixup_count].symbol = symbol;
+          fixup_count++;
+        }
+        break;
+      }
+      case INSTRUCTION_EXPRESSION: {
+        if (expression_count == expression_capacity) {
+          expressions = arena_grow_array(arena, expressions, &expression_capacity, sizeof(ExpressionFixup));
         }
+        char* text = arena_alloc(arena, ins.len);
+        memcpy(text, ins.ptr, ins.len);
+        expressions[expression_count++] = (ExpressionFixup){ word_count, lexer.line_number, { text, ins.len } };
+        break;
       }
+      case INSTRUCTION_WORD:
+        break;
+      case INSTRUCTION_INVALID:
+        set_assembly_error(error, lexer.line_number, message, ins);
+        ok = false;
+        break;
     }
-    else { // C-instruction
-      char* translated_instruction = translate_C_instruction(cleared_line);
-      write_instruction_to_file(translated_instruction, output);
-      free(translated_instruction);
+    if (!ok) break;
+
+    if (word_count == word_capacity) {
+      words = arena_grow_array(arena, words, &word_capacity, sizeof(uint16_t));
+    }
+    words[word_count++] = word;
+  }
+  lexer_free(&lexer);
+  instruction_memo_flush(memo);
+  STATS_PHASE_STOP(pass1, STATS_PASS1);
+  if (!ok) return false;
+
+  // Expressions first, in source order, so that their errors come before the ROM size
+  for (size_t i = 0; i < expression_count; i++) {
+    Slice text = { expressions[i].instruction.ptr + 1, expressions[i].instruction.len - 1 };
+    const char* message;
+    ExpressionResult result = evaluate_expression(text, table, table->size, &words[expressions[i].index], &message);
+    if (result != EXPRESSION_VALUE) {
+      if (result == EXPRESSION_UNRESOLVED) message = "expression operand is not a label or predefined symbol in";
+      set_assembly_error(error, expressions[i].line, message, expressions[i].instruction);
+      return false;
     }
+  }
+  if (word_count > HACK_ROM_SIZE) {
+    set_word_error(error, source, size, HACK_ROM_SIZE, "program does not fit in the 32768-word ROM at");
+    return false;
+  }
 
-    free(cleared_line);
-    free(line);
+  // Resolve forward references: symbols still undefined after all labels are known are
+  // variables, allocated from address 16 in order of first use
+  STATS_PHASE_START(pass2);
+  int variable_address = 16;
+  for (size_t i = 0; i < fixup_count; i++) {
+    Symbol* symbol = &table->symbols[fixups[i].symbol];
+    if (symbol->address == SYMBOL_UNDEFINED) {
+      symbol->address = variable_address++;
+      symbol->variable = true;
+    }
+    if (symbol->address > HACK_MAX_ADDRESS) {
+      set_word_error(error, source, size, fixups[i].index, "address out of range in");
+      return false;
+    }
+    words[fixups[i].index] = (uint16_t)symbol->address;
   }
+  STATS_ADD(variables, variable_address - 16);
+  STATS_ADD(instructions, word_count);
+  STATS_PHASE_STOP(pass2, STATS_PASS2);
 
-  symbol_table_free(&table);
+  *words_out = words;
+  *count_out = word_count;
+  return true;
+}
+
+InstructionKind parse_instruction(Slice ins, uint16_t* word, Slice* symbol, const char** error) {
+
+  // Slice, uint16_t*, Slice*, String* -> InstructionKind
+  // Classifies one cleaned instruction. Numeric A-instructions, expressions over numbers only
+  // and C-instructions are encoded into *word; labels and symbolic A-instructions return the
+  // symbol name in *symbol, and other expressions their text after '@'.
+  // Uses no shared state, so it can run on many threads at once.
+
+  if (ins.ptr[0] == '(') {
+    symbol->ptr = ins.ptr + 1;
+    symbol->len = ins.len >= 2 ? ins.len - 2 : 0;
+    return INSTRUCTION_LABEL;
+  }
+
+  if (ins.ptr[0] == '@') {
+    Slice operand = { ins.ptr + 1, ins.len - 1 };
+    if (ins.len > 1 && ins.ptr[1] >= '0' && ins.ptr[1] <= '9') {
+      long value = 0;
+      size_t i = 1;
+      for (; i < ins.len && ins.ptr[i] >= '0' && ins.ptr[i] <= '9'; i++) {
+        if (value <= 32767) value = value * 10 + (ins.ptr[i] - '0');
+      }
+      if (i == ins.len || !is_expression(operand)) {
+        if (value > 32767) {
+          *error = "constant out of range in";
+          return INSTRUCTION_INVALID;
+        }
+        *word = (uint16_t)value;
+        return INSTRUCTION_WORD;
+      }
+    }
+    if (ins.len > 1 && is_expression(operand)) {
+      switch (evaluate_expression(operand, NULL, 0, word, error)) {
+        case EXPRESSION_VALUE: return INSTRUCTION_WORD;
+        case EXPRESSION_UNRESOLVED:
+          *symbol = operand;
+          return INSTRUCTION_EXPRESSION;
+        default: return INSTRUCTION_INVALID;
+      }
+    }
+    *symbol = operand;
+    return INSTRUCTION_SYMBOL;
+  }
+
+  if (!encode_C_instruction(ins.ptr, ins.len, word)) {
+    *error = "invalid instruction";
+    return INSTRUCTION_INVALID;
+  }
+  return INSTRUCTION_WORD;
+}
+
+void instruction_memo_init(InstructionMemo* memo) {
+  memset(memo, 0, sizeof(*memo));
+}
+
+void instruction_memo_flush(InstructionMemo* memo) {
+
+  // InstructionMemo* -> void
+  // Adds the memo's counters to the current thread's statistics and zeroes them; counting
+  // locally keeps the thread-local statistics lookup off the per-instruction path
+
+  STATS_ADD(memo_lookups, memo->lookups);
+  STATS_ADD(memo_hits, memo->hits);
+  memo->lookups = 0;
+  memo->hits = 0;
+}
+
+InstructionKind parse_instruction_memo(InstructionMemo* memo, Slice ins, uint16_t* word, Slice* symbol,
+                                       const char** error) {
+
+  // InstructionMemo*, Slice, uint16_t*, Slice*, String* -> InstructionKind
+  // parse_instruction() with its result for context-free instructions remembered. The key is
+  // the text zero-padded to 16 bytes, hashed as two 64-bit halves.
+
+  bool numeric = ins.ptr[0] == '@' && ins.len > 1 && ins.ptr[1] >= '0' && ins.ptr[1] <= '9';
+  bool memoizable = ins.len <= INSTRUCTION_MEMO_KEY && ins.ptr[0] != '(' && (ins.ptr[0] != '@' || numeric);
+  if (!memoizable) return parse_instruction(ins, word, symbol, error);
+
+  char key[16] = { 0 };
+  memcpy(key, ins.ptr, ins.len);
+  uint64_t low, high;
+  memcpy(&low, key, 8);
+  memcpy(&high, key + 8, 8);
+  uint64_t hash = (low ^ (high * 0x9E3779B97F4A7C15ull)) * 0xFF51AFD7ED558CCDull;
+  InstructionMemoEntry* entry = &memo->entries[hash >> (64 - INSTRUCTION_MEMO_BITS)];
+
+  memo->lookups++;
+  if (memcmp(entry->text, key, INSTRUCTION_MEMO_KEY) == 0) {
+    memo->hits++;
+    *word = entry->word;
+    return INSTRUCTION_WORD;
+  }
+
+  InstructionKind kind = parse_instruction(ins, word, symbol, error);
+  if (kind == INSTRUCTION_WORD) {
+    memcpy(entry->text, key, INSTRUCTION_MEMO_KEY);
+    entry->word = *word;
+  }
+  return kind;
 }
 
 void add_predefined_symbols(SymbolTable *st) {
@@ -144,103 +404,95 @@ char* translate_A_instruction(char* ins) {
   // String -> String
   // Translates a numeric A-instruction into a 16-bit binary string
 
+  long value = strtol(ins + 1, NULL, 10);
+  if (value >= 0 && value <= 0xFFFF) {
+    char* binary_instruction = malloc(17);
+    if (binary_instruction) word_to_binary((uint16_t)value, binary_instruction);
+    return binary_instruction;
+  }
+
+  // Out of range: keep the historical digits, padded or not
   char* binary_number = convert_to_binary(ins + 1);
   char* binary_instruction = pad_left(binary_number, 16);
   free(binary_number);
   return binary_instruction;
 }
 
+static bool lookup_comp(const char* comp, size_t len, uint16_t* bits) {
+
+  // Slice, uint16_t* -> bool
+  // Maps a comp mnemonic to its 7 bits through a switch generated from HACK_COMP_TABLE
+
+  if (len == 0 || len > 3) return false;
+  uint32_t key = HACK_KEY(comp[0], len > 1 ? comp[1] : 0, len > 2 ? comp[2] : 0);
+  switch (key) {
+#define X(name, c0, c1, c2, code) case HACK_KEY(c0, c1, c2): *bits = code; return true;
+    HACK_COMP_TABLE(X)
+#undef X
+    default: return false;
+  }
+}
+
+static bool lookup_jump(const char* jmp, size_t len, uint16_t* bits) {
+
+  // Slice, uint16_t* -> bool
+  // Maps a jump mnemonic to its 3 bits through a switch generated from HACK_JUMP_TABLE
+
+  if (len == 0) {
+    *bits = 0;
+    return true;
+  }
+  if (len != 3) return false;
+  switch (HACK_KEY(jmp[0], jmp[1], jmp[2])) {
+#define X(name, c0, c1, c2, code) case HACK_KEY(c0, c1, c2): *bits = code; return true;
+    HACK_JUMP_TABLE(X)
+#undef X
+    default: return false;
+  }
+}
+
+bool encode_C_instruction(const char* ins, size_t len, uint16_t* word) {
+
+  // Slice, uint16_t* -> bool
+  // Encodes a C-instruction (dest=comp;jmp) given as a slice into its 16-bit word without
+  // allocating. Returns false if any field is not a valid mnemonic.
+
+  const char* equals = memchr(ins, '=', len);
+  const char* semicolon = memchr(ins, ';', len);
+  const char* comp = equals ? equals + 1 : ins;
+  const char* comp_end = semicolon ? semicolon : ins + len;
+  if (comp_end < comp) return false;
+
+  uint16_t dest_bits = 0;
+  if (equals) {
+    for (const char* c = ins; c < equals; c++) {
+      switch (*c) {
+        case 'A': dest_bits |= HACK_DEST_A; break;
+        case 'D': dest_bits |= HACK_DEST_D; break;
+        case 'M': dest_bits |= HACK_DEST_M; break;
+        default: return false;
+      }
+    }
+  }
+
+  uint16_t comp_bits, jump_bits = 0;
+  if (!lookup_comp(comp, comp_end - comp, &comp_bits)) return false;
+  if (semicolon && !lookup_jump(semicolon + 1, ins + len - semicolon - 1, &jump_bits)) return false;
+
+  *word = HACK_C_PREFIX | (comp_bits << HACK_COMP_SHIFT) | (dest_bits << HACK_DEST_SHIFT) | jump_bits;
+  return true;
+}
+
 char* translate_C_instruction(char* ins) {
 
   // String -> String
-  // Translates a C-instruction into a 16-bit binary string
-
-  CInstructionParts* parts = extract_C_instruction_parts(ins);
-  char *dest = parts->dest ? strdup(parts->dest) : NULL;
-  char *comp = parts->comp ? strdup(parts->comp) : NULL;
-  char *jmp  = parts->jmp  ? strdup(parts->jmp)  : NULL;
-
-  char* A_bit = NULL;
-  char* M_bit = NULL;
-  char* D_bit = NULL; 
-  char* translated_dest;
-  char* translated_comp;
-  char* translated_jmp;
-  char* translated_instruction;
-
-  // Encode destination bits
-  if (dest == NULL) {
-    translated_dest = strdup("000");
-  } else {
-    A_bit = strdup(string_search(dest, 'A') != -1 ? "1" : "0");
-    M_bit = strdup(string_search(dest, 'M') != -1 ? "1" : "0");
-    D_bit = strdup(string_search(dest, 'D') != -1 ? "1" : "0");
-    char* tmp = append_strings(A_bit, D_bit);
-    translated_dest = append_strings(tmp, M_bit);
-    free(tmp);
-  }
+  // Translates a C-instruction into a 16-bit binary string, or returns NULL if it is invalid
 
-  // Encode computation bits
-  if (strcmp(comp, "0") == 0) translated_comp = strdup("0101010");
-  else if (strcmp(comp, "1") == 0) translated_comp = strdup("0111111");
-  else if (strcmp(comp, "-1") == 0) translated_comp = strdup("0111010");
-  else if (strcmp(comp, "D") == 0) translated_comp = strdup("0001100");
-  else if (strcmp(comp, "A") == 0) translated_comp = strdup("0110000");
-  else if (strcmp(comp, "!D") == 0) translated_comp = strdup("0001101");
-  else if (strcmp(comp, "!A") == 0) translated_comp = strdup("0110001");
-  else if (strcmp(comp, "-D") == 0) translated_comp = strdup("0001111");
-  else if (strcmp(comp, "-A") == 0) translated_comp = strdup("0110011");
-  else if (strcmp(comp, "D+1") == 0) translated_comp = strdup("0011111");
-  else if (strcmp(comp, "A+1") == 0) translated_comp = strdup("0110111");
-  else if (strcmp(comp, "D-1") == 0) translated_comp = strdup("0001110");
-  else if (strcmp(comp, "A-1") == 0) translated_comp = strdup("0110010");
-  else if (strcmp(comp, "D+A") == 0) translated_comp = strdup("0000010");
-  else if (strcmp(comp, "D-A") == 0) translated_comp = strdup("0010011");
-  else if (strcmp(comp, "A-D") == 0) translated_comp = strdup("0000111");
-  else if (strcmp(comp, "D&A") == 0) translated_comp = strdup("0000000");
-  else if (strcmp(comp, "D|A") == 0) translated_comp = strdup("0010101");
-  else if (strcmp(comp, "M") == 0) translated_comp = strdup("1110000");
-  else if (strcmp(comp, "!M") == 0) translated_comp = strdup("1110001");
-  else if (strcmp(comp, "-M") == 0) translated_comp = strdup("1110011");
-  else if (strcmp(comp, "M+1") == 0) translated_comp = strdup("1110111");
-  else if (strcmp(comp, "M-1") == 0) translated_comp = strdup("1110010");
-  else if (strcmp(comp, "D+M") == 0) translated_comp = strdup("1000010");
-  else if (strcmp(comp, "D-M") == 0) translated_comp = strdup("1010011");
-  else if (strcmp(comp, "M-D") == 0) translated_comp = strdup("1000111");
-  else if (strcmp(comp, "D&M") == 0) translated_comp = strdup("1000000");
-  else if (strcmp(comp, "D|M") == 0) translated_comp = strdup("1010101");
-
-  // Encode jump bits
-  if (jmp == NULL || strcmp(jmp, "") == 0) translated_jmp = strdup("000");
-  else if (strcmp(jmp, "JGT") == 0) translated_jmp = strdup("001");
-  else if (strcmp(jmp, "JEQ") == 0) translated_jmp = strdup("010");
-  else if (strcmp(jmp, "JGE") == 0) translated_jmp = strdup("011");
-  else if (strcmp(jmp, "JLT") == 0) translated_jmp = strdup("100");
-  else if (strcmp(jmp, "JNE") == 0) translated_jmp = strdup("101");
-  else if (strcmp(jmp, "JLE") == 0) translated_jmp = strdup("110");
-  else if (strcmp(jmp, "JMP") == 0) translated_jmp = strdup("111");
-
-  // Combine into final instruction
-  char* tmp1 = append_strings("111", translated_comp);
-  char* tmp2 = append_strings(tmp1, translated_dest);
-  translated_instruction = append_strings(tmp2, translated_jmp);
-
-  free(tmp1);
-  free(tmp2);
-  free(translated_dest);
-  free(translated_comp);
-  free(translated_jmp);
-  free(A_bit);
-  free(D_bit);
-  free(M_bit);
-  free(dest);
-  free(comp);
-  free(jmp);
-  free(parts->dest);
-  free(parts->comp);
-  free(parts->jmp);
-  free(parts);
+  uint16_t word;
+  if (!encode_C_instruction(ins, strlen(ins), &word)) return NULL;
 
+  char* translated_instruction = malloc(17);
+  word_to_binary(word, translated_instruction);
   return translated_instruction;
 }
 
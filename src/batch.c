@@ -0,0 +1,208 @@
+#include "batch.h"
+#include "hack_asm.h"
+#include "lexer.h"
+#include "compress.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+// Each worker owns a deque of job indices: it takes work from the front of its own deque,
+// which holds its largest remaining files, and steals from the back of other workers' deques
+// once its own runs dry. No jobs are created after start-up, so a worker stops as soon as
+// every deque is empty.
+typedef struct WorkQueue{
+  size_t* items;
+  size_t head;
+  size_t tail;
+  pthread_mutex_t lock;
+} WorkQueue;
+
+typedef struct BatchPool{
+  BatchJob* jobs;
+  WorkQueue* queues;
+  int worker_count;
+  const OutputOptions* options;
+} BatchPool;
+
+typedef struct Worker{
+  BatchPool* pool;
+  int id;
+} Worker;
+
+static bool queue_pop_front(WorkQueue* queue, size_t* item) {
+  pthread_mutex_lock(&queue->lock);
+  bool found = queue->head < queue->tail;
+  if (found) *item = queue->items[queue->head++];
+  pthread_mutex_unlock(&queue->lock);
+  return found;
+}
+
+static bool queue_pop_back(WorkQueue* queue, size_t* item) {
+  pthread_mutex_lock(&queue->lock);
+  bool found = queue->head < queue->tail;
+  if (found) *item = queue->items[--queue->tail];
+  pthread_mutex_unlock(&queue->lock);
+  return found;
+}
+
+static bool next_job(Worker* worker, size_t* job) {
+
+  // Worker*, size_t* -> bool
+  // Takes the next job from the worker's own queue, or steals one from another worker
+
+  BatchPool* pool = worker->pool;
+  if (queue_pop_front(&pool->queues[worker->id], job)) return true;
+
+  for (int i = 1; i < pool->worker_count; i++) {
+    int victim = (worker->id + i) % pool->worker_count;
+    if (queue_pop_back(&pool->queues[victim], job)) return true;
+  }
+  return false;
+}
+
+static bool assemble_job(HackAsmContext* ctx, const BatchJob* job, const OutputOptions* options) {
+
+  // HackAsmContext*, BatchJob*, OutputOptions* -> bool
+  // Maps the job's input, assembles it and writes its output file.
+  // Errors are reported on stderr prefixed with the input path.
+
+  SourceBuffer source;
+  if (!source_open(&source, job->input_path)) {
+    fprintf(stderr, "%s: ", job->input_path);
+    perror("Error opening input file");
+    return false;
+  }
+
+  const uint16_t* words;
+  size_t count;
+  HackAsmError error;
+  if (!hack_asm_ctx_set_cache(ctx, job->cache_path)) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(1);
+  }
+  hack_asm_ctx_set_optimize(ctx, job->optimize);
+  bool ok = job->object ? hack_asm_assemble_object(ctx, source.data, source.size, &error)
+                        : hack_asm_assemble_buffer(ctx, source.data, source.size, &words, &count, &error);
+  source_close(&source);
+  if (!ok) {
+    fprintf(stderr, "%s: line %zu: %s\n", job->input_path, error.line, error.message);
+    return false;
+  }
+
+  bool binary = job->object || (options && options->format == OUTPUT_BINARY);
+  FILE* output = output_open(job->output_path, binary);
+  if (!output) {
+    fprintf(stderr, "%s: ", job->output_path);
+    perror("Error opening output file");
+    return false;
+  }
+
+  bool written = job->object ? hack_asm_write_object(ctx, output) : hack_asm_write(ctx, output, words, count, options);
+  if (!written) {
+    fprintf(stderr, "%s: ", job->output_path);
+    perror("Error writing output file");
+    ok = false;
+  }
+  if (fclose(output) != 0) ok = false;
+  if (!ok) remove(job->output_path);
+  return ok;
+}
+
+static void* worker_main(void* arg) {
+
+  // Worker* -> NULL
+  // Runs jobs until no queue has work left, with a private assembler context per worker
+
+  Worker* worker = arg;
+  BatchPool* pool = worker->pool;
+
+  HackAsmContext* ctx = hack_asm_ctx_create();
+  if (!ctx) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(1);
+  }
+
+  size_t job;
+  while (next_job(worker, &job)) {
+    BatchJob* current = &pool->jobs[job];
+    current->ok = assemble_job(ctx, current, pool->options);
+  }
+
+  hack_asm_ctx_destroy(ctx);
+  return NULL;
+}
+
+static int compare_size_desc(const void* a, const void* b) {
+  const BatchJob* x = a;
+  const BatchJob* y = b;
+  if (x->size == y->size) return 0;
+  return x->size > y->size ? -1 : 1;
+}
+
+bool assemble_batch(BatchJob* jobs, size_t count, int threads, const OutputOptions* options) {
+
+  // BatchJob*, size_t, int, OutputOptions* -> bool
+  // Assembles all jobs concurrently, largest inputs first. Each job's result is stored in its
+  // ok field and errors are reported per file; returns true only if every job succeeded.
+
+  if (count == 0) return true;
+  if (threads < 1) threads = 1;
+  if ((size_t)threads > count) threads = (int)count;
+
+  for (size_t i = 0; i < count; i++) {
+    struct stat info;
+    jobs[i].size = stat(jobs[i].input_path, &info) == 0 ? (size_t)info.st_size : 0;
+    jobs[i].ok = false;
+  }
+  qsort(jobs, count, sizeof(BatchJob), compare_size_desc);
+
+  BatchPool pool = { jobs, calloc(threads, sizeof(WorkQueue)), threads, options };
+  Worker* workers = calloc(threads, sizeof(Worker));
+  pthread_t* handles = calloc(threads, sizeof(pthread_t));
+  if (!pool.queues || !workers || !handles) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(1);
+  }
+
+  // Deal the sorted jobs round-robin so every queue starts with one of the largest files
+  for (int w = 0; w < threads; w++) {
+    pool.queues[w].items = malloc((count / threads + 1) * sizeof(size_t));
+    if (!pool.queues[w].items) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(1);
+    }
+    pthread_mutex_init(&pool.queues[w].lock, NULL);
+  }
+  for (size_t i = 0; i < count; i++) {
+    WorkQueue* queue = &pool.queues[i % threads];
+    queue->items[queue->tail++] = i;
+  }
+
+  int started = 0;
+  for (int w = 0; w < threads; w++) {
+    workers[w].pool = &pool;
+    workers[w].id = w;
+    if (w > 0 && pthread_create(&handles[w], NULL, worker_main, &workers[w]) != 0) break;
+    started++;
+  }
+  worker_main(&workers[0]);   // the calling thread works too
+  for (int w = 1; w < started; w++) {
+    pthread_join(handles[w], NULL);
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < count; i++) {
+    if (!jobs[i].ok) ok = false;
+  }
+
+  for (int w = 0; w < threads; w++) {
+    pthread_mutex_destroy(&pool.queues[w].lock);
+    free(pool.queues[w].items);
+  }
+  free(pool.queues);
+  free(workers);
+  free(handles);
+  return ok;
+}
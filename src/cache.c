@@ -0,0 +1,566 @@
+#include "cache.h"
+#include "lexer.h"
+#include "expression.h"
+#include "hack_isa.h"
+#include "stats.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// Blocks end after a line picked by is_cut_line() once they are at least MIN_BLOCK bytes
+// long, and always by MAX_BLOCK bytes
+#define MIN_BLOCK 1024
+#define MAX_BLOCK (64 * 1024)
+#define CUT_MASK 0x1F
+
+// File layout: magic, block count, 4 reserved bytes, checksum of everything after the header
+#define CACHE_MAGIC "HACKCCH3"
+#define HEADER_SIZE 24
+
+typedef struct CacheSymbol{
+  const char* name;     // into the source, the arena or the loaded cache file
+  uint32_t len;
+  uint32_t index;       // block-relative instruction position
+  uint16_t address;     // for references: the address patched into the cached word
+  uint32_t line;        // for expressions: block-relative source line
+} CacheSymbol;
+
+typedef struct CacheBlock{
+  uint64_t key;         // hash of the block's text
+  const char* text;     // into the source or the loaded cache file
+  uint32_t bytes;
+  uint32_t lines;
+  uint16_t* words;
+  uint32_t word_count;
+  CacheSymbol* labels;
+  uint32_t label_count;
+  CacheSymbol* refs;
+  uint32_t ref_count;
+  CacheSymbol* expressions;   // named by the whole A-instruction, evaluated on every run
+  uint32_t expression_count;
+} CacheBlock;
+
+// On-disk block header, followed by the words, the label, reference and expression records,
+// the names and the block's text. A hit is confirmed against the text, since the key is only
+// a 64-bit hash.
+typedef struct CacheRecord{
+  uint64_t key;
+  uint32_t bytes, lines, word_count, label_count, ref_count, expression_count, names_size, reserved;
+} CacheRecord;
+
+typedef struct CacheSymbolRecord{
+  uint32_t index;
+  uint32_t name_offset;
+  uint32_t len;
+  uint32_t address;     // the line for an expression
+} CacheSymbolRecord;
+
+static size_t align8(size_t n) {
+  return (n + 7) & ~(size_t)7;
+}
+
+static uint64_t hash_bytes(const char* data, size_t len) {
+
+  // String, size_t -> uint64_t
+  // FNV-style hash taking eight bytes per step, with a final mix
+
+  uint64_t hash = 14695981039346656037ull ^ len;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t chunk;
+    memcpy(&chunk, data + i, 8);
+    hash = (hash ^ chunk) * 1099511628211ull;
+    hash ^= hash >> 32;
+  }
+  for (; i < len; i++) {
+    hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+  }
+  hash ^= hash >> 29;
+  hash *= 0xBF58476D1CE4E5B9ull;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+static bool is_cut_line(const char* line, size_t len) {
+
+  // String, size_t -> bool
+  // Decides from the first eight bytes of a line whether a block may end after it, so
+  // that boundaries depend only on nearby text
+
+  uint64_t head = 0;
+  memcpy(&head, line, len < 8 ? len : 8);
+  head *= 0x9E3779B97F4A7C15ull;
+  return ((head >> 40) & CUT_MASK) == 0;
+}
+
+static size_t split_blocks(Arena* arena, const char* source, size_t size, CacheBlock** blocks_out) {
+
+  // Arena*, String, size_t, CacheBlock** -> size_t
+  // Cuts the source into blocks of whole lines and computes each block's key
+
+  CacheBlock* blocks = NULL;
+  size_t count = 0, capacity = 0;
+
+  const char* block_start = source;
+  const char* end = source + size;
+  const char* p = source;
+  uint32_t lines = 0;
+
+  while (p < end) {
+    const char* newline = memchr(p, '\n', end - p);
+    const char* line_end = newline ? newline + 1 : end;
+    bool cut = is_cut_line(p, line_end - p);
+    lines++;
+    p = line_end;
+
+    size_t bytes = p - block_start;
+    if (p == end || bytes >= MAX_BLOCK || (bytes >= MIN_BLOCK && cut)) {
+      if (count == capacity) {
+        blocks = arena_grow_array(arena, blocks, &capacity, sizeof(CacheBlock));
+      }
+      CacheBlock* block = &blocks[count++];
+      memset(block, 0, sizeof(*block));
+      block->key = hash_bytes(block_start, bytes);
+      block->text = block_start;
+      block->bytes = (uint32_t)bytes;
+      block->lines = lines;
+
+      block_start = p;
+      lines = 0;
+    }
+  }
+
+  *blocks_out = blocks;
+  return count;
+}
+
+static void add_symbol(Arena* arena, CacheSymbol** list, uint32_t* count, size_t* capacity,
+                       Slice name, uint32_t index, bool in_scratch) {
+
+  // Arena*, CacheSymbol**, uint32_t*, size_t*, Slice, uint32_t, bool -> void
+  // Records a label or reference; names in the lexer's scratch buffer are copied because the
+  // next instruction overwrites them
+
+  if (*count == *capacity) {
+    *list = arena_grow_array(arena, *list, capacity, sizeof(CacheSymbol));
+  }
+  CacheSymbol* symbol = &(*list)[(*count)++];
+  symbol->len = (uint32_t)name.len;
+  symbol->index = index;
+  symbol->address = 0;
+  symbol->line = 0;
+  symbol->name = name.ptr;
+  if (in_scratch) {
+    char* copy = arena_alloc(arena, name.len);
+    memcpy(copy, name.ptr, name.len);
+    symbol->name = copy;
+  }
+}
+
+static bool encode_block(Arena* arena, InstructionMemo* memo, CacheBlock* block, const char* text,
+                         AssemblyError* error) {
+
+  // Arena*, InstructionMemo*, CacheBlock*, String, AssemblyError* -> bool
+  // Encodes a block that is not in the cache. Symbol references are left as zero words.
+  // On an invalid instruction error gets a block-relative line number.
+
+  size_t word_capacity = 0, label_capacity = 0, ref_capacity = 0, expression_capacity = 0;
+  Lexer lexer;
+  lexer_init(&lexer, text, block->bytes);
+  bool ok = true;
+
+  Slice ins;
+  while (lexer_next(&lexer, &ins)) {
+    uint16_t word = 0;
+    Slice name;
+    const char* message;
+    bool in_scratch = ins.ptr == lexer.scratch;
+
+    InstructionKind kind = parse_instruction_memo(memo, ins, &word, &name, &message);
+    if (kind == INSTRUCTION_INVALID) {
+      set_assembly_error(error, lexer.line_number, message, ins);
+      ok = false;
+      break;
+    }
+    if (kind == INSTRUCTION_LABEL) {
+      add_symbol(arena, &block->labels, &block->label_count, &label_capacity, name, block->word_count, in_scratch);
+      continue;
+    }
+    if (kind == INSTRUCTION_SYMBOL) {
+      add_symbol(arena, &block->refs, &block->ref_count, &ref_capacity, name, block->word_count, in_scratch);
+    } else if (kind == INSTRUCTION_EXPRESSION) {
+      add_symbol(arena, &block->expressions, &block->expression_count, &expression_capacity, ins,
+                 block->word_count, in_scratch);
+      block->expressions[block->expression_count - 1].line = (uint32_t)lexer.line_number;
+    }
+
+    if (block->word_count == word_capacity) {
+      block->words = arena_grow_array(arena, block->words, &word_capacity, sizeof(uint16_t));
+    }
+    block->words[block->word_count++] = word;
+  }
+
+  lexer_free(&lexer);
+  return ok;
+}
+
+static char* read_cache_file(const char* path, size_t* size) {
+
+  // String, size_t* -> String
+  // Reads the whole cache file into a heap buffer, or returns NULL
+
+  FILE* fp = fopen(path, "rb");
+  if (!fp) return NULL;
+
+  SourceBuffer buffer;
+  bool ok = source_read_stream(&buffer, fp);
+  fclose(fp);
+  if (!ok) return NULL;
+  *size = buffer.size;
+  return (char*)buffer.data;
+}
+
+static bool load_symbols(const char* data, size_t size, size_t* offset, CacheSymbol** list, uint32_t count,
+                         const char* names, size_t names_size, Arena* arena) {
+
+  // String, size_t, size_t*, CacheSymbol**, uint32_t, String, size_t, Arena* -> bool
+  // Reads count symbol records, checking every name against the block's name area
+
+  if (count > (size - *offset) / sizeof(CacheSymbolRecord)) return false;
+  *list = arena_alloc(arena, count * sizeof(CacheSymbol));
+  for (uint32_t i = 0; i < count; i++) {
+    CacheSymbolRecord record;
+    memcpy(&record, data + *offset + i * sizeof(record), sizeof(record));
+    if (record.name_offset > names_size || record.len > names_size - record.name_offset) return false;
+    (*list)[i].name = names + record.name_offset;
+    (*list)[i].len = record.len;
+    (*list)[i].index = record.index;
+    (*list)[i].address = (uint16_t)record.address;
+    (*list)[i].line = record.address;
+  }
+  *offset += count * sizeof(CacheSymbolRecord);
+  return true;
+}
+
+static int compare_keys(const void* a, const void* b) {
+  const CacheBlock* x = a;
+  const CacheBlock* y = b;
+  if (x->key != y->key) return x->key < y->key ? -1 : 1;
+  return x->bytes < y->bytes ? -1 : x->bytes > y->bytes;
+}
+
+static size_t load_cache(Arena* arena, const char* data, size_t size, CacheBlock** blocks_out) {
+
+  // Arena*, String, size_t, CacheBlock** -> size_t
+  // Parses a cache file into blocks sorted by key. Anything malformed discards the whole
+  // cache, which then behaves as if it were empty.
+
+  *blocks_out = NULL;
+  if (!data || size < HEADER_SIZE || memcmp(data, CACHE_MAGIC, 8) != 0) return 0;
+
+  uint32_t count;
+  uint64_t checksum;
+  memcpy(&count, data + 8, sizeof(count));
+  memcpy(&checksum, data + 16, sizeof(checksum));
+  if (count > size / sizeof(CacheRecord)) return 0;
+  if (checksum != hash_bytes(data + HEADER_SIZE, size - HEADER_SIZE)) return 0;
+
+  CacheBlock* blocks = arena_alloc(arena, (count ? count : 1) * sizeof(CacheBlock));
+  size_t offset = HEADER_SIZE;
+  for (uint32_t b = 0; b < count; b++) {
+    CacheRecord record;
+    if (size - offset < sizeof(record)) return 0;
+    memcpy(&record, data + offset, sizeof(record));
+    offset += sizeof(record);
+
+    CacheBlock* block = &blocks[b];
+    block->key = record.key;
+    block->bytes = record.bytes;
+    block->lines = record.lines;
+    block->word_count = record.word_count;
+    block->label_count = record.label_count;
+    block->ref_count = record.ref_count;
+    block->expression_count = record.expression_count;
+
+    if (record.word_count > (size - offset) / sizeof(uint16_t)) return 0;
+    block->words = arena_alloc(arena, record.word_count * sizeof(uint16_t));
+    memcpy(block->words, data + offset, record.word_count * sizeof(uint16_t));
+    offset += align8(record.word_count * sizeof(uint16_t));
+    if (offset > size) return 0;
+
+    size_t symbols_size = ((size_t)record.label_count + record.ref_count + record.expression_count) *
+                          sizeof(CacheSymbolRecord);
+    if (symbols_size > size - offset || record.names_size > size - offset - symbols_size) return 0;
+    const char* names = data + offset + symbols_size;
+    if (!load_symbols(data, size, &offset, &block->labels, record.label_count, names, record.names_size, arena) ||
+        !load_symbols(data, size, &offset, &block->refs, record.ref_count, names, record.names_size, arena) ||
+        !load_symbols(data, size, &offset, &block->expressions, record.expression_count, names,
+                      record.names_size, arena)) {
+      return 0;
+    }
+    offset = align8(offset + record.names_size);
+    if (offset > size || record.bytes > size - offset) return 0;
+    block->text = data + offset;
+    offset = align8(offset + record.bytes);
+    if (offset > size) offset = size;
+
+    for (uint32_t i = 0; i < block->label_count + block->ref_count; i++) {
+      const CacheSymbol* symbol = i < block->label_count ? &block->labels[i] : &block->refs[i - block->label_count];
+      if (symbol->index > block->word_count || (i >= block->label_count && symbol->index >= block->word_count)) return 0;
+    }
+    for (uint32_t i = 0; i < block->expression_count; i++) {
+      const CacheSymbol* expression = &block->expressions[i];
+      if (expression->index >= block->word_count || expression->len < 2 || expression->name[0] != '@') return 0;
+    }
+  }
+
+  qsort(blocks, count, sizeof(CacheBlock), compare_keys);
+  *blocks_out = blocks;
+  return count;
+}
+
+static size_t block_names_size(const CacheBlock* block) {
+  size_t size = 0;
+  for (uint32_t i = 0; i < block->label_count; i++) size += block->labels[i].len;
+  for (uint32_t i = 0; i < block->ref_count; i++) size += block->refs[i].len;
+  for (uint32_t i = 0; i < block->expression_count; i++) size += block->expressions[i].len;
+  return size;
+}
+
+static char* put_symbols(char* out, const CacheSymbol* list, uint32_t count, bool expressions,
+                         uint32_t* name_offset) {
+  for (uint32_t i = 0; i < count; i++) {
+    CacheSymbolRecord record = { list[i].index, *name_offset, list[i].len, expressions ? list[i].line : list[i].address };
+    memcpy(out, &record, sizeof(record));
+    out += sizeof(record);
+    *name_offset += list[i].len;
+  }
+  return out;
+}
+
+static char* put_names(char* out, const CacheSymbol* list, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    memcpy(out, list[i].name, list[i].len);
+    out += list[i].len;
+  }
+  return out;
+}
+
+static bool save_cache(Arena* arena, const char* path, const CacheBlock* blocks, size_t count) {
+
+  // Arena*, String, CacheBlock*, size_t -> bool
+  // Serializes every block into one buffer with a checksum, writes it to a temporary file and
+  // renames that over the cache file, so an interrupted run never leaves a torn cache behind
+
+  size_t size = HEADER_SIZE;
+  for (size_t b = 0; b < count; b++) {
+    size += sizeof(CacheRecord) + align8(blocks[b].word_count * sizeof(uint16_t)) +
+            ((size_t)blocks[b].label_count + blocks[b].ref_count + blocks[b].expression_count) *
+            sizeof(CacheSymbolRecord) +
+            align8(block_names_size(&blocks[b])) + align8(blocks[b].bytes);
+  }
+
+  char* data = arena_alloc(arena, size);
+  memset(data, 0, size);
+  char* out = data + HEADER_SIZE;
+  for (size_t b = 0; b < count; b++) {
+    const CacheBlock* block = &blocks[b];
+    size_t names_size = block_names_size(block);
+    CacheRecord record = { block->key, block->bytes, block->lines, block->word_count,
+                           block->label_count, block->ref_count, block->expression_count, (uint32_t)names_size };
+    memcpy(out, &record, sizeof(record));
+    out += sizeof(record);
+    memcpy(out, block->words, block->word_count * sizeof(uint16_t));
+    out += align8(block->word_count * sizeof(uint16_t));
+
+    uint32_t name_offset = 0;
+    out = put_symbols(out, block->labels, block->label_count, false, &name_offset);
+    out = put_symbols(out, block->refs, block->ref_count, false, &name_offset);
+    out = put_symbols(out, block->expressions, block->expression_count, true, &name_offset);
+    char* names = out;
+    out = put_names(out, block->labels, block->label_count);
+    out = put_names(out, block->refs, block->ref_count);
+    out = put_names(out, block->expressions, block->expression_count);
+    out = names + align8(names_size);
+    memcpy(out, block->text, block->bytes);
+    out += align8(block->bytes);
+  }
+
+  uint32_t block_count = (uint32_t)count;
+  uint64_t checksum = hash_bytes(data + HEADER_SIZE, size - HEADER_SIZE);
+  memcpy(data, CACHE_MAGIC, 8);
+  memcpy(data + 8, &block_count, sizeof(block_count));
+  memcpy(data + 16, &checksum, sizeof(checksum));
+
+  size_t path_len = strlen(path);
+  char* tmp_path = arena_alloc(arena, path_len + 5);
+  memcpy(tmp_path, path, path_len);
+  memcpy(tmp_path + path_len, ".tmp", 5);
+
+  FILE* out_file = fopen(tmp_path, "wb");
+  if (!out_file) return false;
+  bool ok = fwrite(data, 1, size, out_file) == size;
+  if (fclose(out_file) != 0) ok = false;
+  if (ok) ok = rename(tmp_path, path) == 0;
+  if (!ok) remove(tmp_path);
+  return ok;
+}
+
+bool assemble_words_cached(SymbolTable *table, Arena *arena, const char *source, size_t size,
+                           const char *cache_path, uint16_t **words_out, size_t *count_out, AssemblyError *error) {
+
+  // SymbolTable*, Arena*, String, size_t, String, uint16_t**, size_t*, AssemblyError* -> bool
+  // Assembles the source block by block, reusing cached blocks:
+  //   1. blocks found in the cache with the same text take their words and symbols from it,
+  //      the others are encoded from their text
+  //   2. labels are defined in source order, the first definition winning
+  //   3. references are resolved in source order, allocating variables from 16; words are
+  //      only patched where the referenced address differs from the one in the cache.
+  //      Expressions are evaluated again in every block, cached or not.
+  //   4. the cache file is rewritten with the current blocks
+
+  STATS_PHASE_START(pass1);
+  size_t file_size = 0;
+  char* file = read_cache_file(cache_path, &file_size);
+  CacheBlock* cached;
+  size_t cached_count = load_cache(arena, file, file_size, &cached);
+
+  CacheBlock* blocks;
+  size_t block_count = split_blocks(arena, source, size, &blocks);
+
+  const char* text = source;
+  size_t line = 0;
+  size_t word_count = 0;
+  bool ok = true;
+  InstructionMemo* memo = arena_alloc(arena, sizeof(InstructionMemo));   // shared by the blocks encoded afresh
+  instruction_memo_init(memo);
+  for (size_t b = 0; b < block_count; b++) {
+    CacheBlock* block = &blocks[b];
+    CacheBlock* hit = cached_count ? bsearch(block, cached, cached_count, sizeof(CacheBlock), compare_keys) : NULL;
+    if (hit && hit->lines == block->lines && memcmp(hit->text, block->text, block->bytes) == 0) {
+      // The references are patched per block, so a block that appears twice needs its own
+      *block = *hit;
+      block->refs = arena_alloc(arena, (hit->ref_count ? hit->ref_count : 1) * sizeof(CacheSymbol));
+      memcpy(block->refs, hit->refs, hit->ref_count * sizeof(CacheSymbol));
+      STATS_ADD(cache_hits, 1);
+    } else {
+      STATS_ADD(cache_misses, 1);
+      if (!encode_block(arena, memo, block, text, error)) {
+        if (error) error->line += line;
+        ok = false;
+        break;
+      }
+    }
+    text += block->bytes;
+    line += block->lines;
+    word_count += block->word_count;
+  }
+
+  if (ok && word_count > HACK_ROM_SIZE) {
+    set_word_error(error, source, size, HACK_ROM_SIZE, "program does not fit in the 32768-word ROM at");
+    ok = false;
+  }
+
+  uint16_t* words = NULL;
+  if (ok) {
+    size_t first_word = 0;
+    for (size_t b = 0; b < block_count; b++) {
+      for (uint32_t i = 0; i < blocks[b].label_count; i++) {
+        CacheSymbol* label = &blocks[b].labels[i];
+        size_t symbol = symbol_table_intern(table, label->name, label->len);
+        if (table->symbols[symbol].address == SYMBOL_UNDEFINED) {
+          table->symbols[symbol].address = first_word + label->index;
+        }
+      }
+      STATS_ADD(labels, blocks[b].label_count);
+      first_word += blocks[b].word_count;
+    }
+  }
+  STATS_PHASE_STOP(pass1, STATS_PASS1);
+
+  if (ok) {
+    STATS_PHASE_START(pass2);
+    words = arena_alloc(arena, word_count * sizeof(uint16_t));
+    int variable_address = 16;
+    size_t first_word = 0;
+    size_t first_line = 0;
+    for (size_t b = 0; b < block_count && ok; b++) {
+      CacheBlock* block = &blocks[b];
+      memcpy(words + first_word, block->words, block->word_count * sizeof(uint16_t));
+      for (uint32_t i = 0; i < block->expression_count; i++) {
+        const CacheSymbol* expression = &block->expressions[i];
+        Slice ins = { expression->name, expression->len };
+        Slice text = { ins.ptr + 1, ins.len - 1 };
+        const char* message;
+        ExpressionResult result = evaluate_expression(text, table, table->size, &words[first_word + expression->index],
+                                                      &message);
+        if (result != EXPRESSION_VALUE) {
+          if (result == EXPRESSION_UNRESOLVED) message = "expression operand is not a label or predefined symbol in";
+          set_assembly_error(error, first_line + expression->line, message, ins);
+          ok = false;
+          break;
+        }
+      }
+      for (uint32_t i = 0; i < block->ref_count; i++) {
+        CacheSymbol* ref = &block->refs[i];
+        size_t symbol = symbol_table_intern(table, ref->name, ref->len);
+        if (table->symbols[symbol].address == SYMBOL_UNDEFINED) {
+          table->symbols[symbol].address = variable_address++;
+          table->symbols[symbol].variable = true;
+        }
+        if (table->symbols[symbol].address > HACK_MAX_ADDRESS) {
+          set_word_error(error, source, size, first_word + ref->index, "address out of range in");
+          ok = false;
+          break;
+        }
+        // Freshly encoded blocks hold zero words with address 0 for their references
+        uint16_t address = (uint16_t)table->symbols[symbol].address;
+        if (address != ref->address) {
+          words[first_word + ref->index] = address;
+          ref->address = address;
+        }
+      }
+      block->words = words + first_word;
+      first_word += block->word_count;
+      first_line += block->lines;
+    }
+    STATS_ADD(variables, variable_address - 16);
+    STATS_ADD(instructions, word_count);
+    STATS_PHASE_STOP(pass2, STATS_PASS2);
+
+    if (ok && !save_cache(arena, cache_path, blocks, block_count)) {
+      fprintf(stderr, "%s: ", cache_path);
+      perror("Warning: could not write cache file");
+    }
+  }
+
+  free(file);
+  *words_out = words;
+  *count_out = ok ? word_count : 0;
+  return ok;
+}
+
+char* cache_path_for(const char *cache_dir, const char *input_path) {
+
+  // String, String -> String
+  // Names the cache file after a hash of the input path, keeping the file's base name
+  // readable: DIR/<base>-<hash>.hcache
+
+  if (mkdir(cache_dir, 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "%s: ", cache_dir);
+    perror("Error creating cache directory");
+    return NULL;
+  }
+
+  const char* base = strrchr(input_path, '/');
+  base = base ? base + 1 : input_path;
+  size_t size = strlen(cache_dir) + strlen(base) + 32;
+  char* path = malloc(size);
+  if (!path) return NULL;
+  snprintf(path, size, "%s/%s-%016llx.hcache", cache_dir, base,
+           (unsigned long long)hash_bytes(input_path, strlen(input_path)));
+  return path;
+}
@@ -0,0 +1,401 @@
+#define _GNU_SOURCE   // fopencookie
+#include "compress.h"
+#include "stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef HACK_ZLIB
+#define HACK_ZLIB 0
+#endif
+#ifndef HACK_ZSTD
+#define HACK_ZSTD 0
+#endif
+
+#if HACK_ZLIB
+#include <zlib.h>
+#endif
+#if HACK_ZSTD
+#include <zstd.h>
+#endif
+
+// Largest single read or write handed to the libraries, whose lengths are 32-bit
+#define COMPRESS_CHUNK (1u << 30)
+
+// gzip level of written files: .hack text is two symbols, so the fastest level already
+// shrinks it about tenfold and higher ones mostly cost time
+#define GZIP_LEVEL "1"
+
+Compression compression_for_path(const char* path) {
+
+  // String -> Compression
+  // Looks at the last extension of path
+
+  const char* dot = strrchr(path, '.');
+  if (!dot || strchr(dot, '/')) return COMPRESSION_NONE;
+  if (strcmp(dot, ".gz") == 0) return COMPRESSION_GZIP;
+  if (strcmp(dot, ".zst") == 0) return COMPRESSION_ZSTD;
+  return COMPRESSION_NONE;
+}
+
+const char* compression_extension(Compression compression) {
+
+  // Compression -> String
+  // Returns the file extension that selects a format
+
+  switch (compression) {
+    case COMPRESSION_GZIP: return ".gz";
+    case COMPRESSION_ZSTD: return ".zst";
+    default: return "";
+  }
+}
+
+#if HACK_ZLIB || HACK_ZSTD
+static char* grow_source(char* buffer, size_t* capacity, size_t needed) {
+
+  // String, size_t*, size_t -> String
+  // Doubles the decompression buffer until it holds needed bytes; NULL when memory runs out
+
+  size_t new_capacity = *capacity;
+  while (new_capacity < needed) new_capacity *= 2;
+  char* grown = realloc(buffer, new_capacity);
+  STATS_ALLOC(new_capacity);
+  if (grown) *capacity = new_capacity;
+  return grown;
+}
+#endif
+
+#if HACK_ZLIB
+static bool read_gzip(SourceBuffer* source, const char* path) {
+
+  // SourceBuffer*, String -> bool
+  // Inflates a gzip file (concatenated members included) into one buffer. The trailer of a
+  // single-member file holds the uncompressed size, which sizes the buffer up front.
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+
+  size_t capacity = 1 << 16;
+  struct stat info;
+  uint32_t trailer;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size >= 18 &&
+      pread(fd, &trailer, sizeof(trailer), info.st_size - 4) == sizeof(trailer)) {
+    // ISIZE is little-endian and modulo 2^32; a size below the compressed one is not trusted
+    uint8_t* bytes = (uint8_t*)&trailer;
+    size_t hint = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (size_t)bytes[3] << 24;
+    if (hint >= (size_t)info.st_size) capacity = hint + 1;
+  }
+
+  gzFile gz = gzdopen(fd, "rb");
+  if (!gz) {
+    close(fd);
+    errno = ENOMEM;
+    return false;
+  }
+  gzbuffer(gz, 1 << 17);
+
+  char* buffer = malloc(capacity);
+  STATS_ALLOC(capacity);
+  size_t size = 0;
+  bool ok = buffer != NULL;
+  while (ok) {
+    if (size == capacity) {
+      char* grown = grow_source(buffer, &capacity, size + 1);
+      if (!grown) {
+        ok = false;
+        break;
+      }
+      buffer = grown;
+    }
+    size_t want = capacity - size < COMPRESS_CHUNK ? capacity - size : COMPRESS_CHUNK;
+    int n = gzread(gz, buffer + size, (unsigned)want);
+    if (n > 0) {
+      size += n;
+      continue;
+    }
+    // A short read at the end leaves Z_BUF_ERROR behind when the stream was cut off
+    int status;
+    gzerror(gz, &status);
+    if (n < 0 || status != Z_OK) {
+      if (status != Z_ERRNO) errno = EBADMSG;
+      ok = false;
+    }
+    break;
+  }
+  int saved_errno = errno;
+  gzclose(gz);
+  errno = saved_errno;
+
+  if (!ok) {
+    free(buffer);
+    return false;
+  }
+  source->data = buffer;
+  source->size = size;
+  source->mapped = false;
+  return true;
+}
+#endif
+
+#if HACK_ZSTD
+static bool read_zstd(SourceBuffer* source, const char* path) {
+
+  // SourceBuffer*, String -> bool
+  // Decompresses a zstd file into one buffer, streaming the compressed data through a
+  // small input buffer. The first frame header sizes the output buffer when it records the
+  // content size.
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+
+  ZSTD_DCtx* dctx = ZSTD_createDCtx();
+  size_t in_capacity = ZSTD_DStreamInSize();
+  char* in_buffer = malloc(in_capacity);
+  size_t capacity = 1 << 16;
+  char* buffer = NULL;
+  size_t size = 0;
+  bool ok = dctx && in_buffer;
+  bool started = false;
+  size_t last_status = 0;
+
+  while (ok) {
+    ssize_t n = read(fd, in_buffer, in_capacity);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      ok = false;
+      break;
+    }
+    if (n == 0) break;
+
+    if (!started) {
+      unsigned long long hint = ZSTD_getFrameContentSize(in_buffer, n);
+      if (hint != ZSTD_CONTENTSIZE_UNKNOWN && hint != ZSTD_CONTENTSIZE_ERROR && hint < SIZE_MAX / 2) {
+        capacity = hint + 1;
+      }
+      buffer = malloc(capacity);
+      STATS_ALLOC(capacity);
+      if (!buffer) {
+        ok = false;
+        break;
+      }
+      started = true;
+    }
+
+    ZSTD_inBuffer in = { in_buffer, (size_t)n, 0 };
+    while (in.pos < in.size) {
+      if (size == capacity) {
+        char* grown = grow_source(buffer, &capacity, size + 1);
+        if (!grown) {
+          ok = false;
+          break;
+        }
+        buffer = grown;
+      }
+      ZSTD_outBuffer out = { buffer, capacity, size };
+      last_status = ZSTD_decompressStream(dctx, &out, &in);
+      if (ZSTD_isError(last_status)) {
+        errno = EBADMSG;
+        ok = false;
+        break;
+      }
+      size = out.pos;
+    }
+  }
+  // A nonzero status at the end means the last frame was cut off
+  if (ok && last_status != 0) {
+    errno = EBADMSG;
+    ok = false;
+  }
+  int saved_errno = errno;
+  close(fd);
+  free(in_buffer);
+  ZSTD_freeDCtx(dctx);
+  errno = saved_errno;
+
+  if (!ok) {
+    free(buffer);
+    return false;
+  }
+  source->data = buffer ? buffer : malloc(1);
+  source->size = size;
+  source->mapped = false;
+  return true;
+}
+#endif
+
+bool source_open_compressed(SourceBuffer* source, const char* path, Compression compression) {
+
+  // SourceBuffer*, String, Compression -> bool
+  // Dispatches to the decompressor of the format
+
+  switch (compression) {
+#if HACK_ZLIB
+    case COMPRESSION_GZIP: return read_gzip(source, path);
+#endif
+#if HACK_ZSTD
+    case COMPRESSION_ZSTD: return read_zstd(source, path);
+#endif
+    case COMPRESSION_NONE: return source_open(source, path);
+    default:
+      errno = ENOTSUP;
+      return false;
+  }
+}
+
+// State behind a compressing output stream
+typedef struct CompressedOutput{
+  Compression compression;
+#if HACK_ZLIB
+  gzFile gz;
+#endif
+#if HACK_ZSTD
+  ZSTD_CCtx* cctx;
+  int fd;
+  char* buffer;
+  size_t capacity;
+#endif
+} CompressedOutput;
+
+#if HACK_ZSTD
+static bool zstd_drain(CompressedOutput* output, ZSTD_inBuffer* in, ZSTD_EndDirective mode) {
+
+  // CompressedOutput*, ZSTD_inBuffer*, ZSTD_EndDirective -> bool
+  // Compresses the input (and with ZSTD_e_end closes the frame), writing each filled buffer
+
+  for (;;) {
+    ZSTD_outBuffer out = { output->buffer, output->capacity, 0 };
+    size_t remaining = ZSTD_compressStream2(output->cctx, &out, in, mode);
+    if (ZSTD_isError(remaining)) {
+      errno = EIO;
+      return false;
+    }
+    for (size_t done = 0; done < out.pos;) {
+      ssize_t written = write(output->fd, output->buffer + done, out.pos - done);
+      if (written < 0 && errno == EINTR) continue;
+      if (written < 0) return false;
+      done += written;
+    }
+    bool finished = mode == ZSTD_e_end ? remaining == 0 : in->pos == in->size;
+    if (finished) return true;
+  }
+}
+#endif
+
+static ssize_t compressed_write(void* cookie, const char* data, size_t size) {
+
+  // CompressedOutput*, String, size_t -> ssize_t
+  // fopencookie write hook: compresses size bytes; -1 with errno set on failure
+
+  CompressedOutput* output = cookie;
+#if HACK_ZLIB
+  if (output->compression == COMPRESSION_GZIP) {
+    for (size_t done = 0; done < size;) {
+      size_t chunk = size - done < COMPRESS_CHUNK ? size - done : COMPRESS_CHUNK;
+      int n = gzwrite(output->gz, data + done, (unsigned)chunk);
+      if (n <= 0) {
+        int status;
+        gzerror(output->gz, &status);
+        if (status != Z_ERRNO) errno = EIO;
+        return -1;
+      }
+      done += n;
+    }
+    return size;
+  }
+#endif
+#if HACK_ZSTD
+  if (output->compression == COMPRESSION_ZSTD) {
+    ZSTD_inBuffer in = { data, size, 0 };
+    return zstd_drain(output, &in, ZSTD_e_continue) ? (ssize_t)size : -1;
+  }
+#endif
+  (void)output;
+  (void)data;
+  errno = ENOTSUP;
+  return -1;
+}
+
+static int compressed_close(void* cookie) {
+
+  // CompressedOutput* -> int
+  // fopencookie close hook: ends the compressed stream and closes the file
+
+  CompressedOutput* output = cookie;
+  bool ok = true;
+#if HACK_ZLIB
+  if (output->compression == COMPRESSION_GZIP) {
+    ok = gzclose(output->gz) == Z_OK;
+    if (!ok) errno = EIO;
+  }
+#endif
+#if HACK_ZSTD
+  if (output->compression == COMPRESSION_ZSTD) {
+    ZSTD_inBuffer in = { NULL, 0, 0 };
+    ok = zstd_drain(output, &in, ZSTD_e_end);
+    int saved_errno = errno;
+    if (close(output->fd) != 0) ok = false;
+    else errno = saved_errno;
+    ZSTD_freeCCtx(output->cctx);
+    free(output->buffer);
+  }
+#endif
+  free(output);
+  return ok ? 0 : -1;
+}
+
+FILE* output_open(const char* path, bool binary) {
+
+  // String, bool -> FILE*
+  // Plain files go to fopen(); compressed ones get a stream whose writes feed the compressor
+
+  Compression compression = compression_for_path(path);
+  if (compression == COMPRESSION_NONE) return fopen(path, binary ? "wb" : "w");
+
+  CompressedOutput* output = calloc(1, sizeof(CompressedOutput));
+  if (!output) return NULL;
+  output->compression = compression;
+  bool opened = false;
+  errno = ENOTSUP;    // kept when the format is not built in
+#if HACK_ZLIB
+  if (compression == COMPRESSION_GZIP) {
+    output->gz = gzopen(path, "wb" GZIP_LEVEL);
+    if (output->gz) {
+      gzbuffer(output->gz, 1 << 17);
+      opened = true;
+    }
+  }
+#endif
+#if HACK_ZSTD
+  if (compression == COMPRESSION_ZSTD) {
+    output->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (output->fd >= 0) {
+      output->cctx = ZSTD_createCCtx();
+      output->capacity = ZSTD_CStreamOutSize();
+      output->buffer = malloc(output->capacity);
+      opened = output->cctx && output->buffer;
+      if (!opened) {
+        ZSTD_freeCCtx(output->cctx);
+        free(output->buffer);
+        close(output->fd);
+        errno = ENOMEM;
+      }
+    }
+  }
+#endif
+  if (!opened) {
+    free(output);
+    return NULL;
+  }
+
+  cookie_io_functions_t functions = { NULL, compressed_write, NULL, compressed_close };
+  FILE* fp = fopencookie(output, "w", functions);
+  if (!fp) {
+    compressed_close(output);
+    errno = ENOMEM;
+  }
+  return fp;
+}
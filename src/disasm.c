@@ -0,0 +1,417 @@
+#include "disasm.h"
+#include "hack_isa.h"
+#include "output.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Values an A-instruction can load, and so the addresses a name can be restored for
+#define A_VALUES 32768
+
+// Every C-instruction is 111 followed by 13 bits of comp, dest and jump
+#define C_INSTRUCTIONS 8192
+
+// Longest C-instruction line: "AMD=D|M;JMP\n"
+#define C_TEXT_MAX 15
+
+typedef struct LabelDefinition{
+  size_t address;
+  const char* name;
+} LabelDefinition;
+
+// Inverse tables, generated from the encoder's tables so the two cannot drift apart
+static const char* const COMP_NAMES[128] = {
+#define X(name, c0, c1, c2, code) [code] = name,
+  HACK_COMP_TABLE(X)
+#undef X
+};
+
+static const char* const JUMP_NAMES[8] = {
+  [0] = "",
+#define X(name, c0, c1, c2, code) [code] = name,
+  HACK_JUMP_TABLE(X)
+#undef X
+};
+
+static const char* const DEST_NAMES[8] = {
+  [0] = "",
+  [HACK_DEST_M] = "M",
+  [HACK_DEST_D] = "D",
+  [HACK_DEST_D | HACK_DEST_M] = "MD",
+  [HACK_DEST_A] = "A",
+  [HACK_DEST_A | HACK_DEST_M] = "AM",
+  [HACK_DEST_A | HACK_DEST_D] = "AD",
+  [HACK_DEST_A | HACK_DEST_D | HACK_DEST_M] = "AMD",
+};
+
+// Preformatted lines: the text padded to a fixed size, with its length in the last byte
+// (0 for comp bit patterns that are not instructions)
+typedef struct LineText{
+  char text[C_TEXT_MAX];
+  uint8_t len;
+} LineText;
+
+static LineText c_lines[C_INSTRUCTIONS];
+static LineText a_lines[A_VALUES];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void build_tables(void) {
+
+  // void -> void
+  // Formats every C-instruction and every numeric A-instruction once
+
+  for (size_t bits = 0; bits < C_INSTRUCTIONS; bits++) {
+    const char* comp = COMP_NAMES[bits >> HACK_COMP_SHIFT];
+    if (!comp) continue;
+    const char* dest = DEST_NAMES[(bits >> HACK_DEST_SHIFT) & 7];
+    const char* jump = JUMP_NAMES[bits & 7];
+    c_lines[bits].len = (uint8_t)snprintf(c_lines[bits].text, C_TEXT_MAX, "%s%s%s%s%s\n",
+                                          dest, *dest ? "=" : "", comp, *jump ? ";" : "", jump);
+  }
+  for (size_t value = 0; value < A_VALUES; value++) {
+    a_lines[value].len = (uint8_t)snprintf(a_lines[value].text, C_TEXT_MAX, "@%zu\n", value);
+  }
+}
+
+static bool parse_binary_line(const char* p, uint16_t* word) {
+
+  // String, uint16_t* -> bool
+  // Converts 16 '0'/'1' characters to a word, eight at a time: after mapping the digits to
+  // 0/1 bytes, one multiplication gathers each byte's bit into the top byte, first digit
+  // highest
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t high, low;
+  memcpy(&high, p, 8);
+  memcpy(&low, p + 8, 8);
+  high ^= 0x3030303030303030ull;
+  low ^= 0x3030303030303030ull;
+  if ((high | low) & 0xFEFEFEFEFEFEFEFEull) return false;
+  *word = (uint16_t)(((high * 0x8040201008040201ull) >> 56) << 8 | ((low * 0x8040201008040201ull) >> 56));
+  return true;
+#else
+  uint16_t value = 0;
+  for (int i = 0; i < 16; i++) {
+    if (p[i] != '0' && p[i] != '1') return false;
+    value = (uint16_t)(value << 1 | (p[i] - '0'));
+  }
+  *word = value;
+  return true;
+#endif
+}
+
+static void decode_binary_image(const unsigned char* data, uint16_t* words, size_t count) {
+
+  // unsigned char*, uint16_t*, size_t -> void
+  // Unpacks the words behind a .hackbin header in the byte order it names. The caller has
+  // checked that the image holds exactly count words.
+
+  bool big = data[5] == 'B';
+  const unsigned char* p = data + HACK_BIN_HEADER_SIZE;
+  for (size_t i = 0; i < count; i++, p += 2) {
+    words[i] = big ? (uint16_t)(p[0] << 8 | p[1]) : (uint16_t)(p[1] << 8 | p[0]);
+  }
+}
+
+bool decode_rom(const char* data, size_t size, uint16_t** words_out, size_t* count_out, DisasmError* error) {
+
+  // String, size_t, uint16_t**, size_t*, DisasmError* -> bool
+  // Recognises the input format and decodes every word
+
+  const unsigned char* bytes = (const unsigned char*)data;
+  if (size >= HACK_BIN_HEADER_SIZE && memcmp(data, HACK_BIN_MAGIC, 4) == 0) {
+    if (bytes[4] != HACK_BIN_VERSION || (bytes[5] != 'L' && bytes[5] != 'B')) {
+      error->position = 0;
+      error->message = "unsupported ROM image version or byte order";
+      return false;
+    }
+    uint32_t count = bytes[5] == 'B'
+      ? (uint32_t)bytes[8] << 24 | (uint32_t)bytes[9] << 16 | (uint32_t)bytes[10] << 8 | bytes[11]
+      : (uint32_t)bytes[11] << 24 | (uint32_t)bytes[10] << 16 | (uint32_t)bytes[9] << 8 | bytes[8];
+    // The count comes from the file, so it is checked against the size before it sizes an
+    // allocation
+    if (size != hack_binary_size(count)) {
+      error->position = 0;
+      error->message = "truncated or oversized ROM image";
+      return false;
+    }
+    uint16_t* words = malloc((count ? count : 1) * sizeof(uint16_t));
+    if (!words) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(1);
+    }
+    decode_binary_image(bytes, words, count);
+    *words_out = words;
+    *count_out = count;
+    return true;
+  }
+
+  // .hack text holds at most one word per HACK_TEXT_LINE bytes, plus a last line without a
+  // newline
+  uint16_t* words = malloc((size / HACK_TEXT_LINE + 1) * sizeof(uint16_t));
+  if (!words) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(1);
+  }
+
+  size_t count = 0, line = 0;
+  const char* p = data;
+  const char* end = data + size;
+  while (p < end) {
+    line++;
+    const char* line_end;
+    if (end - p > 16 && p[16] == '\n') {
+      line_end = p + 16;    // the common case: exactly 16 digits and a newline
+    } else {
+      line_end = memchr(p, '\n', end - p);
+      if (!line_end) line_end = end;
+    }
+
+    size_t len = line_end - p;
+    if (len > 0 && p[len - 1] == '\r') len--;
+    if (len > 0) {
+      if (len != 16 || !parse_binary_line(p, &words[count])) {
+        free(words);
+        error->position = line;
+        error->message = "expected 16 binary digits";
+        return false;
+      }
+      count++;
+    }
+    p = line_end + 1;
+  }
+
+  *words_out = words;
+  *count_out = count;
+  return true;
+}
+
+static int compare_labels(const void* a, const void* b) {
+  const LabelDefinition* x = a;
+  const LabelDefinition* y = b;
+  if (x->address != y->address) return x->address < y->address ? -1 : 1;
+  return x < y ? -1 : (x > y);    // keep dump order for labels at the same address
+}
+
+bool hack_symbols_load(HackSymbols* symbols, const char* path) {
+
+  // HackSymbols*, String -> bool
+  // Reads the whole dump and indexes its names by address
+
+  memset(symbols, 0, sizeof(*symbols));
+  FILE* fp = fopen(path, "r");
+  if (!fp) {
+    fprintf(stderr, "%s: ", path);
+    perror("Error opening symbol file");
+    return false;
+  }
+
+  size_t size = 0, capacity = 4096;
+  char* text = malloc(capacity);
+  size_t n;
+  while (text && (n = fread(text + size, 1, capacity - size - 1, fp)) > 0) {
+    size += n;
+    if (size + 1 == capacity) {
+      char* grown = realloc(text, capacity * 2);
+      if (!grown) free(text);
+      text = grown;
+      capacity *= 2;
+    }
+  }
+  fclose(fp);
+  symbols->text = text;
+  symbols->label_at = calloc(A_VALUES, sizeof(const char*));
+  symbols->variable_at = calloc(A_VALUES, sizeof(const char*));
+  if (!text || !symbols->label_at || !symbols->variable_at) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(1);
+  }
+  text[size] = '\0';
+
+  size_t label_capacity = 0, line_number = 0;
+  for (char* line = text; *line; ) {
+    char* next = strchr(line, '\n');
+    if (next) *next++ = '\0';
+    else next = line + strlen(line);
+    line_number++;
+
+    char kind[16];
+    int name_start, name_end;
+    long address;
+    if (*line == '\0') {
+      line = next;
+      continue;
+    }
+    if (sscanf(line, "%15s %n%*s%n %ld", kind, &name_start, &name_end, &address) != 2 ||
+        address < 0 || (strcmp(kind, "label") != 0 && strcmp(kind, "variable") != 0)) {
+      fprintf(stderr, "%s: line %zu: expected 'label|variable NAME ADDRESS'\n", path, line_number);
+      hack_symbols_free(symbols);
+      return false;
+    }
+    line[name_end] = '\0';
+    const char* name = line + name_start;
+
+    if (kind[0] == 'l') {
+      if (symbols->label_count == label_capacity) {
+        label_capacity = label_capacity ? label_capacity * 2 : 64;
+        symbols->labels = realloc(symbols->labels, label_capacity * sizeof(LabelDefinition));
+        if (!symbols->labels) {
+          fprintf(stderr, "Memory allocation failed\n");
+          exit(1);
+        }
+      }
+      symbols->labels[symbols->label_count].address = (size_t)address;
+      symbols->labels[symbols->label_count].name = name;
+      symbols->label_count++;
+      if (address < A_VALUES && !symbols->label_at[address]) symbols->label_at[address] = name;
+    } else if (address < A_VALUES) {
+      symbols->variable_at[address] = name;
+    }
+    line = next;
+  }
+
+  if (symbols->label_count > 0) {
+    qsort(symbols->labels, symbols->label_count, sizeof(LabelDefinition), compare_labels);
+  }
+  return true;
+}
+
+void hack_symbols_free(HackSymbols* symbols) {
+  free(symbols->text);
+  free(symbols->label_at);
+  free(symbols->variable_at);
+  free(symbols->labels);
+  memset(symbols, 0, sizeof(*symbols));
+}
+
+typedef struct OutputBuffer{
+  FILE* output;
+  char* data;
+  size_t size;
+  size_t capacity;
+  bool ok;
+} OutputBuffer;
+
+static char* reserve_output(OutputBuffer* out, size_t needed) {
+
+  // OutputBuffer*, size_t -> char*
+  // Returns room for needed more bytes, flushing the buffer to the file when it is full
+
+  if (out->size + needed > out->capacity) {
+    if (out->ok && !write_all(out->output, out->data, out->size)) out->ok = false;
+    out->size = 0;
+    if (needed > out->capacity) {
+      char* grown = realloc(out->data, needed);
+      if (!grown) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+      }
+      out->data = grown;
+      out->capacity = needed;
+    }
+  }
+  return out->data + out->size;
+}
+
+static void put_name_line(OutputBuffer* out, char open, const char* name, const char* close) {
+  size_t len = strlen(name);
+  char* p = reserve_output(out, len + 4);
+  *p++ = open;
+  memcpy(p, name, len);
+  p += len;
+  size_t close_len = strlen(close);
+  memcpy(p, close, close_len);
+  out->size += len + 1 + close_len;
+}
+
+static const char* name_for(const HackSymbols* symbols, uint16_t value, const uint16_t* next,
+                            int* next_variable) {
+
+  // HackSymbols*, uint16_t, uint16_t*, int* -> String
+  // Picks the symbol @value most likely referred to, judging by the instruction that uses
+  // it: a jump target is a label, a memory access a variable. A variable is only named
+  // when it is the next one the assembler would allocate, or one allocated already.
+
+  const char* label = symbols->label_at[value];
+  const char* variable = symbols->variable_at[value];
+  if (variable && value > *next_variable) variable = NULL;
+  if (!label && !variable) return NULL;
+
+  bool jumps = false, uses_memory = false;
+  if (next && (*next & HACK_C_PREFIX) == HACK_C_PREFIX) {
+    jumps = (*next & 7) != 0;
+    uses_memory = (*next & (0x40 << HACK_COMP_SHIFT)) || (*next & (HACK_DEST_M << HACK_DEST_SHIFT));
+  }
+
+  const char* name;
+  if (label && variable) name = jumps || !uses_memory ? label : variable;
+  else name = label ? label : variable;
+
+  if (name == variable && value == *next_variable) (*next_variable)++;
+  return name;
+}
+
+bool disassemble(FILE* output, const uint16_t* words, size_t count, const HackSymbols* symbols,
+                 DisasmError* error) {
+
+  // FILE*, uint16_t*, size_t, HackSymbols*, DisasmError* -> bool
+  // Emits each word's preformatted line, copying the fixed-size table entry and advancing by
+  // its length; names only cost extra where a symbol dump provides one
+
+  pthread_once(&tables_once, build_tables);
+
+  OutputBuffer out = { output, malloc(1 << 16), 0, 1 << 16, true };
+  if (!out.data) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(1);
+  }
+
+  size_t next_label = 0;
+  int next_variable = 16;
+  bool ok = true;
+
+  for (size_t i = 0; i < count; i++) {
+    while (symbols && next_label < symbols->label_count && symbols->labels[next_label].address <= i) {
+      if (symbols->labels[next_label].address == i) put_name_line(&out, '(', symbols->labels[next_label].name, ")\n");
+      next_label++;
+    }
+
+    uint16_t word = words[i];
+    const LineText* line;
+    if (word & 0x8000) {
+      line = &c_lines[word & (C_INSTRUCTIONS - 1)];
+      if ((word & HACK_C_PREFIX) != HACK_C_PREFIX || line->len == 0) {
+        error->position = i;
+        error->message = "not a valid instruction";
+        ok = false;
+        break;
+      }
+    } else {
+      const char* name = symbols ? name_for(symbols, word, i + 1 < count ? &words[i + 1] : NULL, &next_variable) : NULL;
+      if (name) {
+        put_name_line(&out, '@', name, "\n");
+        continue;
+      }
+      line = &a_lines[word];
+    }
+
+    char* p = reserve_output(&out, sizeof(LineText));
+    memcpy(p, line->text, sizeof(LineText));
+    out.size += line->len;
+  }
+
+  // Labels placed after the last instruction
+  while (ok && symbols && next_label < symbols->label_count) {
+    if (symbols->labels[next_label].address == count) put_name_line(&out, '(', symbols->labels[next_label].name, ")\n");
+    next_label++;
+  }
+
+  if (ok && out.ok && out.size > 0 && !write_all(output, out.data, out.size)) out.ok = false;
+  free(out.data);
+  if (ok && !out.ok) {
+    error->position = 0;
+    error->message = NULL;    // an I/O error: errno describes it
+    ok = false;
+  }
+  return ok;
+}
@@ -0,0 +1,225 @@
+#include "emulator.h"
+#include "hack_isa.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Decoded opcodes beyond the 7-bit comp codes
+#define OP_LOAD 0x80        // A-instruction
+#define OP_HALT_LOOP 0x81   // "0;JMP" right after "@" of its own address
+#define OP_END 0x82         // past the last instruction
+
+#define PC_SLOTS 65536
+
+#define JUMP_GT 1
+#define JUMP_EQ 2
+#define JUMP_LT 4
+
+bool hack_cpu_init(HackCpu* cpu, const uint16_t* words, size_t count) {
+
+  // HackCpu*, uint16_t*, size_t -> bool
+  // Splits every word into its fields once, and recognises the halt loop
+
+  memset(cpu, 0, sizeof(*cpu));
+  if (count > HACK_ROM_SIZE) return false;
+
+  cpu->ram = calloc(HACK_RAM_SIZE, sizeof(uint16_t));
+  cpu->rom = malloc(PC_SLOTS * sizeof(DecodedInstruction));
+  if (!cpu->ram || !cpu->rom) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(1);
+  }
+  cpu->rom_words = count;
+
+  for (size_t i = 0; i < PC_SLOTS; i++) {
+    DecodedInstruction* ins = &cpu->rom[i];
+    memset(ins, 0, sizeof(*ins));
+    if (i >= count) {
+      ins->op = OP_END;
+      continue;
+    }
+
+    uint16_t word = words[i];
+    if (!(word & 0x8000)) {
+      ins->op = OP_LOAD;
+      ins->value = word;
+      continue;
+    }
+    ins->op = (word >> HACK_COMP_SHIFT) & 0x7F;
+    ins->dest = (word >> HACK_DEST_SHIFT) & 7;
+    ins->jump = word & 7;
+
+    bool own_address_loaded = i > 0 && !(words[i - 1] & 0x8000) && words[i - 1] == i - 1;
+    if (ins->dest == 0 && ins->jump == (JUMP_GT | JUMP_EQ | JUMP_LT) && own_address_loaded) {
+      ins->op = OP_HALT_LOOP;
+    }
+  }
+  return true;
+}
+
+void hack_cpu_free(HackCpu* cpu) {
+  free(cpu->ram);
+  free(cpu->rom);
+  cpu->ram = NULL;
+  cpu->rom = NULL;
+}
+
+static uint16_t alu(uint8_t comp, uint16_t a, uint16_t d, uint16_t m) {
+
+  // uint8_t, uint16_t, uint16_t, uint16_t -> uint16_t
+  // The Hack ALU from its control bits (a zx nx zy ny f no), for comp codes that are not
+  // one of the documented mnemonics
+
+  uint16_t x = d;
+  uint16_t y = (comp & 0x40) ? m : a;
+  if (comp & 0x20) x = 0;
+  if (comp & 0x10) x = ~x;
+  if (comp & 0x08) y = 0;
+  if (comp & 0x04) y = ~y;
+  uint16_t out = (comp & 0x02) ? (uint16_t)(x + y) : (x & y);
+  if (comp & 0x01) out = ~out;
+  return out;
+}
+
+void hack_cpu_run(HackCpu* cpu, uint64_t limit, uint64_t* counts) {
+
+  // HackCpu*, uint64_t, uint64_t* -> void
+  // The interpreter loop. Registers live in locals; the comp switch compiles to a jump table.
+
+  const DecodedInstruction* rom = cpu->rom;
+  uint16_t* ram = cpu->ram;
+  uint16_t a = cpu->a, d = cpu->d, pc = cpu->pc;
+  uint64_t steps = 0;
+
+  while (!cpu->halted && steps < limit) {
+    const DecodedInstruction* ins = &rom[pc];
+    uint16_t m = ram[a & (HACK_RAM_SIZE - 1)];
+    uint16_t out;
+
+    switch (ins->op) {
+      case OP_LOAD:
+        if (counts) counts[pc]++;
+        steps++;
+        a = ins->value;
+        pc++;
+        continue;
+      case OP_HALT_LOOP:
+        if (a == (uint16_t)(pc - 1)) {
+          cpu->halted = true;
+          continue;
+        }
+        if (counts) counts[pc]++;
+        steps++;
+        pc = a;
+        continue;
+      case OP_END:
+        cpu->halted = true;
+        continue;
+      case 0x2A: out = 0; break;
+      case 0x3F: out = 1; break;
+      case 0x3A: out = 0xFFFF; break;
+      case 0x0C: out = d; break;
+      case 0x30: out = a; break;
+      case 0x0D: out = ~d; break;
+      case 0x31: out = ~a; break;
+      case 0x0F: out = -d; break;
+      case 0x33: out = -a; break;
+      case 0x1F: out = d + 1; break;
+      case 0x37: out = a + 1; break;
+      case 0x0E: out = d - 1; break;
+      case 0x32: out = a - 1; break;
+      case 0x02: out = d + a; break;
+      case 0x13: out = d - a; break;
+      case 0x07: out = a - d; break;
+      case 0x00: out = d & a; break;
+      case 0x15: out = d | a; break;
+      case 0x70: out = m; break;
+      case 0x71: out = ~m; break;
+      case 0x73: out = -m; break;
+      case 0x77: out = m + 1; break;
+      case 0x72: out = m - 1; break;
+      case 0x42: out = d + m; break;
+      case 0x53: out = d - m; break;
+      case 0x47: out = m - d; break;
+      case 0x40: out = d & m; break;
+      case 0x55: out = d | m; break;
+      default: out = alu(ins->op, a, d, m); break;
+    }
+
+    if (counts) counts[pc]++;
+    steps++;
+
+    uint16_t target = a;
+    if (ins->dest & HACK_DEST_M) ram[a & (HACK_RAM_SIZE - 1)] = out;
+    if (ins->dest & HACK_DEST_A) a = out;
+    if (ins->dest & HACK_DEST_D) d = out;
+
+    int16_t value = (int16_t)out;
+    int condition = value < 0 ? JUMP_LT : value == 0 ? JUMP_EQ : JUMP_GT;
+    pc = (ins->jump & condition) ? target : (uint16_t)(pc + 1);
+  }
+
+  cpu->a = a;
+  cpu->d = d;
+  cpu->pc = pc;
+  cpu->steps += steps;
+}
+
+typedef struct Region{
+  const char* name;
+  size_t start;
+  uint64_t instructions;
+} Region;
+
+static int compare_label_address(const void* x, const void* y) {
+  const ProfileLabel* a = x;
+  const ProfileLabel* b = y;
+  if (a->address != b->address) return a->address < b->address ? -1 : 1;
+  return 0;
+}
+
+static int compare_region_count(const void* x, const void* y) {
+  const Region* a = x;
+  const Region* b = y;
+  if (a->instructions != b->instructions) return a->instructions > b->instructions ? -1 : 1;
+  return a->start < b->start ? -1 : (a->start > b->start);
+}
+
+void print_profile(FILE* output, const uint64_t* counts, size_t rom_words, ProfileLabel* labels,
+                   size_t label_count) {
+
+  // FILE*, uint64_t*, size_t, ProfileLabel*, size_t -> void
+  // Folds the per-address counts into regions that start at each label address; code before
+  // the first label is reported as "(start)"
+
+  qsort(labels, label_count, sizeof(ProfileLabel), compare_label_address);
+
+  Region* regions = malloc((label_count + 1) * sizeof(Region));
+  if (!regions) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(1);
+  }
+  size_t region_count = 0;
+  if (label_count == 0 || labels[0].address > 0) {
+    regions[region_count++] = (Region){ "(start)", 0, 0 };
+  }
+
+  size_t next_label = 0;
+  uint64_t total = 0;
+  for (size_t address = 0; address < rom_words; address++) {
+    // Several labels on one address share the region; it is named after the first
+    if (next_label < label_count && labels[next_label].address == address) {
+      regions[region_count++] = (Region){ labels[next_label].name, address, 0 };
+      while (next_label < label_count && labels[next_label].address == address) next_label++;
+    }
+    regions[region_count - 1].instructions += counts[address];
+    total += counts[address];
+  }
+
+  qsort(regions, region_count, sizeof(Region), compare_region_count);
+  fprintf(output, "%-32s %16s %8s\n", "region", "instructions", "share");
+  for (size_t i = 0; i < region_count && regions[i].instructions > 0; i++) {
+    fprintf(output, "%-32s %16llu %7.2f%%\n", regions[i].name, (unsigned long long)regions[i].instructions,
+            total ? 100.0 * regions[i].instructions / total : 0.0);
+  }
+  free(regions);
+}
@@ -0,0 +1,183 @@
+#include "expression.h"
+#include <string.h>
+
+// Deepest parenthesis nesting accepted, which bounds the parser's recursion
+#define MAX_EXPRESSION_DEPTH 32
+
+typedef struct ExpressionParser{
+  const char* cursor;
+  const char* end;
+  const SymbolTable* table;
+  size_t symbol_count;
+  int depth;
+  bool unresolved;    // an operand had no usable address; values are computed with 0
+  bool overflow;
+  bool invalid;
+} ExpressionParser;
+
+static bool is_symbol_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+         c == '_' || c == '.' || c == '$' || c == ':';
+}
+
+static bool is_operator_char(char c) {
+  return c == '+' || c == '-' || c == '*' || c == '&' || c == '|' || c == '<' || c == '>' ||
+         c == '(' || c == ')';
+}
+
+bool is_expression(Slice text) {
+
+  // Slice -> bool
+  // Looks for any operator or parenthesis
+
+  for (size_t i = 0; i < text.len; i++) {
+    if (is_operator_char(text.ptr[i])) return true;
+  }
+  return false;
+}
+
+static bool accept(ExpressionParser* parser, const char* token) {
+
+  // ExpressionParser*, String -> bool
+  // Consumes token when the text continues with it
+
+  size_t len = token[1] ? 2 : 1;
+  if ((size_t)(parser->end - parser->cursor) < len || memcmp(parser->cursor, token, len) != 0) return false;
+  parser->cursor += len;
+  return true;
+}
+
+static int64_t parse_or(ExpressionParser* parser);
+
+static int64_t parse_operand(ExpressionParser* parser) {
+
+  // ExpressionParser* -> int64_t
+  // number | symbol | ( expression ) | -operand
+
+  if (parser->cursor == parser->end) {
+    parser->invalid = true;
+    return 0;
+  }
+  if (accept(parser, "-")) {
+    bool negate = true;
+    while (accept(parser, "-")) negate = !negate;
+    int64_t value = parse_operand(parser);
+    if (negate && __builtin_sub_overflow((int64_t)0, value, &value)) parser->overflow = true;
+    return value;
+  }
+  if (accept(parser, "(")) {
+    if (++parser->depth > MAX_EXPRESSION_DEPTH) {
+      parser->invalid = true;
+      return 0;
+    }
+    int64_t value = parse_or(parser);
+    parser->depth--;
+    if (!accept(parser, ")")) parser->invalid = true;
+    return value;
+  }
+
+  const char* start = parser->cursor;
+  while (parser->cursor < parser->end && is_symbol_char(*parser->cursor)) parser->cursor++;
+  size_t len = parser->cursor - start;
+  if (len == 0) {
+    parser->invalid = true;
+    return 0;
+  }
+
+  if (*start >= '0' && *start <= '9') {
+    int64_t value = 0;
+    for (size_t i = 0; i < len; i++) {
+      if (start[i] < '0' || start[i] > '9') {
+        parser->invalid = true;
+        return 0;
+      }
+      if (__builtin_mul_overflow(value, 10, &value) || __builtin_add_overflow(value, start[i] - '0', &value)) {
+        parser->overflow = true;
+      }
+    }
+    return value;
+  }
+
+  size_t index = parser->table ? symbol_table_find(parser->table, start, len) : SYMBOL_NOT_FOUND;
+  if (index == SYMBOL_NOT_FOUND || index >= parser->symbol_count || parser->table->symbols[index].variable) {
+    parser->unresolved = true;
+    return 0;
+  }
+  return parser->table->symbols[index].address;
+}
+
+static int64_t parse_product(ExpressionParser* parser) {
+  int64_t value = parse_operand(parser);
+  while (accept(parser, "*")) {
+    int64_t right = parse_operand(parser);
+    if (__builtin_mul_overflow(value, right, &value)) parser->overflow = true;
+  }
+  return value;
+}
+
+static int64_t parse_sum(ExpressionParser* parser) {
+  int64_t value = parse_product(parser);
+  for (;;) {
+    if (accept(parser, "+")) {
+      if (__builtin_add_overflow(value, parse_product(parser), &value)) parser->overflow = true;
+    } else if (accept(parser, "-")) {
+      if (__builtin_sub_overflow(value, parse_product(parser), &value)) parser->overflow = true;
+    } else {
+      return value;
+    }
+  }
+}
+
+static int64_t parse_shift(ExpressionParser* parser) {
+
+  // ExpressionParser* -> int64_t
+  // Shift counts must be 0..62; a left shift that loses bits overflows
+
+  int64_t value = parse_sum(parser);
+  for (;;) {
+    bool left = accept(parser, "<<");
+    if (!left && !accept(parser, ">>")) return value;
+    int64_t count = parse_sum(parser);
+    if (count < 0 || count > 62) {
+      parser->overflow = true;
+    } else if (left) {
+      if (__builtin_mul_overflow(value, (int64_t)1 << count, &value)) parser->overflow = true;
+    } else {
+      value >>= count;
+    }
+  }
+}
+
+static int64_t parse_and(ExpressionParser* parser) {
+  int64_t value = parse_shift(parser);
+  while (accept(parser, "&")) value &= parse_shift(parser);
+  return value;
+}
+
+static int64_t parse_or(ExpressionParser* parser) {
+  int64_t value = parse_and(parser);
+  while (accept(parser, "|")) value |= parse_and(parser);
+  return value;
+}
+
+ExpressionResult evaluate_expression(Slice text, const SymbolTable *table, size_t symbol_count,
+                                     uint16_t *value, const char **error) {
+
+  // Slice, SymbolTable*, size_t, uint16_t*, String* -> ExpressionResult
+  // Parses the whole text even past an unresolved operand, so syntax errors are found as
+  // soon as the instruction is read
+
+  ExpressionParser parser = { text.ptr, text.ptr + text.len, table, symbol_count, 0, false, false, false };
+  int64_t result = parse_or(&parser);
+  if (parser.invalid || parser.cursor != parser.end) {
+    *error = "invalid expression in";
+    return EXPRESSION_INVALID;
+  }
+  if (parser.unresolved) return EXPRESSION_UNRESOLVED;
+  if (parser.overflow || result < 0 || result > 32767) {
+    *error = "constant out of range in";
+    return EXPRESSION_INVALID;
+  }
+  *value = (uint16_t)result;
+  return EXPRESSION_VALUE;
+}
@@ -0,0 +1,304 @@
+#include "hack_asm.h"
+#include "assembler.h"
+#include "parallel.h"
+#include "cache.h"
+#include "pipeline.h"
+#include "emulator.h"
+#include "object.h"
+#include "lexer.h"
+#include "symbol_table.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+struct HackAsmContext{
+  SymbolTable predefined;   // snapshot restored into table before every program
+  SymbolTable table;
+  Arena arena;              // holds the words of the last program until the next call
+  int threads;
+  char* cache_path;         // incremental cache file, or NULL
+  bool optimize;
+  OptimizeReport report;    // of the last optimized program
+  HackObject object;        // of the last hack_asm_assemble_object() call
+};
+
+HackAsmContext* hack_asm_ctx_create(void) {
+
+  // void -> HackAsmContext*
+  // Creates a context with the predefined symbols loaded and an empty arena
+
+  HackAsmContext* ctx = malloc(sizeof(HackAsmContext));
+  if (!ctx) return NULL;
+
+  symbol_table_init(&ctx->predefined, 32);
+  add_predefined_symbols(&ctx->predefined);
+  symbol_table_init(&ctx->table, ctx->predefined.capacity);
+  arena_init(&ctx->arena, 1 << 16);
+  ctx->threads = 1;
+  ctx->cache_path = NULL;
+  ctx->optimize = false;
+  memset(&ctx->report, 0, sizeof(ctx->report));
+  memset(&ctx->object, 0, sizeof(ctx->object));
+  return ctx;
+}
+
+void hack_asm_ctx_destroy(HackAsmContext* ctx) {
+
+  // HackAsmContext* -> void
+  // Releases the context and everything it owns
+
+  if (!ctx) return;
+  symbol_table_free(&ctx->predefined);
+  symbol_table_free(&ctx->table);
+  arena_free(&ctx->arena);
+  free(ctx->cache_path);
+  free(ctx);
+}
+
+void hack_asm_ctx_reset(HackAsmContext* ctx) {
+
+  // HackAsmContext* -> void
+  // Forgets the last program's symbols and words, keeping the arena's blocks for reuse
+
+  symbol_table_copy(&ctx->table, &ctx->predefined);
+  arena_reset(&ctx->arena);
+  memset(&ctx->report, 0, sizeof(ctx->report));
+  memset(&ctx->object, 0, sizeof(ctx->object));
+}
+
+void hack_asm_ctx_set_threads(HackAsmContext* ctx, int threads) {
+  ctx->threads = threads < 1 ? 1 : threads;
+}
+
+void hack_asm_ctx_set_optimize(HackAsmContext* ctx, bool optimize) {
+  ctx->optimize = optimize;
+}
+
+const OptimizeReport* hack_asm_optimize_report(const HackAsmContext* ctx) {
+  return &ctx->report;
+}
+
+bool hack_asm_ctx_set_cache(HackAsmContext* ctx, const char* path) {
+
+  // HackAsmContext*, String -> bool
+  // Sets or clears the cache file; returns false when memory runs out
+
+  char* copy = NULL;
+  if (path) {
+    copy = malloc(strlen(path) + 1);
+    if (!copy) return false;
+    strcpy(copy, path);
+  }
+  free(ctx->cache_path);
+  ctx->cache_path = copy;
+  return true;
+}
+
+bool hack_asm_assemble_buffer(HackAsmContext* ctx, const char* source, size_t len,
+                              const uint16_t** words, size_t* count, HackAsmError* err) {
+
+  // HackAsmContext*, String, size_t, uint16_t**, size_t*, HackAsmError* -> bool
+  // Assembles one program from memory into words owned by the context
+
+  hack_asm_ctx_reset(ctx);
+
+  uint16_t* result;
+  size_t result_count;
+  AssemblyError error;
+  bool ok;
+  if (ctx->optimize) {
+    ok = assemble_words_optimized(&ctx->table, &ctx->arena, source, len, &result, &result_count, &error, &ctx->report);
+  } else if (ctx->cache_path) {
+    ok = assemble_words_cached(&ctx->table, &ctx->arena, source, len, ctx->cache_path, &result, &result_count, &error);
+  } else {
+    ok = assemble_words_parallel(&ctx->table, &ctx->arena, source, len, ctx->threads, &result, &result_count, &error);
+  }
+  if (!ok) {
+    if (err) {
+      err->line = error.line;
+      snprintf(err->message, sizeof(err->message), "%s '%.*s'", error.message, (int)error.text_len, error.text);
+    }
+    *words = NULL;
+    *count = 0;
+    return false;
+  }
+
+  *words = result;
+  *count = result_count;
+  return true;
+}
+
+bool hack_asm_assemble_object(HackAsmContext* ctx, const char* source, size_t len, HackAsmError* err) {
+
+  // HackAsmContext*, String, size_t, HackAsmError* -> bool
+  // Assembles one module into the context's object
+
+  hack_asm_ctx_reset(ctx);
+
+  AssemblyError error;
+  if (!assemble_object(&ctx->table, &ctx->arena, source, len, &ctx->object, &error)) {
+    if (err) {
+      err->line = error.line;
+      snprintf(err->message, sizeof(err->message), "%s '%.*s'", error.message, (int)error.text_len, error.text);
+    }
+    return false;
+  }
+  return true;
+}
+
+bool hack_asm_write_object(HackAsmContext* ctx, FILE* output) {
+  return write_object(output, &ctx->object, &ctx->arena);
+}
+
+bool hack_asm_link(HackAsmContext* ctx, const char* const* paths, size_t path_count,
+                   const uint16_t** words, size_t* count, HackAsmError* err) {
+
+  // HackAsmContext*, String[], size_t, uint16_t**, size_t*, HackAsmError* -> bool
+  // Maps every object file, links them and unmaps them again; the names they lend the
+  // linker are copied into the table
+
+  hack_asm_ctx_reset(ctx);
+  *words = NULL;
+  *count = 0;
+
+  SourceBuffer* files = arena_alloc(&ctx->arena, (path_count ? path_count : 1) * sizeof(SourceBuffer));
+  HackObject* objects = arena_alloc(&ctx->arena, (path_count ? path_count : 1) * sizeof(HackObject));
+  size_t opened = 0;
+  bool ok = true;
+  for (; opened < path_count; opened++) {
+    if (!source_open(&files[opened], paths[opened])) {
+      if (err) {
+        err->line = 0;
+        snprintf(err->message, sizeof(err->message), "%s: Error opening object file: %s", paths[opened], strerror(errno));
+      }
+      ok = false;
+      break;
+    }
+    if (!read_object(&objects[opened], files[opened].data, files[opened].size, &ctx->arena)) {
+      if (err) {
+        err->line = 0;
+        snprintf(err->message, sizeof(err->message), "%s: not a valid object file", paths[opened]);
+      }
+      opened++;
+      ok = false;
+      break;
+    }
+  }
+
+  if (ok) {
+    uint16_t* result;
+    size_t result_count;
+    LinkError error;
+    ok = link_objects(&ctx->table, &ctx->arena, objects, path_count, &result, &result_count, &error);
+    if (ok) {
+      *words = result;
+      *count = result_count;
+    } else if (err) {
+      err->line = 0;
+      snprintf(err->message, sizeof(err->message), "%s: %.100s", paths[error.object], error.message);
+    }
+  }
+
+  for (size_t i = 0; i < opened; i++) source_close(&files[i]);
+  return ok;
+}
+
+bool hack_asm_assemble_fd(HackAsmContext* ctx, int input_fd, int output_fd, const OutputOptions* options,
+                          size_t* count, HackAsmError* err) {
+
+  // HackAsmContext*, int, int, OutputOptions*, size_t*, HackAsmError* -> bool
+  // Runs the pipelined engine with the context's tables and arena
+
+  hack_asm_ctx_reset(ctx);
+
+  AssemblyError error;
+  PipelineResult result = assemble_pipelined(&ctx->table, &ctx->arena, input_fd, output_fd, options, count, &error);
+  if (result == PIPELINE_OK) return true;
+
+  if (err) {
+    if (result == PIPELINE_ASSEMBLY_ERROR) {
+      err->line = error.line;
+      snprintf(err->message, sizeof(err->message), "%s '%.*s'", error.message, (int)error.text_len, error.text);
+    } else {
+      err->line = 0;
+      snprintf(err->message, sizeof(err->message), "%s: %s",
+               result == PIPELINE_READ_ERROR ? "Error reading input file" : "Error writing output file",
+               strerror(errno));
+    }
+  }
+  return false;
+}
+
+bool hack_asm_write_symbols(HackAsmContext* ctx, FILE* output) {
+
+  // HackAsmContext*, FILE* -> bool
+  // Dumps every symbol the program added to the predefined ones
+
+  for (size_t i = ctx->predefined.size; i < ctx->table.size; i++) {
+    const Symbol* symbol = &ctx->table.symbols[i];
+    if (symbol->address == SYMBOL_UNDEFINED) continue;
+    fprintf(output, "%s %s %d\n", symbol->variable ? "variable" : "label",
+            symbol_table_name(&ctx->table, i), symbol->address);
+  }
+  return !ferror(output);
+}
+
+bool hack_asm_run(HackAsmContext* ctx, const uint16_t* words, size_t count, uint64_t limit, bool profile,
+                  FILE* report) {
+
+  // HackAsmContext*, uint16_t*, size_t, uint64_t, bool, FILE* -> bool
+  // Executes the program, counting per ROM address when profiling, and reports on it. The
+  // profile regions come from the labels left in the table by the last program.
+
+  HackCpu cpu;
+  if (!hack_cpu_init(&cpu, words, count)) {
+    fprintf(stderr, "The program has %zu words and does not fit in the %d-word ROM\n", count, HACK_ROM_SIZE);
+    return false;
+  }
+  uint64_t* counts = NULL;
+  if (profile) {
+    counts = calloc(65536, sizeof(uint64_t));
+    if (!counts) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(1);
+    }
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  hack_cpu_run(&cpu, limit, counts);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  fprintf(report, "Executed %llu instructions in %.3f ms (%.1f M instructions/s), %s at ROM address %u\n",
+          (unsigned long long)cpu.steps, seconds * 1e3, seconds > 0 ? cpu.steps / seconds / 1e6 : 0.0,
+          cpu.halted ? "halted" : "stopped", cpu.pc);
+  fprintf(report, "A=%d D=%d RAM[0..15]:", (int16_t)cpu.a, (int16_t)cpu.d);
+  for (int i = 0; i < 16; i++) fprintf(report, " %d", (int16_t)cpu.ram[i]);
+  fprintf(report, "\n");
+
+  if (profile) {
+    ProfileLabel* labels = arena_alloc(&ctx->arena, (ctx->table.size + 1) * sizeof(ProfileLabel));
+    size_t label_count = 0;
+    for (size_t i = ctx->predefined.size; i < ctx->table.size; i++) {
+      const Symbol* symbol = &ctx->table.symbols[i];
+      if (symbol->variable || symbol->address == SYMBOL_UNDEFINED) continue;
+      labels[label_count++] = (ProfileLabel){ (size_t)symbol->address, symbol_table_name(&ctx->table, i) };
+    }
+    print_profile(report, counts, count, labels, label_count);
+    free(counts);
+  }
+  hack_cpu_free(&cpu);
+  return !ferror(report);
+}
+
+bool hack_asm_write(HackAsmContext* ctx, FILE* output, const uint16_t* words, size_t count,
+                    const OutputOptions* options) {
+
+  // HackAsmContext*, FILE*, uint16_t*, size_t, OutputOptions* -> bool
+  // Formats words with the context's arena and threads and writes them in one go
+
+  return write_output_parallel(output, words, count, options, &ctx->arena, ctx->threads);
+}
@@ -0,0 +1,126 @@
+#include "ir.h"
+#include "lexer.h"
+#include "expression.h"
+#include "stats.h"
+#include <string.h>
+
+bool build_ir(SymbolTable *table, Arena *arena, const char *source, size_t size, HackIr *ir,
+              AssemblyError *error) {
+
+  // SymbolTable*, Arena*, String, size_t, HackIr*, AssemblyError* -> bool
+  // Reads the source once, turning each instruction into one IR entry
+
+  IrInstruction* items = NULL;
+  size_t count = 0, capacity = 0;
+  size_t word_count = 0;
+  IrExpression* expressions = NULL;
+  size_t expression_count = 0, expression_capacity = 0;
+  ir->first_program_symbol = table->size;
+
+  InstructionMemo* memo = arena_alloc(arena, sizeof(InstructionMemo));
+  instruction_memo_init(memo);
+
+  Lexer lexer;
+  lexer_init(&lexer, source, size);
+  bool ok = true;
+
+  STATS_PHASE_START(pass1);
+  Slice ins;
+  while (lexer_next(&lexer, &ins)) {
+    IrInstruction item = { IR_C, 0, 0 };
+    Slice name;
+    const char* message;
+
+    switch (parse_instruction_memo(memo, ins, &item.word, &name, &message)) {
+      case INSTRUCTION_LABEL: {
+        size_t symbol = symbol_table_intern(table, name.ptr, name.len);
+        STATS_ADD(labels, 1);
+        if (table->symbols[symbol].address != SYMBOL_UNDEFINED) continue;   // first definition wins
+        table->symbols[symbol].address = (int)word_count;
+        item.kind = IR_LABEL;
+        item.symbol = (uint32_t)symbol;
+        break;
+      }
+      case INSTRUCTION_SYMBOL: {  // label or variable, possibly defined further down
+        size_t symbol = symbol_table_intern(table, name.ptr, name.len);
+        item.kind = IR_SYMBOL;
+        item.symbol = (uint32_t)symbol;
+        word_count++;
+        break;
+      }
+      case INSTRUCTION_EXPRESSION: {
+        if (expression_count == expression_capacity) {
+          expressions = arena_grow_array(arena, expressions, &expression_capacity, sizeof(IrExpression));
+        }
+        char* text = arena_alloc(arena, ins.len);
+        memcpy(text, ins.ptr, ins.len);
+        expressions[expression_count] = (IrExpression){ { text, ins.len }, lexer.line_number };
+        item.kind = IR_EXPRESSION;
+        item.symbol = (uint32_t)expression_count++;
+        word_count++;
+        break;
+      }
+      case INSTRUCTION_WORD:
+        item.kind = ins.ptr[0] == '@' ? IR_CONSTANT : IR_C;
+        word_count++;
+        break;
+      case INSTRUCTION_INVALID:
+        set_assembly_error(error, lexer.line_number, message, ins);
+        ok = false;
+        break;
+    }
+    if (!ok) break;
+
+    if (count == capacity) {
+      items = arena_grow_array(arena, items, &capacity, sizeof(IrInstruction));
+    }
+    items[count++] = item;
+  }
+  lexer_free(&lexer);
+  instruction_memo_flush(memo);
+  STATS_PHASE_STOP(pass1, STATS_PASS1);
+
+  ir->items = items;
+  ir->count = count;
+  ir->word_count = word_count;
+  ir->expressions = expressions;
+  ir->expression_count = expression_count;
+  return ok;
+}
+
+bool resolve_ir_expressions(const SymbolTable *table, HackIr *ir, bool predefined_only, AssemblyError *error) {
+
+  // SymbolTable*, HackIr*, bool, AssemblyError* -> bool
+  // Reports the first expression, in source order, that does not evaluate
+
+  if (ir->expression_count == 0) return true;
+  size_t symbol_count = predefined_only ? ir->first_program_symbol : table->size;
+  for (size_t i = 0; i < ir->count; i++) {
+    IrInstruction* item = &ir->items[i];
+    if (item->kind != IR_EXPRESSION) continue;
+    const IrExpression* expression = &ir->expressions[item->symbol];
+    Slice text = { expression->instruction.ptr + 1, expression->instruction.len - 1 };
+    const char* message;
+    uint16_t value;
+    switch (evaluate_expression(text, table, symbol_count, &value, &message)) {
+      case EXPRESSION_VALUE:
+        item->kind = IR_CONSTANT;
+        item->word = value;
+        continue;
+      case EXPRESSION_UNRESOLVED: {
+        // Tell a label that is not allowed here from a name that is not a label at all
+        const char* unused;
+        bool label = predefined_only &&
+                     evaluate_expression(text, table, table->size, &value, &unused) != EXPRESSION_UNRESOLVED;
+        message = label ? "labels cannot be expression operands with -O or -c in"
+                        : "expression operand is not a label or predefined symbol in";
+        break;
+      }
+      case EXPRESSION_INVALID:
+        break;
+    }
+    set_assembly_error(error, expression->line, message, expression->instruction);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,174 @@
+#include "lexer.h"
+#include "compress.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool source_open(SourceBuffer* source, const char* path) {
+
+  // SourceBuffer*, String -> bool
+  // Memory-maps a regular file; falls back to a buffered read when mapping is not possible.
+  // .gz and .zst files are decompressed into a heap buffer instead.
+
+  Compression compression = compression_for_path(path);
+  if (compression != COMPRESSION_NONE) return source_open_compressed(source, path, compression);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat info;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      madvise(data, info.st_size, MADV_SEQUENTIAL);
+      close(fd);
+      source->data = data;
+      source->size = info.st_size;
+      source->mapped = true;
+      return true;
+    }
+  }
+
+  FILE* fp = fdopen(fd, "r");
+  if (!fp) {
+    close(fd);
+    return false;
+  }
+  bool ok = source_read_stream(source, fp);
+  fclose(fp);
+  return ok;
+}
+
+bool source_read_stream(SourceBuffer* source, FILE* fp) {
+
+  // SourceBuffer*, FILE* -> bool
+  // Reads a whole stream (pipes included) into one heap buffer using large buffered reads
+
+  size_t capacity = 1 << 16;
+  size_t size = 0;
+  char* buffer = malloc(capacity);
+  STATS_ALLOC(capacity);
+  if (!buffer) return false;
+
+  size_t n;
+  while ((n = fread(buffer + size, 1, capacity - size, fp)) > 0) {
+    size += n;
+    if (size == capacity) {
+      capacity *= 2;
+      char* tmp = realloc(buffer, capacity);
+      STATS_ALLOC(capacity);
+      if (!tmp) {
+        free(buffer);
+        return false;
+      }
+      buffer = tmp;
+    }
+  }
+
+  if (ferror(fp)) {
+    free(buffer);
+    return false;
+  }
+
+  source->data = buffer;
+  source->size = size;
+  source->mapped = false;
+  return true;
+}
+
+void source_close(SourceBuffer* source) {
+
+  // SourceBuffer* -> void
+  // Releases the mapping or the heap buffer behind a source
+
+  if (source->mapped) {
+    munmap((void*)source->data, source->size);
+  } else {
+    free((void*)source->data);
+  }
+  source->data = NULL;
+  source->size = 0;
+  source->mapped = false;
+}
+
+void lexer_init(Lexer* lexer, const char* data, size_t size) {
+
+  // Lexer*, String, size_t -> void
+  // Prepares a lexer over size bytes of source text
+
+  lexer->cursor = data;
+  lexer->end = data + size;
+  lexer->line_number = 0;
+  lexer->scratch = NULL;
+  lexer->scratch_capacity = 0;
+  lexer->scan = scan_select();
+}
+
+void lexer_free(Lexer* lexer) {
+
+  // Lexer* -> void
+  // Releases the lexer's scratch buffer
+
+  free(lexer->scratch);
+  lexer->scratch = NULL;
+  lexer->scratch_capacity = 0;
+}
+
+bool lexer_next(Lexer* lexer, Slice* instruction) {
+
+  // Lexer*, Slice* -> bool
+  // Finds the next non-empty instruction, skipping comments and whitespace without copying.
+  // The slice points into the source unless the instruction contains inner whitespace, in
+  // which case the compacted text is placed in the lexer's scratch buffer. Returns false at
+  // the end.
+
+  while (lexer->cursor < lexer->end) {
+    const char* line = lexer->cursor;
+    LineScan scan;
+    lexer->scan(line, lexer->end, &scan);
+    lexer->cursor = scan.end < lexer->end ? scan.end + 1 : lexer->end;
+    lexer->line_number++;
+
+    const char* stop = scan.stop;
+    size_t spaces = scan.spaces;
+    while (line < stop && scan_is_space(*line)) {
+      line++;
+      spaces--;
+    }
+    while (stop > line && scan_is_space(stop[-1])) {
+      stop--;
+      spaces--;
+    }
+    if (line == stop) continue;
+
+    size_t len = stop - line;
+    if (spaces == 0) {
+      instruction->ptr = line;
+      instruction->len = len;
+      return true;
+    }
+
+    if (len > lexer->scratch_capacity) {
+      char* tmp = realloc(lexer->scratch, len);
+      STATS_ALLOC(len);
+      if (!tmp) {
+        // Returning false here would end the input early and assemble a truncated program
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+      }
+      lexer->scratch = tmp;
+      lexer->scratch_capacity = len;
+    }
+
+    instruction->ptr = lexer->scratch;
+    instruction->len = scan_compact(line, stop, lexer->scratch);
+    return true;
+  }
+
+  return false;
+}
@@ -4,74 +4,728 @@
 #include <stdlib.h>
 #include "utils.h"
 #include "assembler.h"
+#include "lexer.h"
+#include "output.h"
+#include "batch.h"
+#include "hack_asm.h"
+#include "stats.h"
+#include "cache.h"
+#include "server.h"
+#include "disasm.h"
+#include "object.h"
+#include "compress.h"
 #include <unistd.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <fcntl.h>
+
+// Instructions --profile executes when no --run limit is given
+#define DEFAULT_RUN_LIMIT 100000000ULL
+
+static void print_usage(const char *program) {
+    printf("Usage: %s [--format=text|bin] [--endian=little|big] <inputfile> [outputfile]\n", program);
+    printf("       %s [options] -j <threads> <inputfile>...\n", program);
+    printf("       %s [options] --parallel=<threads> <inputfile> [outputfile]\n", program);
+    printf("       %s [options] --stats[=json] <inputfile> [outputfile]\n", program);
+    printf("       %s [options] --cache <dir> <inputfile>...\n", program);
+    printf("       %s [options] -O <inputfile> [outputfile]\n", program);
+    printf("       %s -c [-j <threads>] <inputfile> [outputfile]\n", program);
+    printf("       %s [options] --link <outputfile> <objectfile>...\n", program);
+    printf("       %s [options] --symbols <symfile> <inputfile> [outputfile]\n", program);
+    printf("       %s [options] --run <instructions> [--profile] <inputfile> [outputfile]\n", program);
+    printf("       %s --disassemble [--symbols <symfile>] <hackfile> [outputfile]\n", program);
+    printf("       %s [options] --pipeline <inputfile> [outputfile]\n", program);
+    printf("       %s [-j <threads>] --serve <socket>\n", program);
+    printf("       %s [options] --connect <socket> <inputfile> [outputfile]\n", program);
+}
+
+static char *output_name_for(const char *input_file_name, const char *output_file_name, const char *output_ext) {
+
+    // String, String, String -> String
+    // Builds the output file name: the user-specified name plus the extension, or the input
+    // name with its .asm extension replaced. A compression extension stays last, so
+    // Prog.asm.gz gives Prog.hack.gz, and so do the user-specified names Prog.gz and Prog.hack.gz.
+
+    const char *name = output_file_name ? output_file_name : input_file_name;
+    const char *compression_ext = compression_extension(compression_for_path(name));
+    size_t base_len = strlen(name) - strlen(compression_ext);
+    size_t ext_len = strlen(output_ext);
+
+    if (!output_file_name && base_len >= 4 && strncmp(name + base_len - 4, ".asm", 4) == 0) {
+        base_len -= 4; // replace the .asm extension
+    } else if (output_file_name && *compression_ext && base_len >= ext_len &&
+               strncmp(name + base_len - ext_len, output_ext, ext_len) == 0) {
+        base_len -= ext_len; // the user already gave the extension
+    }
+
+    char *output_complete_name = malloc(base_len + ext_len + strlen(compression_ext) + 1);
+    if (!output_complete_name) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    memcpy(output_complete_name, name, base_len);
+    strcpy(output_complete_name + base_len, output_ext);
+    strcat(output_complete_name, compression_ext);
+    return output_complete_name;
+}
+
+static int assemble_many(char **inputs, int count, int threads, const OutputOptions *options,
+                         const char *cache_dir, bool optimize, bool object) {
+
+    // String[], int, int, OutputOptions*, String, bool, bool -> int
+    // Batch mode: assembles every input next to itself on a thread pool and combines the results
+
+    BatchJob *jobs = calloc(count, sizeof(BatchJob));
+    if (!jobs) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        jobs[i].input_path = inputs[i];
+        jobs[i].output_path = output_name_for(inputs[i], NULL, object ? OBJECT_EXTENSION : output_extension(options->format));
+        jobs[i].cache_path = cache_dir ? cache_path_for(cache_dir, inputs[i]) : NULL;
+        jobs[i].optimize = optimize;
+        jobs[i].object = object;
+        if (cache_dir && !jobs[i].cache_path) {
+            for (int j = 0; j <= i; j++) {
+                free(jobs[j].output_path);
+                free(jobs[j].cache_path);
+            }
+            free(jobs);
+            return 1;
+        }
+    }
+
+    bool ok = assemble_batch(jobs, count, threads, options);
+
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (!jobs[i].ok) failed++;
+        free(jobs[i].output_path);
+        free(jobs[i].cache_path);
+    }
+    if (failed > 0) {
+        fprintf(stderr, "%d of %d files failed to assemble\n", failed, count);
+    }
+    free(jobs);
+
+    return ok ? 0 : 1;
+}
+
+static int assemble_remote(int server_fd, const char *input_file_name, bool read_stdin,
+                           const char *output_file_name, const char *cache_dir,
+                           const OutputOptions *options) {
+
+    // int, String, bool, String, String, OutputOptions* -> int
+    // Client mode: hands the invocation to a running daemon and reports its result like a
+    // local run would. Files are read by the daemon; standard input is sent along inline.
+
+    ServerRequest request = { NULL, NULL, 0, output_file_name, NULL, *options };
+    SourceBuffer source = { NULL, 0, false };
+    if (read_stdin) {
+        if (!source_read_stream(&source, stdin)) {
+            perror("Error opening input file");
+            close(server_fd);
+            return 1;
+        }
+        request.source = source.data;
+        request.source_size = source.size;
+    } else {
+        request.input_path = input_file_name;
+    }
+
+    char *cache_path = NULL;
+    if (cache_dir) {
+        cache_path = cache_path_for(cache_dir, read_stdin ? "stdin" : input_file_name);
+        if (!cache_path) {
+            if (read_stdin) source_close(&source);
+            close(server_fd);
+            return 1;
+        }
+        request.cache_path = cache_path;
+    }
+
+    HackAsmError error;
+    bool ok = server_request(server_fd, &request, &error);
+    if (!ok) {
+        if (error.line > 0) fprintf(stderr, "Line %zu: %s\n", error.line, error.message);
+        else fprintf(stderr, "%s\n", error.message);
+    }
+
+    if (read_stdin) source_close(&source);
+    free(cache_path);
+    return ok ? 0 : 1;
+}
+
+static void print_optimize_report(const OptimizeReport *report) {
+
+    // OptimizeReport* -> void
+    // Prints how many instructions (and so ROM words) -O removed, by pattern
+
+    size_t saved = report->words_before - report->words_after;
+    printf("Optimized %zu -> %zu words, %zu saved (%.1f%%): %zu dead loads, %zu redundant loads, %zu unreachable\n",
+           report->words_before, report->words_after, saved,
+           report->words_before ? 100.0 * saved / report->words_before : 0.0,
+           report->dead_loads, report->redundant_loads, report->unreachable);
+}
+
+static bool write_symbols(HackAsmContext *ctx, const char *symbols_path) {
+
+    // HackAsmContext*, String -> bool
+    // Writes the symbol dump of the program just assembled
+
+    FILE *fp = fopen(symbols_path, "w");
+    if (!fp) {
+        perror("Error opening symbol file");
+        return false;
+    }
+    bool ok = hack_asm_write_symbols(ctx, fp);
+    if (fclose(fp) != 0) ok = false;
+    if (!ok) {
+        perror("Error writing symbol file");
+        remove(symbols_path);
+    }
+    return ok;
+}
+
+static int disassemble_file(const char *input_file_name, bool read_stdin, const char *output_file_name,
+                            const char *symbols_path) {
+
+    // String, bool, String, String -> int
+    // --disassemble: decodes a .hack or .hackbin file into Hack assembly, restoring names from
+    // a symbol dump when one is given
+
+    if (!read_stdin && strcmp(input_file_name, output_file_name) == 0) {
+        fprintf(stderr, "Refusing to overwrite the input file %s\n", input_file_name);
+        return 1;
+    }
+
+    SourceBuffer source;
+    bool loaded = read_stdin ? source_read_stream(&source, stdin) : source_open(&source, input_file_name);
+    if (!loaded) {
+        perror("Error opening input file");
+        return 1;
+    }
+
+    uint16_t *words;
+    size_t count;
+    DisasmError error;
+    bool ok = decode_rom(source.data, source.size, &words, &count, &error);
+    source_close(&source);
+    if (!ok) {
+        if (error.position > 0) fprintf(stderr, "Line %zu: %s\n", error.position, error.message);
+        else fprintf(stderr, "%s\n", error.message);
+        return 1;
+    }
+
+    HackSymbols symbols;
+    if (symbols_path && !hack_symbols_load(&symbols, symbols_path)) {
+        free(words);
+        return 1;
+    }
+
+    FILE *output = output_open(output_file_name, false);
+    if (!output) {
+        perror("Error opening output file");
+        ok = false;
+    } else {
+        ok = disassemble(output, words, count, symbols_path ? &symbols : NULL, &error);
+        if (!ok && error.message) {
+            fprintf(stderr, "ROM address %zu: %s (0x%04x)\n", error.position, error.message, words[error.position]);
+        } else if (!ok) {
+            perror("Error writing output file");
+        }
+        if (fclose(output) != 0) ok = false;
+        if (!ok) remove(output_file_name);
+    }
+
+    if (symbols_path) hack_symbols_free(&symbols);
+    free(words);
+    return ok ? 0 : 1;
+}
+
+static int compile_object(const char *input_file_name, bool read_stdin, const char *output_file_name) {
+
+    // String, bool, String -> int
+    // -c: assembles one module into a relocatable object file
+
+    SourceBuffer source;
+    bool loaded = read_stdin ? source_read_stream(&source, stdin) : source_open(&source, input_file_name);
+    if (!loaded) {
+        perror("Error opening input file");
+        return 1;
+    }
+
+    HackAsmContext *ctx = hack_asm_ctx_create();
+    if (!ctx) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+
+    HackAsmError error;
+    bool ok = hack_asm_assemble_object(ctx, source.data, source.size, &error);
+    source_close(&source);
+    if (!ok) {
+        fprintf(stderr, "Line %zu: %s\n", error.line, error.message);
+    } else {
+        FILE *output = output_open(output_file_name, true);
+        if (!output) {
+            perror("Error opening output file");
+            ok = false;
+        } else {
+            if (!hack_asm_write_object(ctx, output)) {
+                perror("Error writing output file");
+                ok = false;
+            }
+            if (fclose(output) != 0) ok = false;
+            if (!ok) remove(output_file_name);
+        }
+    }
+
+    hack_asm_ctx_destroy(ctx);
+    return ok ? 0 : 1;
+}
+
+static int link_files(char **objects, int count, const char *output_file_name, const OutputOptions *options,
+                      const char *symbols_path, uint64_t run_limit, bool profile) {
+
+    // String[], int, String, OutputOptions*, String, uint64_t, bool -> int
+    // --link: merges object files into one program and writes it like an assembled one
+
+    HackAsmContext *ctx = hack_asm_ctx_create();
+    if (!ctx) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+
+    const uint16_t *words;
+    size_t word_count;
+    HackAsmError error;
+    bool ok = hack_asm_link(ctx, (const char *const *)objects, count, &words, &word_count, &error);
+    if (!ok) {
+        fprintf(stderr, "%s\n", error.message);
+    } else {
+        FILE *output = output_open(output_file_name, options->format == OUTPUT_BINARY);
+        if (!output) {
+            perror("Error opening output file");
+            ok = false;
+        } else {
+            if (!hack_asm_write(ctx, output, words, word_count, options)) {
+                perror("Error writing output file");
+                ok = false;
+            }
+            if (fclose(output) != 0) ok = false;
+            if (!ok) remove(output_file_name);
+        }
+        if (ok && symbols_path && !write_symbols(ctx, symbols_path)) ok = false;
+        if (ok && run_limit && !hack_asm_run(ctx, words, word_count, run_limit, profile, stdout)) ok = false;
+    }
+
+    hack_asm_ctx_destroy(ctx);
+    return ok ? 0 : 1;
+}
+
+static int assemble_streamed(const char *input_file_name, bool read_stdin, const char *output_file_name,
+                             const OutputOptions *options, const char *symbols_path, bool show_stats,
+                             bool stats_json) {
+
+    // String, bool, String, OutputOptions*, String, bool, bool -> int
+    // --pipeline: reads, encodes and writes concurrently instead of loading the whole input
+    // first. The output is opened read-write so that forward references can be patched.
+
+    int input_fd = read_stdin ? STDIN_FILENO : open(input_file_name, O_RDONLY);
+    if (input_fd < 0) {
+        perror("Error opening input file");
+        return 1;
+    }
+    int output_fd = open(output_file_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (output_fd < 0) {
+        perror("Error opening output file");
+        if (!read_stdin) close(input_fd);
+        return 1;
+    }
+
+    HackAsmContext *ctx = hack_asm_ctx_create();
+    if (!ctx) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+
+    AssemblyStats stats;
+    if (show_stats) stats_begin(&stats);
+
+    size_t word_count;
+    HackAsmError error;
+    bool ok = hack_asm_assemble_fd(ctx, input_fd, output_fd, options, &word_count, &error);
+    if (close(output_fd) != 0 && ok) {
+        perror("Error writing output file");
+        ok = false;
+    }
+    if (!read_stdin) close(input_fd);
+
+    if (!ok) {
+        if (error.line > 0) fprintf(stderr, "Line %zu: %s\n", error.line, error.message);
+        else fprintf(stderr, "%s\n", error.message);
+        remove(output_file_name);
+    } else if (symbols_path && !write_symbols(ctx, symbols_path)) {
+        ok = false;
+    }
+
+    if (show_stats) {
+        stats_end();
+        stats_print(stdout, &stats, stats_json);
+    }
+    hack_asm_ctx_destroy(ctx);
+    return ok ? 0 : 1;
+}
 
 int main(int argc, char *argv[]) {
 
     // int, char** -> int
     // Entry point for the assembler program
-    // Usage: ./assembler <inputfile> [outputfile]
+    // Usage: ./assembler [--format=text|bin] [--endian=little|big] <inputfile> [outputfile]
     // Reads an assembly (.asm) file, assembles it, and writes the output to a .hack file
+    // (or a packed .hackbin ROM image with --format=bin)
+    // An input file name of "-" reads the program from standard input
+    // Files named *.gz (and *.zst when built with ZSTD=1) are decompressed on input and
+    // compressed on output; Prog.asm.gz assembles to Prog.hack.gz
+    // With -j N every argument is an input file, and all of them are assembled on N threads
+    // (0 means one per online CPU)
+    // --parallel=N splits a single large input across N threads
+    // --cache DIR keeps an incremental cache per input in DIR so that only changed parts of a
+    // program are encoded again
+    // --stats prints per-phase timings and counters to stdout (--stats=json as one JSON object)
+    // --pipeline overlaps reading, encoding and writing of a single input on three threads
+    // -O runs the peephole optimizer and reports the ROM words it saved
+    // --run N executes the assembled program on the built-in emulator for at most N instructions;
+    // --profile also counts the instructions executed under every label
+    // -c writes a relocatable object (.hackobj) per module instead of a ROM; --link OUT links
+    // object files, in the order given, into the program OUT
+    // --symbols FILE also writes the program's labels and variables to FILE
+    // --disassemble turns a .hack or .hackbin file back into assembly (named from --symbols)
+    // --serve SOCK runs a daemon on a Unix socket (with -j worker threads); --connect SOCK, or
+    // HACK_ASM_SERVER in the environment, sends single-file invocations to it, assembling
+    // locally when no daemon is listening
+
+    OutputOptions options = { OUTPUT_TEXT, HACK_ENDIAN_LITTLE };
+    int threads = -1;
+    int parallel_threads = 1;
+    bool show_stats = false;
+    bool stats_json = false;
+    bool pipelined = false;
+    bool optimize = false;
+    bool compile_only = false;
+    const char *link_output = NULL;
+    bool disassembling = false;
+    bool profile = false;
+    uint64_t run_limit = 0;
+    const char *symbols_path = NULL;
+    const char *cache_dir = NULL;
+    const char *serve_path = NULL;
+    const char *connect_path = getenv("HACK_ASM_SERVER");
+
+    static const struct option long_options[] = {
+        { "format", required_argument, NULL, 'f' },
+        { "endian", required_argument, NULL, 'e' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "parallel", required_argument, NULL, 'p' },
+        { "stats", optional_argument, NULL, 's' },
+        { "cache", required_argument, NULL, 'k' },
+        { "serve", required_argument, NULL, 'S' },
+        { "connect", required_argument, NULL, 'C' },
+        { "pipeline", no_argument, NULL, 'P' },
+        { "disassemble", no_argument, NULL, 'd' },
+        { "symbols", required_argument, NULL, 'y' },
+        { "run", required_argument, NULL, 'r' },
+        { "profile", no_argument, NULL, 'R' },
+        { "link", required_argument, NULL, 'l' },
+        { NULL, 0, NULL, 0 }
+    };
 
-    if (argc < 2) {
-        printf("Usage: %s <inputfile> [outputfile]\n", argv[0]);
+    int opt;
+    while ((opt = getopt_long(argc, argv, "j:Oc", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'j':
+            case 'p': {
+                char *end;
+                long value = strtol(optarg, &end, 10);
+                if (*end != '\0' || value < 0) {
+                    fprintf(stderr, "Invalid thread count '%s'\n", optarg);
+                    return 1;
+                }
+                int count = value == 0 ? (int)sysconf(_SC_NPROCESSORS_ONLN) : (int)value;
+                if (opt == 'j') threads = count;
+                else parallel_threads = count;
+                break;
+            }
+            case 'f':
+                if (strcmp(optarg, "text") == 0) options.format = OUTPUT_TEXT;
+                else if (strcmp(optarg, "bin") == 0) options.format = OUTPUT_BINARY;
+                else {
+                    fprintf(stderr, "Unknown output format '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'e':
+                if (strcmp(optarg, "little") == 0) options.endian = HACK_ENDIAN_LITTLE;
+                else if (strcmp(optarg, "big") == 0) options.endian = HACK_ENDIAN_BIG;
+                else {
+                    fprintf(stderr, "Unknown byte order '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'k':
+                cache_dir = optarg;
+                break;
+            case 'S':
+                serve_path = optarg;
+                break;
+            case 'C':
+                connect_path = optarg;
+                break;
+            case 'P':
+                pipelined = true;
+                break;
+            case 'O':
+                optimize = true;
+                break;
+            case 'c':
+                compile_only = true;
+                break;
+            case 'l':
+                link_output = optarg;
+                break;
+            case 'd':
+                disassembling = true;
+                break;
+            case 'y':
+                symbols_path = optarg;
+                break;
+            case 'r': {
+                char *end;
+                unsigned long long value = strtoull(optarg, &end, 10);
+                if (*end != '\0' || value == 0 || optarg[0] == '-') {
+                    fprintf(stderr, "Invalid instruction limit '%s'\n", optarg);
+                    return 1;
+                }
+                run_limit = value;
+                break;
+            }
+            case 'R':
+                profile = true;
+                break;
+            case 's':
+                if (!HACK_STATS) {
+                    fprintf(stderr, "Statistics are not available in this build (built with STATS=0)\n");
+                    return 1;
+                }
+                if (optarg && strcmp(optarg, "json") != 0) {
+                    fprintf(stderr, "Unknown statistics format '%s'\n", optarg);
+                    return 1;
+                }
+                show_stats = true;
+                stats_json = optarg != NULL;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (serve_path) {
+        if (optind < argc) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        return serve(serve_path, threads > 0 ? threads : (int)sysconf(_SC_NPROCESSORS_ONLN));
+    }
+
+    if (optind >= argc) {
+        print_usage(argv[0]);
         return 1;
     }
 
-    const char *input_file_name = argv[1];
-    const char *output_file_name = (argc >= 3) ? argv[2] : NULL;
+    if (optimize && (parallel_threads > 1 || cache_dir || pipelined)) {
+        fprintf(stderr, "-O cannot be combined with --parallel, --cache or --pipeline\n");
+        return 1;
+    }
 
-    const char *output_ext = ".hack";
+    if (profile && run_limit == 0) run_limit = DEFAULT_RUN_LIMIT;
+    if (run_limit && (threads >= 0 || pipelined || disassembling)) {
+        fprintf(stderr, "--run and --profile cannot be combined with -j, --pipeline or --disassemble\n");
+        return 1;
+    }
+
+    if (compile_only || link_output) {
+        if (compile_only && link_output) {
+            fprintf(stderr, "-c and --link cannot be combined\n");
+            return 1;
+        }
+        if (optimize || parallel_threads > 1 || cache_dir || pipelined || disassembling || show_stats) {
+            fprintf(stderr, "-c and --link cannot be combined with -O, --parallel, --cache, --pipeline, "
+                            "--disassemble or --stats\n");
+            return 1;
+        }
+        if (compile_only && (symbols_path || run_limit)) {
+            fprintf(stderr, "-c writes objects only; use --symbols and --run with --link\n");
+            return 1;
+        }
+    }
 
-    char *input_complete_name = strdup(input_file_name); // duplicate input filename
-    char *output_complete_name;
+    if (link_output) {
+        if (threads >= 0) {
+            fprintf(stderr, "--link cannot be combined with -j\n");
+            return 1;
+        }
+        char *output_complete_name = output_name_for(link_output, link_output, output_extension(options.format));
+        int status = link_files(argv + optind, argc - optind, output_complete_name, &options, symbols_path,
+                                run_limit, profile);
+        free(output_complete_name);
+        return status;
+    }
 
-    // Determine output file name
-    if (output_file_name) {
-        output_complete_name = append_strings(output_file_name, output_ext); // user-specified output file
-    } else {
-        char *dot = strrchr(input_file_name, '.');
-        if (dot && strcmp(dot, ".asm") == 0) {
-            // Replace .asm extension with .hack
-            size_t base_len = dot - input_file_name;
-            output_complete_name = malloc(base_len + strlen(output_ext) + 1);
-            strncpy(output_complete_name, input_file_name, base_len);
-            output_complete_name[base_len] = '\0';
-            strcat(output_complete_name, output_ext);
-        } else {
-            // fallback: just append .hack
-            output_complete_name = append_strings(input_file_name, output_ext);
+    if (threads >= 0) {
+        if (show_stats) {
+            fprintf(stderr, "--stats cannot be combined with -j\n");
+            return 1;
+        }
+        if (disassembling || symbols_path) {
+            fprintf(stderr, "-j only assembles; --disassemble and --symbols take a single file\n");
+            return 1;
+        }
+        return assemble_many(argv + optind, argc - optind, threads, &options, cache_dir, optimize, compile_only);
+    }
+
+    const char *input_file_name = argv[optind];
+    const char *output_file_name = (optind + 1 < argc) ? argv[optind + 1] : NULL;
+    bool read_stdin = strcmp(input_file_name, "-") == 0;
+
+    if (read_stdin && !output_file_name) {
+        printf("Usage: %s [options] - <outputfile>\n", argv[0]);
+        return 1;
+    }
+
+    if (disassembling) {
+        char *output_asm_name = output_name_for(input_file_name, output_file_name, ".asm");
+        int status = disassemble_file(input_file_name, read_stdin, output_asm_name, symbols_path);
+        free(output_asm_name);
+        return status;
+    }
+
+    if (compile_only) {
+        char *output_object_name = output_name_for(input_file_name, output_file_name, OBJECT_EXTENSION);
+        int status = compile_object(input_file_name, read_stdin, output_object_name);
+        free(output_object_name);
+        return status;
+    }
+
+    char *output_complete_name = output_name_for(input_file_name, output_file_name, output_extension(options.format));
+
+    if (pipelined) {
+        if (parallel_threads > 1 || cache_dir) {
+            fprintf(stderr, "--pipeline cannot be combined with --parallel or --cache\n");
+            free(output_complete_name);
+            return 1;
+        }
+        // The output is patched in place, and the input is read as it arrives
+        if (compression_for_path(input_file_name) != COMPRESSION_NONE ||
+            compression_for_path(output_complete_name) != COMPRESSION_NONE) {
+            fprintf(stderr, "--pipeline reads and writes uncompressed files only\n");
+            free(output_complete_name);
+            return 1;
         }
+        int status = assemble_streamed(input_file_name, read_stdin, output_complete_name, &options,
+                                       symbols_path, show_stats, stats_json);
+        free(output_complete_name);
+        return status;
     }
 
-    // Open input file for reading
-    FILE *input = fopen(input_complete_name, "r");
-    if (!input) {
+    // Statistics, --parallel, --symbols and --run describe this process, so those runs always stay local
+    if (connect_path && *connect_path && !show_stats && !symbols_path && !optimize && !run_limit &&
+        parallel_threads == 1) {
+        int server_fd = server_connect(connect_path);
+        if (server_fd >= 0) {
+            int status = assemble_remote(server_fd, input_file_name, read_stdin, output_complete_name,
+                                         cache_dir, &options);
+            free(output_complete_name);
+            return status;
+        }
+    }
+
+    AssemblyStats stats;
+    if (show_stats) stats_begin(&stats);
+
+    // Load the input: regular files are memory-mapped, anything else is read through stdio
+    STATS_PHASE_START(read);
+    SourceBuffer source;
+    bool loaded = read_stdin ? source_read_stream(&source, stdin)
+                             : source_open(&source, input_file_name);
+    STATS_PHASE_STOP(read, STATS_READ);
+    if (!loaded) {
         perror("Error opening input file");
+        free(output_complete_name);
         return 1;
     }
 
-    // Open output file for writing
-    FILE *output = fopen(output_complete_name, "w");
-    if (!output) {
-        perror("Error opening output file");
-        fclose(input);
+    HackAsmContext *ctx = hack_asm_ctx_create();
+    if (!ctx) {
+        fprintf(stderr, "Memory allocation failed\n");
+        source_close(&source);
+        free(output_complete_name);
         return 1;
     }
+    hack_asm_ctx_set_threads(ctx, parallel_threads);
+    hack_asm_ctx_set_optimize(ctx, optimize);
+    if (cache_dir) {
+        char *cache_path = cache_path_for(cache_dir, read_stdin ? "stdin" : input_file_name);
+        bool cache_set = cache_path && hack_asm_ctx_set_cache(ctx, cache_path);
+        free(cache_path);
+        if (!cache_set) {
+            hack_asm_ctx_destroy(ctx);
+            source_close(&source);
+            free(output_complete_name);
+            return 1;
+        }
+    }
 
-    // Assemble input file into output file
-    assemble(input, output);
+    // Assemble the whole program in memory, then write it out in one go
+    const uint16_t *words;
+    size_t word_count;
+    HackAsmError error;
+    bool ok = hack_asm_assemble_buffer(ctx, source.data, source.size, &words, &word_count, &error);
+    source_close(&source);
 
-    // Remove the trailing newline at the end of the output file
-    fflush(output);
-    long pos = ftell(output);
-    ftruncate(fileno(output), pos - 1);
+    if (!ok) {
+        fprintf(stderr, "Line %zu: %s\n", error.line, error.message);
+    } else {
+        FILE *output = output_open(output_complete_name, options.format == OUTPUT_BINARY);
+        if (!output) {
+            perror("Error opening output file");
+            ok = false;
+        } else {
+            STATS_PHASE_START(write);
+            if (!hack_asm_write(ctx, output, words, word_count, &options)) {
+                perror("Error writing output file");
+                ok = false;
+            }
+            if (fclose(output) != 0) ok = false;
+            STATS_PHASE_STOP(write, STATS_OUTPUT);
+            if (!ok) remove(output_complete_name);
+        }
+        if (ok && symbols_path && !write_symbols(ctx, symbols_path)) ok = false;
+        if (ok && optimize) print_optimize_report(hack_asm_optimize_report(ctx));
+        if (ok && run_limit && !hack_asm_run(ctx, words, word_count, run_limit, profile, stdout)) ok = false;
+    }
+
+    if (show_stats) {
+        stats_end();
+        stats_print(stdout, &stats, stats_json);
+    }
 
     // Clean up
-    fclose(input);
-    fclose(output);
-    free(input_complete_name);
+    hack_asm_ctx_destroy(ctx);
     free(output_complete_name);
 
-    return 0;
-}
\ No newline at end of file
+    return ok ? 0 : 1;
+}
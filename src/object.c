@@ -0,0 +1,293 @@
+#include "object.h"
+#include "ir.h"
+#include "output.h"
+#include "hack_isa.h"
+#include "stats.h"
+#include <string.h>
+
+// On-disk symbol; the name is at name_offset in the name area
+typedef struct ObjectSymbolRecord{
+  uint32_t name_offset;
+  uint32_t len;
+  uint32_t kind;
+  uint32_t offset;
+} ObjectSymbolRecord;
+
+static size_t align8(size_t n) {
+  return (n + 7) & ~(size_t)7;
+}
+
+bool assemble_object(SymbolTable *table, Arena *arena, const char *source, size_t size,
+                     HackObject *object, AssemblyError *error) {
+
+  // SymbolTable*, Arena*, String, size_t, HackObject*, AssemblyError* -> bool
+  // Encodes the module from its IR. Labels get module-relative addresses; references to
+  // anything but predefined symbols are recorded as relocations.
+
+  HackIr ir;
+  if (!build_ir(table, arena, source, size, &ir, error)) return false;
+  if (!resolve_ir_expressions(table, &ir, true, error)) return false;
+  if (ir.word_count > HACK_ROM_SIZE) {
+    set_word_error(error, source, size, HACK_ROM_SIZE, "module does not fit in the 32768-word ROM at");
+    return false;
+  }
+  size_t first_program_symbol = ir.first_program_symbol;
+
+  uint16_t* words = arena_alloc(arena, (ir.word_count ? ir.word_count : 1) * sizeof(uint16_t));
+  size_t word_count = 0;
+  ObjectRelocation* relocations = NULL;
+  size_t relocation_count = 0, relocation_capacity = 0;
+  for (size_t i = 0; i < ir.count; i++) {
+    const IrInstruction* item = &ir.items[i];
+    if (item->kind == IR_LABEL) continue;
+    if (item->kind == IR_SYMBOL && item->symbol >= first_program_symbol) {
+      if (relocation_count == relocation_capacity) {
+        relocations = arena_grow_array(arena, relocations, &relocation_capacity, sizeof(ObjectRelocation));
+      }
+      relocations[relocation_count++] = (ObjectRelocation){ (uint32_t)word_count,
+                                                            (uint32_t)(item->symbol - first_program_symbol) };
+      words[word_count++] = 0;
+    } else if (item->kind == IR_SYMBOL) {
+      words[word_count++] = (uint16_t)table->symbols[item->symbol].address;
+    } else {
+      words[word_count++] = item->word;
+    }
+  }
+
+  size_t symbol_count = table->size - first_program_symbol;
+  ObjectSymbol* symbols = arena_alloc(arena, (symbol_count ? symbol_count : 1) * sizeof(ObjectSymbol));
+  for (size_t i = 0; i < symbol_count; i++) {
+    const Symbol* symbol = &table->symbols[first_program_symbol + i];
+    const char* name = symbol_table_name(table, first_program_symbol + i);
+    ObjectSymbol* out = &symbols[i];
+    out->name = name;
+    out->len = (uint32_t)strlen(name);
+    if (symbol->address == SYMBOL_UNDEFINED) {
+      out->kind = OBJECT_EXTERNAL;
+      out->offset = 0;
+    } else {
+      out->kind = memchr(name, '$', out->len) ? OBJECT_LOCAL : OBJECT_EXPORTED;
+      out->offset = (uint32_t)symbol->address;
+    }
+  }
+  STATS_ADD(instructions, word_count);
+
+  object->words = words;
+  object->word_count = (uint32_t)word_count;
+  object->symbols = symbols;
+  object->symbol_count = (uint32_t)symbol_count;
+  object->relocations = relocations;
+  object->relocation_count = (uint32_t)relocation_count;
+  return true;
+}
+
+bool write_object(FILE *output, const HackObject *object, Arena *arena) {
+
+  // FILE*, HackObject*, Arena* -> bool
+  // Serializes the object into one buffer and writes it in one go
+
+  size_t names_size = 0;
+  for (uint32_t i = 0; i < object->symbol_count; i++) names_size += object->symbols[i].len;
+
+  size_t words_size = align8(object->word_count * sizeof(uint16_t));
+  size_t size = OBJECT_HEADER_SIZE + words_size + object->symbol_count * sizeof(ObjectSymbolRecord) +
+                object->relocation_count * sizeof(ObjectRelocation) + names_size;
+  char* data = arena_alloc(arena, size);
+  memset(data, 0, size);
+
+  uint32_t header[4] = { object->word_count, object->symbol_count, object->relocation_count,
+                         (uint32_t)names_size };
+  memcpy(data, OBJECT_MAGIC, 8);
+  memcpy(data + 8, header, sizeof(header));
+
+  char* out = data + OBJECT_HEADER_SIZE;
+  if (object->word_count > 0) memcpy(out, object->words, object->word_count * sizeof(uint16_t));
+  out += words_size;
+
+  uint32_t name_offset = 0;
+  for (uint32_t i = 0; i < object->symbol_count; i++) {
+    const ObjectSymbol* symbol = &object->symbols[i];
+    ObjectSymbolRecord record = { name_offset, symbol->len, symbol->kind, symbol->offset };
+    memcpy(out, &record, sizeof(record));
+    out += sizeof(record);
+    name_offset += symbol->len;
+  }
+  if (object->relocation_count > 0) {
+    memcpy(out, object->relocations, object->relocation_count * sizeof(ObjectRelocation));
+    out += object->relocation_count * sizeof(ObjectRelocation);
+  }
+  for (uint32_t i = 0; i < object->symbol_count; i++) {
+    memcpy(out, object->symbols[i].name, object->symbols[i].len);
+    out += object->symbols[i].len;
+  }
+
+  return write_all(output, data, size);
+}
+
+bool read_object(HackObject *object, const char *data, size_t size, Arena *arena) {
+
+  // HackObject*, String, size_t, Arena* -> bool
+  // Parses and checks an object image: every count, name, label offset and relocation must
+  // stay inside the file and the module
+
+  if (size < OBJECT_HEADER_SIZE || memcmp(data, OBJECT_MAGIC, 8) != 0) return false;
+  uint32_t header[4];
+  memcpy(header, data + 8, sizeof(header));
+  uint32_t word_count = header[0], symbol_count = header[1], relocation_count = header[2];
+  size_t names_size = header[3];
+
+  size_t offset = OBJECT_HEADER_SIZE;
+  size_t words_size = align8((size_t)word_count * sizeof(uint16_t));
+  if (words_size > size - offset) return false;
+  size_t tables_size = (size_t)symbol_count * sizeof(ObjectSymbolRecord) +
+                       (size_t)relocation_count * sizeof(ObjectRelocation);
+  if (tables_size > size - offset - words_size || names_size != size - offset - words_size - tables_size) {
+    return false;
+  }
+
+  object->word_count = word_count;
+  object->words = arena_alloc(arena, (word_count ? word_count : 1) * sizeof(uint16_t));
+  memcpy(object->words, data + offset, (size_t)word_count * sizeof(uint16_t));
+  offset += words_size;
+
+  const char* names = data + size - names_size;
+  object->symbol_count = symbol_count;
+  object->symbols = arena_alloc(arena, (symbol_count ? symbol_count : 1) * sizeof(ObjectSymbol));
+  for (uint32_t i = 0; i < symbol_count; i++) {
+    ObjectSymbolRecord record;
+    memcpy(&record, data + offset, sizeof(record));
+    offset += sizeof(record);
+    if (record.name_offset > names_size || record.len > names_size - record.name_offset) return false;
+    if (record.len == 0 || record.kind > OBJECT_EXTERNAL) return false;
+    if (record.kind != OBJECT_EXTERNAL && record.offset > word_count) return false;
+    object->symbols[i] = (ObjectSymbol){ names + record.name_offset, record.len, record.kind, record.offset };
+  }
+
+  object->relocation_count = relocation_count;
+  object->relocations = arena_alloc(arena, (relocation_count ? relocation_count : 1) * sizeof(ObjectRelocation));
+  memcpy(object->relocations, data + offset, (size_t)relocation_count * sizeof(ObjectRelocation));
+  for (uint32_t i = 0; i < relocation_count; i++) {
+    if (object->relocations[i].word >= word_count || object->relocations[i].symbol >= symbol_count) return false;
+  }
+  return true;
+}
+
+static bool check_variables(const SymbolTable *table, size_t first_program_symbol, const HackObject *objects,
+                            size_t count, LinkError *error) {
+
+  // SymbolTable*, size_t, HackObject*, size_t, LinkError* -> bool
+  // Fails when a name that became a variable is a local label of some module: a reference
+  // to it from another module would read RAM where the concatenated source jumps to code
+
+  SymbolTable locals;
+  symbol_table_init(&locals, 64);
+  for (size_t m = 0; m < count; m++) {
+    for (uint32_t i = 0; i < objects[m].symbol_count; i++) {
+      const ObjectSymbol* symbol = &objects[m].symbols[i];
+      if (symbol->kind != OBJECT_LOCAL) continue;
+      size_t index = symbol_table_intern(&locals, symbol->name, symbol->len);
+      if (locals.symbols[index].address == SYMBOL_UNDEFINED) locals.symbols[index].address = (int)m;
+    }
+  }
+
+  bool ok = true;
+  for (size_t i = first_program_symbol; i < table->size && ok; i++) {
+    if (!table->symbols[i].variable) continue;
+    const char* name = symbol_table_name(table, i);
+    size_t local = symbol_table_find(&locals, name, table->symbols[i].name_length);
+    if (local != SYMBOL_NOT_FOUND) {
+      error->object = (size_t)locals.symbols[local].address;
+      snprintf(error->message, sizeof(error->message), "local label '%s' is referenced from another object",
+               name);
+      ok = false;
+    }
+  }
+  symbol_table_free(&locals);
+  return ok;
+}
+
+bool link_objects(SymbolTable *table, Arena *arena, const HackObject *objects, size_t count,
+                  uint16_t **words_out, size_t *count_out, LinkError *error) {
+
+  // SymbolTable*, Arena*, HackObject*, size_t, uint16_t**, size_t*, LinkError* -> bool
+  // Lays the modules out back to back, defines the exported labels, then patches every
+  // relocation. Externals are looked up on their first use in each module, which is also
+  // when a variable gets its address.
+
+  size_t first_program_symbol = table->size;
+  size_t* bases = arena_alloc(arena, (count ? count : 1) * sizeof(size_t));
+  size_t total = 0;
+  for (size_t m = 0; m < count; m++) {
+    bases[m] = total;
+    total += objects[m].word_count;
+    if (total > HACK_ROM_SIZE) {
+      error->object = m;
+      snprintf(error->message, sizeof(error->message), "the linked program does not fit in the %d-word ROM",
+               HACK_ROM_SIZE);
+      return false;
+    }
+  }
+
+  for (size_t m = 0; m < count; m++) {
+    const HackObject* object = &objects[m];
+    for (uint32_t i = 0; i < object->symbol_count; i++) {
+      const ObjectSymbol* symbol = &object->symbols[i];
+      if (symbol->kind != OBJECT_EXPORTED) continue;
+      size_t index = symbol_table_intern(table, symbol->name, symbol->len);
+      if (index < first_program_symbol || table->symbols[index].address != SYMBOL_UNDEFINED) {
+        error->object = m;
+        snprintf(error->message, sizeof(error->message), "label '%.*s' is already defined %s",
+                 (int)symbol->len, symbol->name,
+                 index < first_program_symbol ? "as a predefined symbol" : "by an earlier object");
+        return false;
+      }
+      table->symbols[index].address = (int)(bases[m] + symbol->offset);
+      STATS_ADD(labels, 1);
+    }
+  }
+
+  uint16_t* words = arena_alloc(arena, (total ? total : 1) * sizeof(uint16_t));
+  int variable_address = 16;
+  for (size_t m = 0; m < count; m++) {
+    const HackObject* object = &objects[m];
+    if (object->word_count > 0) memcpy(words + bases[m], object->words, object->word_count * sizeof(uint16_t));
+
+    // Addresses of this module's symbols, resolved on first use
+    int* addresses = arena_alloc(arena, (object->symbol_count ? object->symbol_count : 1) * sizeof(int));
+    for (uint32_t i = 0; i < object->symbol_count; i++) addresses[i] = SYMBOL_UNDEFINED;
+
+    for (uint32_t r = 0; r < object->relocation_count; r++) {
+      const ObjectRelocation* relocation = &object->relocations[r];
+      int* address = &addresses[relocation->symbol];
+      if (*address == SYMBOL_UNDEFINED) {
+        const ObjectSymbol* symbol = &object->symbols[relocation->symbol];
+        if (symbol->kind != OBJECT_EXTERNAL) {
+          *address = (int)(bases[m] + symbol->offset);
+        } else {
+          size_t index = symbol_table_intern(table, symbol->name, symbol->len);   // may move symbols
+          Symbol* global = &table->symbols[index];
+          if (global->address == SYMBOL_UNDEFINED) {
+            global->address = variable_address++;
+            global->variable = true;
+          }
+          *address = global->address;
+        }
+        if (*address > HACK_MAX_ADDRESS) {
+          error->object = m;
+          snprintf(error->message, sizeof(error->message), "address of '%.*s' is out of range",
+                   (int)symbol->len, symbol->name);
+          return false;
+        }
+      }
+      words[bases[m] + relocation->word] = (uint16_t)*address;
+    }
+  }
+  STATS_ADD(variables, variable_address - 16);
+  STATS_ADD(instructions, total);
+
+  if (variable_address > 16 && !check_variables(table, first_program_symbol, objects, count, error)) return false;
+
+  *words_out = words;
+  *count_out = total;
+  return true;
+}
@@ -0,0 +1,204 @@
+#include "optimize.h"
+#include "ir.h"
+#include "hack_isa.h"
+#include "stats.h"
+#include <stdio.h>
+#include <string.h>
+
+#define JUMP_ALWAYS 7
+
+static bool is_load(const IrInstruction* ins) {
+  return ins->kind == IR_CONSTANT || ins->kind == IR_SYMBOL;
+}
+
+static bool same_load(const IrInstruction* a, const IrInstruction* b) {
+  if (a->kind != b->kind) return false;
+  return a->kind == IR_SYMBOL ? a->symbol == b->symbol : a->word == b->word;
+}
+
+static size_t remove_dead_loads(IrInstruction* ir, size_t count) {
+
+  // IrInstruction*, size_t -> size_t
+  // Removes every A-instruction whose value is replaced by the next instruction. Labels in
+  // between do not matter: the removed load only ever ran on the fall-through path.
+
+  size_t removed = 0;
+  IrInstruction* last_load = NULL;
+  for (size_t i = 0; i < count; i++) {
+    IrInstruction* ins = &ir[i];
+    if (ins->kind == IR_REMOVED || ins->kind == IR_LABEL) continue;
+    if (is_load(ins)) {
+      if (last_load) {
+        last_load->kind = IR_REMOVED;
+        removed++;
+      }
+      last_load = ins;
+    } else {
+      last_load = NULL;
+    }
+  }
+  return removed;
+}
+
+static size_t remove_redundant_loads(IrInstruction* ir, size_t count) {
+
+  // IrInstruction*, size_t -> size_t
+  // Tracks what A holds along straight-line code and removes loads of that same value.
+  // A label forgets it (control may arrive from elsewhere), and so does any instruction
+  // that stores to A. Conditional jumps keep it: on the fall-through path A is unchanged.
+
+  size_t removed = 0;
+  const IrInstruction* known = NULL;
+  for (size_t i = 0; i < count; i++) {
+    IrInstruction* ins = &ir[i];
+    switch (ins->kind) {
+      case IR_REMOVED:
+        break;
+      case IR_LABEL:
+        known = NULL;
+        break;
+      case IR_C:
+        if (ins->word & (HACK_DEST_A << HACK_DEST_SHIFT) || (ins->word & 7) == JUMP_ALWAYS) known = NULL;
+        break;
+      default:
+        if (known && same_load(known, ins)) {
+          ins->kind = IR_REMOVED;
+          removed++;
+        } else {
+          known = ins;
+        }
+        break;
+    }
+  }
+  return removed;
+}
+
+static size_t remove_unreachable(IrInstruction* ir, size_t count) {
+
+  // IrInstruction*, size_t -> size_t
+  // Removes the instructions between an unconditional jump and the next label
+
+  size_t removed = 0;
+  bool reachable = true;
+  for (size_t i = 0; i < count; i++) {
+    IrInstruction* ins = &ir[i];
+    if (ins->kind == IR_REMOVED) continue;
+    if (ins->kind == IR_LABEL) {
+      reachable = true;
+    } else if (!reachable) {
+      ins->kind = IR_REMOVED;
+      removed++;
+    } else if (ins->kind == IR_C && (ins->word & 7) == JUMP_ALWAYS) {
+      reachable = false;
+    }
+  }
+  return removed;
+}
+
+static size_t source_word(const IrInstruction* ir, size_t position) {
+
+  // IrInstruction*, size_t -> size_t
+  // ROM word that the IR entry at position had before optimizing, for diagnostics: every
+  // entry but a label took one, including those removed since
+
+  size_t word = 0;
+  for (size_t i = 0; i < position; i++) {
+    if (ir[i].kind != IR_LABEL) word++;
+  }
+  return word;
+}
+
+bool assemble_words_optimized(SymbolTable *table, Arena *arena, const char *source, size_t size,
+                              uint16_t **words_out, size_t *count_out, AssemblyError *error,
+                              OptimizeReport *report) {
+
+  // SymbolTable*, Arena*, String, size_t, uint16_t**, size_t*, AssemblyError*, OptimizeReport* -> bool
+  // Builds the IR, resolves variables, runs the peephole patterns to a fixed point, then
+  // lays the surviving instructions out and encodes them
+
+  HackIr program;
+  if (!build_ir(table, arena, source, size, &program, error)) return false;
+  if (!resolve_ir_expressions(table, &program, true, error)) return false;
+  IrInstruction* ir = program.items;
+  size_t ir_count = program.count;
+  size_t first_program_symbol = program.first_program_symbol;
+
+  // Variables and predefined symbols have fixed addresses, so they become constants; only
+  // label references are left symbolic. Symbols still undefined after pass 1 are variables.
+  STATS_PHASE_START(pass2);
+  int variable_address = 16;
+  for (size_t i = 0; i < ir_count; i++) {
+    if (ir[i].kind != IR_SYMBOL) continue;
+    Symbol* symbol = &table->symbols[ir[i].symbol];
+    if (symbol->address == SYMBOL_UNDEFINED) {
+      symbol->address = variable_address++;
+      symbol->variable = true;
+    }
+    if (symbol->variable && symbol->address > HACK_MAX_ADDRESS) {
+      set_word_error(error, source, size, source_word(ir, i), "address out of range in");
+      return false;
+    }
+    if (ir[i].symbol < first_program_symbol || symbol->variable) {
+      ir[i].kind = IR_CONSTANT;
+      ir[i].word = (uint16_t)symbol->address;
+    }
+  }
+  STATS_ADD(variables, variable_address - 16);
+
+  OptimizeReport result = { program.word_count, 0, 0, 0, 0 };
+  for (;;) {
+    size_t unreachable = remove_unreachable(ir, ir_count);
+    size_t dead = remove_dead_loads(ir, ir_count);
+    size_t redundant = remove_redundant_loads(ir, ir_count);
+    result.unreachable += unreachable;
+    result.dead_loads += dead;
+    result.redundant_loads += redundant;
+    if (unreachable + dead + redundant == 0) break;
+  }
+
+  // Lay out what is left: labels take the address of the next surviving instruction
+  size_t address = 0;
+  for (size_t i = 0; i < ir_count; i++) {
+    if (ir[i].kind == IR_LABEL) table->symbols[ir[i].symbol].address = (int)address;
+    else if (ir[i].kind != IR_REMOVED) address++;
+  }
+  if (address > HACK_ROM_SIZE) {
+    // Report the first surviving instruction past the end of the ROM
+    size_t i = 0;
+    for (size_t n = 0;; i++) {
+      if (ir[i].kind == IR_LABEL || ir[i].kind == IR_REMOVED) continue;
+      if (n++ == HACK_ROM_SIZE) break;
+    }
+    set_word_error(error, source, size, source_word(ir, i),
+                   "optimized program does not fit in the 32768-word ROM at");
+    return false;
+  }
+
+  uint16_t* words = arena_alloc(arena, (address ? address : 1) * sizeof(uint16_t));
+  size_t n = 0;
+  for (size_t i = 0; i < ir_count; i++) {
+    switch (ir[i].kind) {
+      case IR_SYMBOL:
+        if (table->symbols[ir[i].symbol].address > HACK_MAX_ADDRESS) {   // a label after a full ROM
+          set_word_error(error, source, size, source_word(ir, i), "address out of range in");
+          return false;
+        }
+        words[n++] = (uint16_t)table->symbols[ir[i].symbol].address;
+        break;
+      case IR_CONSTANT:
+      case IR_C:
+        words[n++] = ir[i].word;
+        break;
+      default:
+        break;
+    }
+  }
+  result.words_after = n;
+  STATS_ADD(instructions, n);
+  STATS_PHASE_STOP(pass2, STATS_PASS2);
+
+  if (report) *report = result;
+  *words_out = words;
+  *count_out = n;
+  return true;
+}
@@ -0,0 +1,212 @@
+#include "output.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+size_t hack_text_size(size_t count) {
+
+  // size_t -> size_t
+  // Returns the number of bytes needed to print count words, without a final newline
+
+  return count == 0 ? 0 : count * HACK_TEXT_LINE - 1;
+}
+
+const char HACK_NIBBLE_DIGITS[16][4] = {
+  "0000", "0001", "0010", "0011", "0100", "0101", "0110", "0111",
+  "1000", "1001", "1010", "1011", "1100", "1101", "1110", "1111",
+};
+
+void format_hack_text(const uint16_t* words, size_t count, char* out) {
+
+  // uint16_t*, size_t, char* -> void
+  // Prints every word as 16 binary digits, separating lines with '\n'. The last line is
+  // split off so the loop needs no check for it.
+
+  if (count == 0) return;
+  for (size_t i = 0; i + 1 < count; i++) {
+    format_hack_word(words[i], out);
+    out[16] = '\n';
+    out += HACK_TEXT_LINE;
+  }
+  format_hack_word(words[count - 1], out);
+}
+
+bool write_all(FILE* output, const char* data, size_t size) {
+
+  // FILE*, String, size_t -> bool
+  // Writes data straight to the file descriptor behind output, bypassing stdio buffering.
+  // Streams without a descriptor fall back to a single fwrite.
+
+  if (fflush(output) != 0) return false;
+
+  int fd = fileno(output);
+  if (fd < 0) {
+    return fwrite(data, 1, size, output) == size;
+  }
+
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+bool write_hack_text(FILE* output, const uint16_t* words, size_t count) {
+
+  // FILE*, uint16_t*, size_t -> bool
+  // Formats all words into one exactly-sized buffer and writes it in one go
+
+  size_t size = hack_text_size(count);
+  if (size == 0) return true;
+
+  char* buffer = malloc(size);
+  if (!buffer) {
+    fprintf(stderr, "Memory allocation failed\n");
+    return false;
+  }
+
+  format_hack_text(words, count, buffer);
+  bool ok = write_all(output, buffer, size);
+  free(buffer);
+  return ok;
+}
+
+size_t hack_binary_size(size_t count) {
+
+  // size_t -> size_t
+  // Returns the size of a packed ROM image holding count words
+
+  return HACK_BIN_HEADER_SIZE + count * 2;
+}
+
+static void store_u16(unsigned char* out, uint16_t value, HackEndian endian) {
+  if (endian == HACK_ENDIAN_BIG) {
+    out[0] = value >> 8;
+    out[1] = value & 0xFF;
+  } else {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+  }
+}
+
+static void store_u32(unsigned char* out, uint32_t value, HackEndian endian) {
+  if (endian == HACK_ENDIAN_BIG) {
+    store_u16(out, value >> 16, endian);
+    store_u16(out + 2, value & 0xFFFF, endian);
+  } else {
+    store_u16(out, value & 0xFFFF, endian);
+    store_u16(out + 2, value >> 16, endian);
+  }
+}
+
+void format_hack_binary(const uint16_t* words, size_t count, HackEndian endian, unsigned char* out) {
+
+  // uint16_t*, size_t, HackEndian, unsigned char* -> void
+  // Writes the ROM header followed by every word in the chosen byte order
+
+  memcpy(out, HACK_BIN_MAGIC, 4);
+  out[4] = HACK_BIN_VERSION;
+  out[5] = endian == HACK_ENDIAN_BIG ? 'B' : 'L';
+  out[6] = 0;
+  out[7] = 0;
+  store_u32(out + 8, (uint32_t)count, endian);
+
+  out += HACK_BIN_HEADER_SIZE;
+  for (size_t i = 0; i < count; i++) {
+    store_u16(out + 2 * i, words[i], endian);
+  }
+}
+
+bool write_hack_binary(FILE* output, const uint16_t* words, size_t count, HackEndian endian) {
+
+  // FILE*, uint16_t*, size_t, HackEndian -> bool
+  // Packs the header and words into one buffer and writes it in one go
+
+  size_t size = hack_binary_size(count);
+  unsigned char* buffer = malloc(size);
+  if (!buffer) {
+    fprintf(stderr, "Memory allocation failed\n");
+    return false;
+  }
+
+  format_hack_binary(words, count, endian, buffer);
+  bool ok = write_all(output, (const char*)buffer, size);
+  free(buffer);
+  return ok;
+}
+
+size_t output_size(size_t count, const OutputOptions* options) {
+
+  // size_t, OutputOptions* -> size_t
+  // Returns the size of the whole output file for count words
+
+  if (options && options->format == OUTPUT_BINARY) return hack_binary_size(count);
+  return hack_text_size(count);
+}
+
+void format_output_header(size_t count, const OutputOptions* options, char* out) {
+
+  // size_t, OutputOptions*, char* -> void
+  // Writes the header of the output format, if it has one
+
+  if (options && options->format == OUTPUT_BINARY) {
+    format_hack_binary(NULL, 0, options->endian, (unsigned char*)out);
+    store_u32((unsigned char*)out + 8, (uint32_t)count, options->endian);
+  }
+}
+
+void format_output_range(const uint16_t* words, size_t first, size_t n, size_t count,
+                         const OutputOptions* options, char* out) {
+
+  // uint16_t*, size_t, size_t, size_t, OutputOptions*, char* -> void
+  // Formats one slice of the program into its final position in the output buffer
+
+  if (options && options->format == OUTPUT_BINARY) {
+    unsigned char* image = (unsigned char*)out + HACK_BIN_HEADER_SIZE + 2 * first;
+    for (size_t i = 0; i < n; i++) {
+      store_u16(image + 2 * i, words[i], options->endian);
+    }
+    return;
+  }
+
+  if (n == 0) return;
+  char* line = out + first * HACK_TEXT_LINE;
+  format_hack_text(words, n, line);
+  if (first + n < count) line[n * HACK_TEXT_LINE - 1] = '\n';
+}
+
+bool write_output(FILE* output, const uint16_t* words, size_t count, const OutputOptions* options, Arena* arena) {
+
+  // FILE*, uint16_t*, size_t, OutputOptions*, Arena* -> bool
+  // Formats the words in the requested format into one buffer and writes it in one go.
+  // The buffer comes from arena when one is given, otherwise from the heap.
+
+  size_t size = output_size(count, options);
+  if (size == 0) return true;
+
+  char* buffer = arena ? arena_alloc(arena, size) : malloc(size);
+  if (!buffer) {
+    fprintf(stderr, "Memory allocation failed\n");
+    return false;
+  }
+
+  format_output_header(count, options, buffer);
+  format_output_range(words, 0, count, count, options, buffer);
+  bool ok = write_all(output, buffer, size);
+  if (!arena) free(buffer);
+  return ok;
+}
+
+const char* output_extension(OutputFormat format) {
+
+  // OutputFormat -> String
+  // Returns the file extension used for an output format
+
+  return format == OUTPUT_BINARY ? ".hackbin" : ".hack";
+}
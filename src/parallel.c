@@ -0,0 +1,425 @@
+#include "parallel.h"
+#include "assembler.h"
+#include "expression.h"
+#include "hack_isa.h"
+#include "lexer.h"
+#include "arena.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Below this many bytes per chunk the thread start-up costs more than it saves
+#define MIN_CHUNK_SIZE (256 * 1024)
+#define CHUNKS_PER_THREAD 4
+
+typedef struct ChunkSymbol{
+  size_t index;        // chunk-relative instruction position
+  const char* ptr;     // NULL while the name lives in the chunk's own name buffer
+  size_t offset;       // position in that buffer
+  size_t len;
+  size_t line;         // chunk-relative source line, for diagnostics
+  bool resolved;
+} ChunkSymbol;
+
+typedef struct Chunk{
+  const char* start;
+  size_t size;
+  Arena arena;         // owned by the chunk's thread during the parallel passes
+
+  uint16_t* words;
+  size_t word_count, word_capacity;
+  ChunkSymbol* labels;
+  size_t label_count, label_capacity;
+  ChunkSymbol* refs;
+  size_t ref_count, ref_capacity;
+  ChunkSymbol* expressions;   // whole A-instructions, '@' included
+  size_t expression_count, expression_capacity;
+  char* names;         // copies of names that the lexer compacted into its scratch buffer
+  size_t names_size, names_capacity;
+
+  size_t line_count;
+  size_t first_word;   // ROM address of the chunk's first instruction
+  size_t first_line;
+
+  bool failed;
+  AssemblyError error;   // line is chunk-relative until the chunks are merged
+} Chunk;
+
+typedef struct ParallelAssembly{
+  Chunk* chunks;
+  SymbolTable* table;
+  uint16_t* words;       // the whole program, filled chunk by chunk
+} ParallelAssembly;
+
+typedef struct ParallelOutput{
+  const uint16_t* words;
+  size_t count;
+  size_t range;          // words per formatting task
+  const OutputOptions* options;
+  char* out;
+} ParallelOutput;
+
+typedef struct TaskRunner{
+  void (*run)(void* ctx, size_t index);
+  void* ctx;
+  size_t count;
+  atomic_size_t next;
+  AssemblyStats* stats;       // the caller's statistics, if it is collecting any
+  pthread_mutex_t stats_lock;
+} TaskRunner;
+
+static void* task_worker(void* arg) {
+
+  // TaskRunner* -> NULL
+  // Runs tasks until none are left. Every thread counts into its own statistics, which
+  // are folded into the caller's once the thread is done.
+
+  TaskRunner* runner = arg;
+  AssemblyStats local;
+  if (runner->stats) stats_begin(&local);
+
+  size_t index;
+  while ((index = atomic_fetch_add(&runner->next, 1)) < runner->count) {
+    runner->run(runner->ctx, index);
+  }
+
+  if (runner->stats) {
+    pthread_mutex_lock(&runner->stats_lock);
+    stats_merge(runner->stats, &local);
+    pthread_mutex_unlock(&runner->stats_lock);
+    stats_attach(NULL);
+  }
+  return NULL;
+}
+
+void run_parallel(int threads, size_t count, void (*run)(void* ctx, size_t index), void* ctx) {
+
+  // int, size_t, function, void* -> void
+  // Hands out task indices from a shared counter to a group of threads
+
+  TaskRunner runner = { run, ctx, count, 0, stats_current() };
+  pthread_mutex_init(&runner.stats_lock, NULL);
+  if (threads < 1) threads = 1;
+  if ((size_t)threads > count) threads = (int)count;
+
+  pthread_t* handles = malloc(threads * sizeof(pthread_t));
+  int started = 0;
+  for (int i = 1; handles && i < threads; i++) {
+    if (pthread_create(&handles[started], NULL, task_worker, &runner) != 0) break;
+    started++;
+  }
+  task_worker(&runner);
+  for (int i = 0; i < started; i++) {
+    pthread_join(handles[i], NULL);
+  }
+  free(handles);
+  pthread_mutex_destroy(&runner.stats_lock);
+  stats_attach(runner.stats);
+}
+
+static void add_chunk_symbol(Chunk* chunk, ChunkSymbol** list, size_t* count, size_t* capacity,
+                             Slice name, size_t line, bool in_scratch) {
+
+  // Chunk*, ChunkSymbol**, size_t*, size_t*, Slice, size_t, bool -> void
+  // Records a label, reference or expression; names in the lexer's scratch buffer are copied
+  // because the next instruction overwrites them
+
+  if (*count == *capacity) {
+    *list = arena_grow_array(&chunk->arena, *list, capacity, sizeof(ChunkSymbol));
+  }
+  ChunkSymbol* symbol = &(*list)[(*count)++];
+  symbol->index = chunk->word_count;
+  symbol->len = name.len;
+  symbol->line = line;
+  symbol->resolved = false;
+  symbol->ptr = name.ptr;
+
+  if (in_scratch) {
+    while (chunk->names_size + name.len > chunk->names_capacity) {
+      chunk->names = arena_grow_array(&chunk->arena, chunk->names, &chunk->names_capacity, 1);
+    }
+    memcpy(chunk->names + chunk->names_size, name.ptr, name.len);
+    symbol->ptr = NULL;
+    symbol->offset = chunk->names_size;
+    chunk->names_size += name.len;
+  }
+}
+
+static void pin_names(Chunk* chunk, ChunkSymbol* list, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (!list[i].ptr) list[i].ptr = chunk->names + list[i].offset;
+  }
+}
+
+static size_t count_lines(const char* cursor, const char* end) {
+  size_t lines = 0;
+  while (cursor < end) {
+    const char* newline = memchr(cursor, '\n', end - cursor);
+    lines++;
+    if (!newline) break;
+    cursor = newline + 1;
+  }
+  return lines;
+}
+
+static void scan_chunk(void* ctx, size_t index) {
+
+  // ParallelAssembly*, size_t -> void
+  // First pass over one chunk: encodes everything that does not depend on a symbol and
+  // collects the chunk's labels and symbol references with chunk-relative positions
+
+  Chunk* chunk = &((ParallelAssembly*)ctx)->chunks[index];
+  InstructionMemo memo;
+  instruction_memo_init(&memo);
+  Lexer lexer;
+  lexer_init(&lexer, chunk->start, chunk->size);
+
+  Slice ins;
+  while (lexer_next(&lexer, &ins)) {
+    uint16_t word = 0;
+    Slice name;
+    const char* message;
+    bool in_scratch = ins.ptr == lexer.scratch;
+
+    InstructionKind kind = parse_instruction_memo(&memo, ins, &word, &name, &message);
+    if (kind == INSTRUCTION_INVALID) {
+      chunk->failed = true;
+      set_assembly_error(&chunk->error, lexer.line_number, message, ins);
+      break;
+    }
+    if (kind == INSTRUCTION_LABEL) {
+      add_chunk_symbol(chunk, &chunk->labels, &chunk->label_count, &chunk->label_capacity, name,
+                       lexer.line_number, in_scratch);
+      continue;
+    }
+    if (kind == INSTRUCTION_SYMBOL) {
+      add_chunk_symbol(chunk, &chunk->refs, &chunk->ref_count, &chunk->ref_capacity, name,
+                       lexer.line_number, in_scratch);
+    } else if (kind == INSTRUCTION_EXPRESSION) {
+      add_chunk_symbol(chunk, &chunk->expressions, &chunk->expression_count, &chunk->expression_capacity, ins,
+                       lexer.line_number, in_scratch);
+    }
+
+    if (chunk->word_count == chunk->word_capacity) {
+      chunk->words = arena_grow_array(&chunk->arena, chunk->words, &chunk->word_capacity, sizeof(uint16_t));
+    }
+    chunk->words[chunk->word_count++] = word;
+  }
+
+  chunk->line_count = lexer.line_number + (chunk->failed ? count_lines(lexer.cursor, lexer.end) : 0);
+  pin_names(chunk, chunk->labels, chunk->label_count);
+  pin_names(chunk, chunk->refs, chunk->ref_count);
+  pin_names(chunk, chunk->expressions, chunk->expression_count);
+  lexer_free(&lexer);
+  instruction_memo_flush(&memo);
+}
+
+static void resolve_chunk(void* ctx, size_t index) {
+
+  // ParallelAssembly*, size_t -> void
+  // Second pass over one chunk: patches every reference to a label or predefined symbol,
+  // evaluates the expressions and copies the chunk into its place in the program. The table
+  // is only read here; references left unresolved are variables.
+
+  ParallelAssembly* assembly = ctx;
+  Chunk* chunk = &assembly->chunks[index];
+  for (size_t i = 0; i < chunk->ref_count; i++) {
+    ChunkSymbol* ref = &chunk->refs[i];
+    int address;
+    if (symbol_table_lookup(assembly->table, ref->ptr, ref->len, &address)) {
+      if (address > HACK_MAX_ADDRESS) {
+        set_word_error(&chunk->error, chunk->start, chunk->size, ref->index, "address out of range in");
+        chunk->failed = true;
+        break;
+      }
+      chunk->words[ref->index] = (uint16_t)address;
+      ref->resolved = true;
+    }
+  }
+  for (size_t i = 0; i < chunk->expression_count; i++) {
+    ChunkSymbol* expression = &chunk->expressions[i];
+    Slice ins = { expression->ptr, expression->len };
+    Slice text = { ins.ptr + 1, ins.len - 1 };
+    const char* message;
+    ExpressionResult result = evaluate_expression(text, assembly->table, assembly->table->size,
+                                                  &chunk->words[expression->index], &message);
+    if (result != EXPRESSION_VALUE) {
+      if (result == EXPRESSION_UNRESOLVED) message = "expression operand is not a label or predefined symbol in";
+      // Keep whichever error comes first in the source
+      if (!chunk->failed || expression->line < chunk->error.line) {
+        set_assembly_error(&chunk->error, expression->line, message, ins);
+      }
+      chunk->failed = true;
+      break;
+    }
+  }
+  if (chunk->word_count > 0) {
+    memcpy(assembly->words + chunk->first_word, chunk->words, chunk->word_count * sizeof(uint16_t));
+  }
+}
+
+static void format_range(void* ctx, size_t index) {
+
+  // ParallelOutput*, size_t -> void
+  // Formats one range of words into its own slice of the output buffer
+
+  ParallelOutput* output = ctx;
+  size_t first = index * output->range;
+  size_t n = output->count - first < output->range ? output->count - first : output->range;
+  format_output_range(output->words + first, first, n, output->count, output->options, output->out);
+}
+
+bool write_output_parallel(FILE* output, const uint16_t* words, size_t count, const OutputOptions* options,
+                           Arena* arena, int threads) {
+
+  // FILE*, uint16_t*, size_t, OutputOptions*, Arena*, int -> bool
+  // Like write_output, but formats disjoint ranges of the program on several threads
+
+  if (threads <= 1 || count < MIN_CHUNK_SIZE / HACK_TEXT_LINE) {
+    return write_output(output, words, count, options, arena);
+  }
+
+  size_t size = output_size(count, options);
+  ParallelOutput job = { words, count, 0, options, arena_alloc(arena, size) };
+  size_t tasks = (size_t)threads * CHUNKS_PER_THREAD;
+  job.range = (count + tasks - 1) / tasks;
+  tasks = (count + job.range - 1) / job.range;
+
+  format_output_header(count, options, job.out);
+  run_parallel(threads, tasks, format_range, &job);
+  return write_all(output, job.out, size);
+}
+
+static size_t split_chunks(const char* source, size_t size, size_t wanted, Chunk* chunks) {
+
+  // String, size_t, size_t, Chunk* -> size_t
+  // Cuts the source into about wanted pieces that each end just after a newline
+
+  size_t count = 0;
+  size_t start = 0;
+  for (size_t i = 1; i <= wanted && start < size; i++) {
+    size_t end = i == wanted ? size : size / wanted * i;
+    if (end < start) end = start;
+    const char* newline = end < size ? memchr(source + end, '\n', size - end) : NULL;
+    end = newline ? (size_t)(newline - source) + 1 : size;
+
+    memset(&chunks[count], 0, sizeof(Chunk));
+    arena_init(&chunks[count].arena, 1 << 16);
+    chunks[count].start = source + start;
+    chunks[count].size = end - start;
+    count++;
+    start = end;
+  }
+  return count;
+}
+
+bool assemble_words_parallel(SymbolTable *table, Arena *arena, const char *source, size_t size, int threads,
+                             uint16_t **words_out, size_t *count_out, AssemblyError *error) {
+
+  // SymbolTable*, Arena*, String, size_t, int, uint16_t**, size_t*, AssemblyError* -> bool
+  // Parallel assembly of a single program:
+  //   1. every chunk is lexed and encoded in parallel, collecting labels and references
+  //   2. a prefix sum over the chunk sizes gives each chunk its ROM offset, and labels are
+  //      defined in source order so the first definition wins as in the sequential engine
+  //   3. references to labels and predefined symbols are patched in parallel while the
+  //      chunks are copied into one word array allocated from arena
+  //   4. the remaining references are variables, allocated from 16 in source order
+
+  size_t wanted = (size_t)threads * CHUNKS_PER_THREAD;
+  if (wanted > size / MIN_CHUNK_SIZE) wanted = size / MIN_CHUNK_SIZE;
+  if (threads <= 1 || wanted <= 1) {
+    return assemble_words(table, arena, source, size, words_out, count_out, error);
+  }
+
+  Chunk* chunks = arena_alloc(arena, wanted * sizeof(Chunk));
+  size_t chunk_count = split_chunks(source, size, wanted, chunks);
+  ParallelAssembly assembly = { chunks, table, NULL };
+  bool ok = true;
+
+  STATS_PHASE_START(pass1);
+  run_parallel(threads, chunk_count, scan_chunk, &assembly);
+
+  size_t word_count = 0;
+  size_t line = 0;
+  for (size_t c = 0; c < chunk_count; c++) {
+    chunks[c].first_word = word_count;
+    chunks[c].first_line = line;
+    word_count += chunks[c].word_count;
+    line += chunks[c].line_count;
+
+    if (chunks[c].failed) {
+      if (error) {
+        *error = chunks[c].error;
+        error->line += chunks[c].first_line;
+      }
+      ok = false;
+      break;
+    }
+  }
+
+  if (ok && word_count > HACK_ROM_SIZE) {
+    set_word_error(error, source, size, HACK_ROM_SIZE, "program does not fit in the 32768-word ROM at");
+    ok = false;
+  }
+
+  if (ok) {
+    for (size_t c = 0; c < chunk_count; c++) {
+      for (size_t i = 0; i < chunks[c].label_count; i++) {
+        ChunkSymbol* label = &chunks[c].labels[i];
+        size_t symbol = symbol_table_intern(table, label->ptr, label->len);
+        if (table->symbols[symbol].address == SYMBOL_UNDEFINED) {
+          table->symbols[symbol].address = chunks[c].first_word + label->index;
+        }
+      }
+      STATS_ADD(labels, chunks[c].label_count);
+    }
+    STATS_PHASE_STOP(pass1, STATS_PASS1);
+
+    STATS_PHASE_START(pass2);
+
+    assembly.words = arena_alloc(arena, word_count * sizeof(uint16_t));
+    run_parallel(threads, chunk_count, resolve_chunk, &assembly);
+    for (size_t c = 0; c < chunk_count && ok; c++) {
+      if (chunks[c].failed) {
+        if (error) {
+          *error = chunks[c].error;
+          error->line += chunks[c].first_line;
+        }
+        ok = false;
+      }
+    }
+
+    int variable_address = 16;
+    for (size_t c = 0; c < chunk_count && ok; c++) {
+      for (size_t i = 0; i < chunks[c].ref_count; i++) {
+        ChunkSymbol* ref = &chunks[c].refs[i];
+        if (ref->resolved) continue;
+        size_t symbol = symbol_table_intern(table, ref->ptr, ref->len);
+        if (table->symbols[symbol].address == SYMBOL_UNDEFINED) {
+          table->symbols[symbol].address = variable_address++;
+          table->symbols[symbol].variable = true;
+        }
+        if (table->symbols[symbol].address > HACK_MAX_ADDRESS) {
+          set_word_error(error, source, size, chunks[c].first_word + ref->index, "address out of range in");
+          ok = false;
+          break;
+        }
+        assembly.words[chunks[c].first_word + ref->index] = (uint16_t)table->symbols[symbol].address;
+      }
+    }
+    STATS_ADD(variables, variable_address - 16);
+    STATS_ADD(instructions, word_count);
+    STATS_PHASE_STOP(pass2, STATS_PASS2);
+  }
+
+  for (size_t c = 0; c < chunk_count; c++) {
+    arena_free(&chunks[c].arena);
+  }
+
+  *words_out = assembly.words;
+  *count_out = ok ? word_count : 0;
+  return ok;
+}
@@ -0,0 +1,470 @@
+#include "pipeline.h"
+#include "lexer.h"
+#include "expression.h"
+#include "hack_isa.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Text read per batch; a batch grows beyond this only to hold a single longer line
+#define BATCH_BYTES (1 << 16)
+
+// Batches in flight, shared by all three stages. Each ring can hold every batch, so a push
+// never has to wait.
+#define BATCH_COUNT 8
+
+typedef struct Batch{
+  char* text;           // whole lines, except possibly in the last batch
+  size_t size;
+  size_t capacity;
+  size_t first_line;    // lines that precede the batch in the source
+  uint16_t* words;      // encoded by the middle stage
+  size_t count;
+  size_t word_capacity;
+  bool last;
+} Batch;
+
+// Lock-free single-producer/single-consumer ring. Each index is written by one side only
+// and kept on its own cache line.
+typedef struct Ring{
+  _Alignas(64) atomic_size_t head;    // next slot to take, advanced by the consumer
+  _Alignas(64) atomic_size_t tail;    // next slot to fill, advanced by the producer
+  Batch* slots[BATCH_COUNT];
+} Ring;
+
+typedef struct Pipeline{
+  int input_fd;
+  int output_fd;
+  const OutputOptions* options;
+  Ring filled;          // reader -> encoder
+  Ring encoded;         // encoder -> writer
+  Ring free;            // writer -> reader
+  atomic_bool stop;     // set by any stage that fails; the reader then ends the input early
+  int read_errno;       // 0, or why the reader failed
+  int write_errno;      // 0, or why the writer failed
+  size_t bytes_written;
+} Pipeline;
+
+static void ring_push(Ring* ring, Batch* batch) {
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  ring->slots[tail % BATCH_COUNT] = batch;
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static Batch* ring_pop(Ring* ring) {
+
+  // Ring* -> Batch*
+  // Takes the oldest batch, waiting for one if the ring is empty. The wait spins briefly,
+  // then yields, then sleeps, so a stage blocked on slow I/O does not keep a core busy.
+
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  for (unsigned attempt = 0;; attempt++) {
+    if (atomic_load_explicit(&ring->tail, memory_order_acquire) != head) break;
+    if (attempt < 64) continue;
+    if (attempt < 256) {
+      sched_yield();
+    } else {
+      struct timespec pause = { 0, 50000 };
+      nanosleep(&pause, NULL);
+    }
+  }
+  Batch* batch = ring->slots[head % BATCH_COUNT];
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return batch;
+}
+
+static void* grow(void* data, size_t* capacity, size_t needed, size_t element_size) {
+
+  // void*, size_t*, size_t, size_t -> void*
+  // Grows a batch buffer to hold at least needed elements, exiting if memory runs out
+
+  if (needed <= *capacity) return data;
+  size_t new_capacity = *capacity ? *capacity : 1024;
+  while (new_capacity < needed) new_capacity *= 2;
+  void* grown = realloc(data, new_capacity * element_size);
+  STATS_ALLOC(new_capacity * element_size);
+  if (!grown) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(1);
+  }
+  *capacity = new_capacity;
+  return grown;
+}
+
+static void* reader_main(void* arg) {
+
+  // Pipeline* -> NULL
+  // Fills free batches with input, cutting each after its last complete line and carrying
+  // the partial line over to the next batch. The final batch is marked last.
+
+  Pipeline* pipeline = arg;
+  char* carry = NULL;
+  size_t carry_size = 0, carry_capacity = 0;
+  size_t lines = 0;
+
+  for (;;) {
+    Batch* batch = ring_pop(&pipeline->free);
+    batch->text = grow(batch->text, &batch->capacity, carry_size + BATCH_BYTES, 1);
+    if (carry_size > 0) memcpy(batch->text, carry, carry_size);
+    batch->size = carry_size;
+    carry_size = 0;
+
+    // Read until the batch is full and ends in a newline, or the input ends
+    bool eof = atomic_load(&pipeline->stop);
+    char* newline = NULL;
+    while (!eof) {
+      if (batch->size == batch->capacity) {
+        if (newline) break;
+        batch->text = grow(batch->text, &batch->capacity, batch->capacity * 2, 1);
+      }
+      ssize_t n = read(pipeline->input_fd, batch->text + batch->size, batch->capacity - batch->size);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0) {
+        pipeline->read_errno = errno;
+        atomic_store(&pipeline->stop, true);
+      }
+      if (n <= 0) {
+        eof = true;
+        break;
+      }
+      for (char* c = batch->text + batch->size + n; c > batch->text + batch->size; c--) {
+        if (c[-1] == '\n') {
+          newline = c - 1;
+          break;
+        }
+      }
+      batch->size += n;
+    }
+
+    if (!eof) {
+      size_t keep = newline + 1 - batch->text;
+      carry_size = batch->size - keep;
+      if (carry_size > 0) {
+        carry = grow(carry, &carry_capacity, carry_size, 1);
+        memcpy(carry, newline + 1, carry_size);
+      }
+      batch->size = keep;
+    }
+
+    batch->first_line = lines;
+    for (const char* p = batch->text; (p = memchr(p, '\n', batch->text + batch->size - p)); p++) {
+      lines++;
+    }
+    batch->last = eof;
+    ring_push(&pipeline->filled, batch);
+    if (eof) break;
+  }
+
+  free(carry);
+  return NULL;
+}
+
+static bool write_fully(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = write(fd, data, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+static void* writer_main(void* arg) {
+
+  // Pipeline* -> NULL
+  // Formats every encoded batch and appends it to the output. Text lines all end in a
+  // newline here; the last one is trimmed when the output is finished.
+
+  Pipeline* pipeline = arg;
+  bool binary = pipeline->options && pipeline->options->format == OUTPUT_BINARY;
+  char* buffer = NULL;
+  size_t capacity = 0;
+
+  if (binary) {
+    char header[HACK_BIN_HEADER_SIZE];
+    format_output_header(0, pipeline->options, header);
+    if (!write_fully(pipeline->output_fd, header, sizeof(header))) {
+      pipeline->write_errno = errno;
+      atomic_store(&pipeline->stop, true);
+    }
+    pipeline->bytes_written += sizeof(header);
+  }
+
+  for (;;) {
+    Batch* batch = ring_pop(&pipeline->encoded);
+    bool last = batch->last;
+
+    if (batch->count > 0 && pipeline->write_errno == 0) {
+      size_t header = binary ? HACK_BIN_HEADER_SIZE : 0;
+      size_t size = binary ? 2 * batch->count : batch->count * HACK_TEXT_LINE;
+      buffer = grow(buffer, &capacity, header + size, 1);
+      // One extra word in the program length keeps the newline after the batch's last line
+      format_output_range(batch->words, 0, batch->count, batch->count + 1, pipeline->options, buffer);
+      if (!write_fully(pipeline->output_fd, buffer + header, size)) {
+        pipeline->write_errno = errno;
+        atomic_store(&pipeline->stop, true);
+      }
+      pipeline->bytes_written += size;
+    }
+
+    ring_push(&pipeline->free, batch);
+    if (last) break;
+  }
+
+  free(buffer);
+  return NULL;
+}
+
+typedef struct Fixup{
+  size_t index;
+  size_t symbol;
+  size_t line;          // for diagnostics
+} Fixup;
+
+// An expression with an operand that was not defined yet when it was read
+typedef struct ExpressionFixup{
+  size_t index;
+  size_t line;
+  Slice instruction;    // '@' included, copied into the arena
+  uint16_t word;        // the value, once resolved
+} ExpressionFixup;
+
+static bool resolve_expressions(SymbolTable* table, ExpressionFixup* expressions, size_t count,
+                                AssemblyError* error) {
+
+  // SymbolTable*, ExpressionFixup*, size_t, AssemblyError* -> bool
+  // Evaluates the deferred expressions now that every label is known, stopping at the first
+  // one that fails
+
+  for (size_t i = 0; i < count; i++) {
+    Slice text = { expressions[i].instruction.ptr + 1, expressions[i].instruction.len - 1 };
+    const char* message;
+    ExpressionResult result = evaluate_expression(text, table, table->size, &expressions[i].word, &message);
+    if (result != EXPRESSION_VALUE) {
+      if (result == EXPRESSION_UNRESOLVED) message = "expression operand is not a label or predefined symbol in";
+      set_assembly_error(error, expressions[i].line, message, expressions[i].instruction);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool resolve_fixups(SymbolTable* table, const Fixup* fixups, size_t count, AssemblyError* error) {
+
+  // SymbolTable*, Fixup*, size_t, AssemblyError* -> bool
+  // Allocates the variables in order of first use and checks that every patched address
+  // fits in an A-instruction
+
+  int variable_address = 16;
+  bool ok = true;
+  for (size_t i = 0; i < count; i++) {
+    Symbol* symbol = &table->symbols[fixups[i].symbol];
+    if (symbol->address == SYMBOL_UNDEFINED) {
+      symbol->address = variable_address++;
+      symbol->variable = true;
+    }
+    if (symbol->address > HACK_MAX_ADDRESS) {
+      char text[sizeof(error->text)];
+      int len = snprintf(text, sizeof(text), "@%s", symbol_table_name(table, fixups[i].symbol));
+      Slice ins = { text, len < (int)sizeof(text) ? (size_t)len : sizeof(text) - 1 };
+      set_assembly_error(error, fixups[i].line, "address out of range in", ins);
+      ok = false;
+      break;
+    }
+  }
+  STATS_ADD(variables, variable_address - 16);
+  return ok;
+}
+
+static bool patch_output(Pipeline* pipeline, SymbolTable* table, const Fixup* fixups, size_t fixup_count,
+                         const ExpressionFixup* expressions, size_t expression_count, size_t word_count) {
+
+  // Pipeline*, SymbolTable*, Fixup*, size_t, ExpressionFixup*, size_t, size_t -> bool
+  // Rewrites every placeholder word and the binary header through a shared mapping of the
+  // output, then trims the text's final newline
+
+  bool binary = pipeline->options && pipeline->options->format == OUTPUT_BINARY;
+  size_t size = pipeline->bytes_written;
+  if (size > 0 && (fixup_count > 0 || expression_count > 0 || binary)) {
+    char* out = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, pipeline->output_fd, 0);
+    if (out == MAP_FAILED) return false;
+
+    format_output_header(word_count, pipeline->options, out);
+    for (size_t i = 0; i < fixup_count; i++) {
+      uint16_t word = (uint16_t)table->symbols[fixups[i].symbol].address;
+      format_output_range(&word, fixups[i].index, 1, word_count + 1, pipeline->options, out);
+    }
+    for (size_t i = 0; i < expression_count; i++) {
+      format_output_range(&expressions[i].word, expressions[i].index, 1, word_count + 1, pipeline->options, out);
+    }
+    if (munmap(out, size) != 0) return false;
+  }
+
+  if (!binary && size > 0 && ftruncate(pipeline->output_fd, size - 1) != 0) return false;
+  return true;
+}
+
+PipelineResult assemble_pipelined(SymbolTable *table, Arena *arena, int input_fd, int output_fd,
+                                  const OutputOptions *options, size_t *count, AssemblyError *error) {
+
+  // SymbolTable*, Arena*, int, int, OutputOptions*, size_t*, AssemblyError* -> PipelineResult
+  // Runs the reader and writer threads around the encoding loop on the calling thread.
+  // After a failure the stages keep passing batches along without work until the reader has
+  // ended the input, so every thread shuts down through the normal path.
+
+  Pipeline* pipeline = calloc(1, sizeof(Pipeline));
+  Batch* batches = calloc(BATCH_COUNT, sizeof(Batch));
+  if (!pipeline || !batches) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(1);
+  }
+  pipeline->input_fd = input_fd;
+  pipeline->output_fd = output_fd;
+  pipeline->options = options;
+  for (size_t i = 0; i < BATCH_COUNT; i++) {
+    ring_push(&pipeline->free, &batches[i]);
+  }
+
+  pthread_t reader, writer;
+  if (pthread_create(&reader, NULL, reader_main, pipeline) != 0 ||
+      pthread_create(&writer, NULL, writer_main, pipeline) != 0) {
+    fprintf(stderr, "Error starting pipeline threads\n");
+    exit(1);
+  }
+
+  Fixup* fixups = NULL;
+  size_t fixup_count = 0, fixup_capacity = 0;
+  ExpressionFixup* expressions = NULL;
+  size_t expression_count = 0, expression_capacity = 0;
+  size_t word_count = 0;
+  bool ok = true;
+  InstructionMemo* memo = arena_alloc(arena, sizeof(InstructionMemo));
+  instruction_memo_init(memo);
+
+  STATS_PHASE_START(pass1);
+  for (;;) {
+    Batch* batch = ring_pop(&pipeline->filled);
+    batch->count = 0;
+
+    Lexer lexer;
+    lexer_init(&lexer, batch->text, batch->size);
+    Slice ins;
+    while (ok && lexer_next(&lexer, &ins)) {
+      uint16_t word = 0;
+      Slice name;
+      const char* message;
+
+      switch (parse_instruction_memo(memo, ins, &word, &name, &message)) {
+        case INSTRUCTION_LABEL: {
+          size_t symbol = symbol_table_intern(table, name.ptr, name.len);
+          if (table->symbols[symbol].address == SYMBOL_UNDEFINED) {
+            table->symbols[symbol].address = word_count;
+          }
+          STATS_ADD(labels, 1);
+          continue;
+        }
+        case INSTRUCTION_SYMBOL: {  // written as 0 for now and patched at the end
+          size_t symbol = symbol_table_intern(table, name.ptr, name.len);
+          int address = table->symbols[symbol].address;
+          if (address > HACK_MAX_ADDRESS) {   // a label after a full ROM
+            set_assembly_error(error, batch->first_line + lexer.line_number, "address out of range in", ins);
+            ok = false;
+            atomic_store(&pipeline->stop, true);
+            continue;
+          }
+          if (address != SYMBOL_UNDEFINED) {
+            word = (uint16_t)address;
+          }
+          else {
+            if (fixup_count == fixup_capacity) {
+              fixups = arena_grow_array(arena, fixups, &fixup_capacity, sizeof(Fixup));
+            }
+            fixups[fixup_count++] = (Fixup){ word_count, symbol, batch->first_line + lexer.line_number };
+          }
+          break;
+        }
+        case INSTRUCTION_EXPRESSION: {  // final already when its operands are
+          if (evaluate_expression(name, table, table->size, &word, &message) == EXPRESSION_VALUE) break;
+          if (expression_count == expression_capacity) {
+            expressions = arena_grow_array(arena, expressions, &expression_capacity, sizeof(ExpressionFixup));
+          }
+          char* text = arena_alloc(arena, ins.len);
+          memcpy(text, ins.ptr, ins.len);
+          expressions[expression_count++] = (ExpressionFixup){ word_count, batch->first_line + lexer.line_number,
+                                                               { text, ins.len }, 0 };
+          word = 0;
+          break;
+        }
+        case INSTRUCTION_WORD:
+          break;
+        case INSTRUCTION_INVALID:
+          set_assembly_error(error, batch->first_line + lexer.line_number, message, ins);
+          ok = false;
+          atomic_store(&pipeline->stop, true);
+          continue;
+      }
+      if (word_count == HACK_ROM_SIZE) {
+        set_assembly_error(error, batch->first_line + lexer.line_number,
+                           "program does not fit in the 32768-word ROM at", ins);
+        ok = false;
+        atomic_store(&pipeline->stop, true);
+        continue;
+      }
+
+      batch->words = grow(batch->words, &batch->word_capacity, batch->count + 1, sizeof(uint16_t));
+      batch->words[batch->count++] = word;
+      word_count++;
+    }
+    lexer_free(&lexer);
+
+    if (!ok) batch->count = 0;
+    bool last = batch->last;
+    ring_push(&pipeline->encoded, batch);
+    if (last) break;
+  }
+  instruction_memo_flush(memo);
+  STATS_PHASE_STOP(pass1, STATS_PASS1);
+
+  pthread_join(reader, NULL);
+  pthread_join(writer, NULL);
+
+  PipelineResult result = PIPELINE_OK;
+  if (!ok) {
+    result = PIPELINE_ASSEMBLY_ERROR;
+  } else if (pipeline->read_errno) {
+    errno = pipeline->read_errno;
+    result = PIPELINE_READ_ERROR;
+  } else if (pipeline->write_errno) {
+    errno = pipeline->write_errno;
+    result = PIPELINE_WRITE_ERROR;
+  } else {
+    STATS_PHASE_START(pass2);
+    if (!resolve_expressions(table, expressions, expression_count, error) ||
+        !resolve_fixups(table, fixups, fixup_count, error)) {
+      result = PIPELINE_ASSEMBLY_ERROR;
+    } else if (!patch_output(pipeline, table, fixups, fixup_count, expressions, expression_count, word_count)) {
+      result = PIPELINE_WRITE_ERROR;
+    }
+    STATS_ADD(instructions, word_count);
+    STATS_PHASE_STOP(pass2, STATS_PASS2);
+  }
+
+  for (size_t i = 0; i < BATCH_COUNT; i++) {
+    free(batches[i].text);
+    free(batches[i].words);
+  }
+  free(batches);
+  free(pipeline);
+
+  *count = word_count;
+  return result;
+}
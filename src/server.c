@@ -0,0 +1,446 @@
+#include "server.h"
+#include "lexer.h"
+#include "compress.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define PROTOCOL_HEADER "HACKASM 1"
+
+// A client that stops sending in the middle of a request gives its worker back after this
+#define REQUEST_TIMEOUT_SECONDS 30
+
+typedef struct ServerWorker{
+  int listen_fd;
+  HackAsmContext* ctx;
+  char* buffer;               // inline sources, kept between requests
+  size_t capacity;
+} ServerWorker;
+
+typedef struct Request{
+  char input[PATH_MAX];
+  char output[PATH_MAX];
+  char cache[PATH_MAX];
+  bool inline_source;
+  size_t source_size;
+  OutputOptions options;
+} Request;
+
+static bool send_all(int fd, const void* data, size_t size) {
+
+  // int, void*, size_t -> bool
+  // Writes the whole buffer, without raising SIGPIPE when the peer has gone away
+
+  const char* p = data;
+  while (size > 0) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static void reply_error(int fd, size_t line, const char* format, ...) {
+
+  // int, size_t, String, ... -> void
+  // Sends an "error" reply with a printf-style message
+
+  char message[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+
+  char reply[300];
+  int len = snprintf(reply, sizeof(reply), "error %zu %s\n", line, message);
+  send_all(fd, reply, len < (int)sizeof(reply) ? (size_t)len : sizeof(reply) - 1);
+}
+
+static bool set_path(char* field, const char* value) {
+  if (value[0] != '/' || strlen(value) >= PATH_MAX) return false;
+  strcpy(field, value);
+  return true;
+}
+
+static bool read_request(FILE* in, Request* request, const char** problem) {
+
+  // FILE*, Request*, String* -> bool
+  // Parses the request headers up to the empty line that ends them
+
+  char line[PATH_MAX + 16];
+  memset(request, 0, sizeof(*request));
+  request->options.format = OUTPUT_TEXT;
+  request->options.endian = HACK_ENDIAN_LITTLE;
+  *problem = "Malformed request";
+
+  bool first = true;
+  while (fgets(line, sizeof(line), in)) {
+    size_t len = strlen(line);
+    if (len == 0 || line[len - 1] != '\n') return false;
+    line[--len] = '\0';
+
+    if (first) {
+      if (strcmp(line, PROTOCOL_HEADER) != 0) {
+        *problem = "Unsupported protocol version";
+        return false;
+      }
+      first = false;
+      continue;
+    }
+    if (len == 0) {
+      if (!request->output[0] || (!request->input[0] && !request->inline_source)) return false;
+      return true;
+    }
+
+    char* value = strchr(line, ' ');
+    if (!value) return false;
+    *value++ = '\0';
+
+    bool ok = true;
+    if (strcmp(line, "input") == 0) ok = set_path(request->input, value);
+    else if (strcmp(line, "output") == 0) ok = set_path(request->output, value);
+    else if (strcmp(line, "cache") == 0) ok = set_path(request->cache, value);
+    else if (strcmp(line, "source") == 0) {
+      char* end;
+      request->source_size = strtoull(value, &end, 10);
+      request->inline_source = true;
+      ok = *end == '\0' && end != value;
+    } else if (strcmp(line, "format") == 0) {
+      if (strcmp(value, "text") == 0) request->options.format = OUTPUT_TEXT;
+      else if (strcmp(value, "bin") == 0) request->options.format = OUTPUT_BINARY;
+      else ok = false;
+    } else if (strcmp(line, "endian") == 0) {
+      if (strcmp(value, "little") == 0) request->options.endian = HACK_ENDIAN_LITTLE;
+      else if (strcmp(value, "big") == 0) request->options.endian = HACK_ENDIAN_BIG;
+      else ok = false;
+    } else ok = false;
+    if (!ok) return false;
+  }
+  return false;
+}
+
+static void handle_connection(ServerWorker* worker, int fd) {
+
+  // ServerWorker*, int -> void
+  // Reads one request, assembles it with the worker's context and sends the reply
+
+  struct timeval timeout = { REQUEST_TIMEOUT_SECONDS, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  FILE* in = fdopen(fd, "r");
+  if (!in) {
+    close(fd);
+    return;
+  }
+
+  Request request;
+  const char* problem;
+  if (!read_request(in, &request, &problem)) {
+    reply_error(fd, 0, "%s", problem);
+    fclose(in);
+    return;
+  }
+
+  // Load the program: a path is mapped like any input file, inline text lands in the
+  // worker's buffer, which only ever grows
+  SourceBuffer source = { NULL, 0, false };
+  if (request.inline_source) {
+    if (request.source_size > worker->capacity) {
+      char* grown = realloc(worker->buffer, request.source_size);
+      if (!grown) {
+        reply_error(fd, 0, "Source too large");
+        fclose(in);
+        return;
+      }
+      worker->buffer = grown;
+      worker->capacity = request.source_size;
+    }
+    if (fread(worker->buffer, 1, request.source_size, in) != request.source_size) {
+      fclose(in);
+      return;
+    }
+    source.data = worker->buffer;
+    source.size = request.source_size;
+  } else if (!source_open(&source, request.input)) {
+    reply_error(fd, 0, "%s: Error opening input file: %s", request.input, strerror(errno));
+    fclose(in);
+    return;
+  }
+
+  // Only this request fails; the other workers keep serving theirs
+  if (!hack_asm_ctx_set_cache(worker->ctx, request.cache[0] ? request.cache : NULL)) {
+    if (!request.inline_source) source_close(&source);
+    reply_error(fd, 0, "Memory allocation failed");
+    fclose(in);
+    return;
+  }
+
+  const uint16_t* words;
+  size_t count;
+  HackAsmError error;
+  bool ok = hack_asm_assemble_buffer(worker->ctx, source.data, source.size, &words, &count, &error);
+  if (!request.inline_source) source_close(&source);
+  if (!ok) {
+    reply_error(fd, error.line, "%s", error.message);
+    fclose(in);
+    return;
+  }
+
+  FILE* output = output_open(request.output, request.options.format == OUTPUT_BINARY);
+  if (!output) {
+    reply_error(fd, 0, "%s: Error opening output file: %s", request.output, strerror(errno));
+    fclose(in);
+    return;
+  }
+  ok = hack_asm_write(worker->ctx, output, words, count, &request.options);
+  int write_errno = errno;
+  if (fclose(output) != 0 && ok) {
+    ok = false;
+    write_errno = errno;
+  }
+  if (!ok) {
+    remove(request.output);
+    reply_error(fd, 0, "%s: Error writing output file: %s", request.output, strerror(write_errno));
+  } else {
+    char reply[32];
+    int len = snprintf(reply, sizeof(reply), "ok %zu\n", count);
+    send_all(fd, reply, len);
+  }
+  fclose(in);
+}
+
+static void* worker_main(void* arg) {
+
+  // ServerWorker* -> NULL
+  // Accepts and serves connections until the listening socket is shut down
+
+  ServerWorker* worker = arg;
+  for (;;) {
+    int fd = accept(worker->listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      break;
+    }
+    handle_connection(worker, fd);
+    hack_asm_ctx_reset(worker->ctx);
+  }
+  return NULL;
+}
+
+static bool fill_address(struct sockaddr_un* address, const char* socket_path) {
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(address->sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", socket_path);
+    return false;
+  }
+  strcpy(address->sun_path, socket_path);
+  return true;
+}
+
+static int listen_on(const char* socket_path) {
+
+  // String -> int
+  // Binds the listening socket. A socket file left behind by a daemon that is no longer
+  // running is replaced; a live daemon is left alone.
+
+  struct sockaddr_un address;
+  if (!fill_address(&address, socket_path)) return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("Error creating socket");
+    return -1;
+  }
+
+  int bound = bind(fd, (struct sockaddr*)&address, sizeof(address));
+  if (bound != 0 && errno == EADDRINUSE) {
+    int existing = server_connect(socket_path);
+    if (existing >= 0) {
+      close(existing);
+      close(fd);
+      fprintf(stderr, "An assembler daemon is already listening on %s\n", socket_path);
+      return -1;
+    }
+    unlink(socket_path);
+    bound = bind(fd, (struct sockaddr*)&address, sizeof(address));
+  }
+  if (bound != 0 || listen(fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "%s: ", socket_path);
+    perror("Error listening on socket");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int serve(const char* socket_path, int threads) {
+
+  // String, int -> int
+  // Runs the daemon: the workers inherit a signal mask blocking SIGINT and SIGTERM, which
+  // this thread then waits for before shutting the listening socket down
+
+  if (threads < 1) threads = 1;
+
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  int listen_fd = listen_on(socket_path);
+  if (listen_fd < 0) return 1;
+
+  ServerWorker* workers = calloc(threads, sizeof(ServerWorker));
+  pthread_t* handles = calloc(threads, sizeof(pthread_t));
+  if (!workers || !handles) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(1);
+  }
+
+  int started = 0;
+  for (int w = 0; w < threads; w++) {
+    workers[w].listen_fd = listen_fd;
+    workers[w].ctx = hack_asm_ctx_create();
+    if (!workers[w].ctx) {
+      fprintf(stderr, "Memory allocation failed\n");
+      exit(1);
+    }
+    if (pthread_create(&handles[w], NULL, worker_main, &workers[w]) != 0) {
+      hack_asm_ctx_destroy(workers[w].ctx);
+      break;
+    }
+    started++;
+  }
+
+  int status = 0;
+  if (started == 0) {
+    fprintf(stderr, "Error starting worker threads\n");
+    status = 1;
+  } else {
+    printf("Listening on %s with %d worker%s\n", socket_path, started, started == 1 ? "" : "s");
+    fflush(stdout);
+    int received;
+    sigwait(&signals, &received);
+  }
+
+  // Wakes every worker blocked in accept(); requests in progress run to completion
+  shutdown(listen_fd, SHUT_RDWR);
+  for (int w = 0; w < started; w++) {
+    pthread_join(handles[w], NULL);
+    hack_asm_ctx_destroy(workers[w].ctx);
+    free(workers[w].buffer);
+  }
+  close(listen_fd);
+  unlink(socket_path);
+
+  free(workers);
+  free(handles);
+  return status;
+}
+
+int server_connect(const char* socket_path) {
+
+  // String -> int
+  // Returns a socket connected to the daemon, or -1
+
+  struct sockaddr_un address;
+  if (!fill_address(&address, socket_path)) return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool absolute_path(char* out, const char* path) {
+
+  // char*, String -> bool
+  // Writes path into out (PATH_MAX bytes), prefixed with the working directory when relative
+
+  if (path[0] == '/') {
+    if (strlen(path) >= PATH_MAX) return false;
+    strcpy(out, path);
+    return true;
+  }
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd))) return false;
+  return (size_t)snprintf(out, PATH_MAX, "%s/%s", cwd, path) < PATH_MAX;
+}
+
+static bool fail(HackAsmError* error, int fd, const char* message) {
+  error->line = 0;
+  snprintf(error->message, sizeof(error->message), "%s", message);
+  if (fd >= 0) close(fd);
+  return false;
+}
+
+bool server_request(int fd, const ServerRequest* request, HackAsmError* error) {
+
+  // int, ServerRequest*, HackAsmError* -> bool
+  // Sends the headers (and inline source), then parses the single reply line
+
+  char input[PATH_MAX], output[PATH_MAX], cache[PATH_MAX];
+  if ((request->input_path && !absolute_path(input, request->input_path)) ||
+      !absolute_path(output, request->output_path) ||
+      (request->cache_path && !absolute_path(cache, request->cache_path))) {
+    return fail(error, fd, "Path too long");
+  }
+
+  size_t size = 4 * PATH_MAX + 128;
+  char* header = malloc(size);
+  if (!header) return fail(error, fd, "Memory allocation failed");
+
+  int len = snprintf(header, size, PROTOCOL_HEADER "\n");
+  if (request->input_path) len += snprintf(header + len, size - len, "input %s\n", input);
+  else len += snprintf(header + len, size - len, "source %zu\n", request->source_size);
+  len += snprintf(header + len, size - len, "output %s\nformat %s\nendian %s\n", output,
+                  request->options.format == OUTPUT_BINARY ? "bin" : "text",
+                  request->options.endian == HACK_ENDIAN_BIG ? "big" : "little");
+  if (request->cache_path) len += snprintf(header + len, size - len, "cache %s\n", cache);
+  len += snprintf(header + len, size - len, "\n");
+
+  bool sent = send_all(fd, header, len) &&
+              (request->input_path || send_all(fd, request->source, request->source_size));
+  free(header);
+  if (!sent) return fail(error, fd, "Lost connection to the assembler daemon");
+
+  FILE* in = fdopen(fd, "r");
+  if (!in) return fail(error, fd, "Lost connection to the assembler daemon");
+
+  char reply[512];
+  bool ok = false;
+  if (!fgets(reply, sizeof(reply), in)) {
+    fail(error, -1, "Lost connection to the assembler daemon");
+  } else {
+    reply[strcspn(reply, "\n")] = '\0';
+    char* message;
+    if (strncmp(reply, "ok ", 3) == 0) {
+      ok = true;
+    } else if (strncmp(reply, "error ", 6) == 0) {
+      error->line = strtoull(reply + 6, &message, 10);
+      if (*message == ' ') message++;
+      snprintf(error->message, sizeof(error->message), "%s", message);
+    } else {
+      fail(error, -1, "Unexpected reply from the assembler daemon");
+    }
+  }
+  fclose(in);
+  return ok;
+}
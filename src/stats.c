@@ -0,0 +1,140 @@
+#include "stats.h"
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#if HACK_STATS
+_Thread_local AssemblyStats* stats_active;
+#endif
+
+static const char* PHASE_NAMES[STATS_PHASE_COUNT] = { "read", "pass1", "pass2", "output" };
+
+void stats_begin(AssemblyStats* stats) {
+
+  // AssemblyStats* -> void
+  // Clears stats and starts recording into it on the calling thread
+
+  memset(stats, 0, sizeof(*stats));
+  stats_attach(stats);
+}
+
+void stats_end(void) {
+
+  // void -> void
+  // Stops recording on the calling thread, noting the process's peak RSS
+
+  AssemblyStats* stats = stats_current();
+  if (stats) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) stats->peak_rss_kb = usage.ru_maxrss;
+  }
+  stats_attach(NULL);
+}
+
+AssemblyStats* stats_current(void) {
+#if HACK_STATS
+  return stats_active;
+#else
+  return NULL;
+#endif
+}
+
+void stats_attach(AssemblyStats* stats) {
+#if HACK_STATS
+  stats_active = stats;
+#else
+  (void)stats;
+#endif
+}
+
+void stats_merge(AssemblyStats* into, const AssemblyStats* from) {
+
+  // AssemblyStats*, AssemblyStats* -> void
+  // Folds the counters of from into into; timings are recorded by the calling thread only
+
+  into->instructions += from->instructions;
+  into->labels += from->labels;
+  into->variables += from->variables;
+  into->lookups += from->lookups;
+  into->probes += from->probes;
+  if (from->max_probes > into->max_probes) into->max_probes = from->max_probes;
+  into->allocations += from->allocations;
+  into->bytes_allocated += from->bytes_allocated;
+  into->arena_allocations += from->arena_allocations;
+  into->arena_bytes += from->arena_bytes;
+  into->cache_hits += from->cache_hits;
+  into->cache_misses += from->cache_misses;
+  into->memo_lookups += from->memo_lookups;
+  into->memo_hits += from->memo_hits;
+}
+
+static double clock_seconds(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void stats_timer_start(StatsTimer* timer) {
+  if (!stats_current()) return;
+  timer->wall = clock_seconds(CLOCK_MONOTONIC);
+  timer->cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void stats_timer_stop(const StatsTimer* timer, StatsPhase phase) {
+
+  // StatsTimer*, StatsPhase -> void
+  // Charges the time since stats_timer_start to phase
+
+  AssemblyStats* stats = stats_current();
+  if (!stats) return;
+  stats->wall[phase] += clock_seconds(CLOCK_MONOTONIC) - timer->wall;
+  stats->cpu[phase] += clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - timer->cpu;
+}
+
+void stats_print(FILE* out, const AssemblyStats* stats, bool json) {
+
+  // FILE*, AssemblyStats*, bool -> void
+  // Prints the statistics as a readable table or as one JSON object
+
+  double average_probes = stats->lookups ? (double)stats->probes / stats->lookups : 0.0;
+
+  if (json) {
+    fprintf(out, "{\"phases\": {");
+    for (int p = 0; p < STATS_PHASE_COUNT; p++) {
+      fprintf(out, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}", p ? ", " : "", PHASE_NAMES[p],
+              stats->wall[p], stats->cpu[p]);
+    }
+    fprintf(out, "}, \"instructions\": %zu, \"labels\": %zu, \"variables\": %zu, "
+                 "\"lookups\": %zu, \"average_probes\": %.3f, \"max_probes\": %zu, "
+                 "\"allocations\": %zu, \"bytes_allocated\": %zu, "
+                 "\"arena_allocations\": %zu, \"arena_bytes\": %zu, "
+                 "\"cache_hits\": %zu, \"cache_misses\": %zu, \"memo_lookups\": %zu, \"memo_hits\": %zu, "
+                 "\"peak_rss_kb\": %ld}\n",
+            stats->instructions, stats->labels, stats->variables,
+            stats->lookups, average_probes, stats->max_probes,
+            stats->allocations, stats->bytes_allocated,
+            stats->arena_allocations, stats->arena_bytes,
+            stats->cache_hits, stats->cache_misses, stats->memo_lookups, stats->memo_hits,
+            stats->peak_rss_kb);
+    return;
+  }
+
+  fprintf(out, "%-8s %12s %12s\n", "phase", "wall ms", "cpu ms");
+  for (int p = 0; p < STATS_PHASE_COUNT; p++) {
+    fprintf(out, "%-8s %12.3f %12.3f\n", PHASE_NAMES[p], stats->wall[p] * 1e3, stats->cpu[p] * 1e3);
+  }
+  fprintf(out, "instructions: %zu, labels: %zu, variables: %zu\n",
+          stats->instructions, stats->labels, stats->variables);
+  fprintf(out, "symbol lookups: %zu, probes per lookup: %.3f average, %zu max\n",
+          stats->lookups, average_probes, stats->max_probes);
+  fprintf(out, "heap: %zu allocations, %zu bytes; arena: %zu allocations, %zu bytes\n",
+          stats->allocations, stats->bytes_allocated, stats->arena_allocations, stats->arena_bytes);
+  if (stats->cache_hits + stats->cache_misses > 0) {
+    fprintf(out, "cache: %zu blocks reused, %zu encoded\n", stats->cache_hits, stats->cache_misses);
+  }
+  if (stats->memo_lookups > 0) {
+    fprintf(out, "instruction memo: %zu lookups, %zu hits (%.1f%%)\n", stats->memo_lookups, stats->memo_hits,
+            100.0 * stats->memo_hits / stats->memo_lookups);
+  }
+  fprintf(out, "peak RSS: %ld KB\n", stats->peak_rss_kb);
+}
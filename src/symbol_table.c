@@ -1,79 +1,275 @@
 #include "symbol_table.h"
+#include "stats.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+static uint32_t hash_name(const char *name, size_t length) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static size_t round_up_pow2(size_t n) {
+    size_t result = 16;
+    while (result < n) {
+        result <<= 1;
+    }
+    return result;
+}
+
+static size_t find_slot(const SymbolTable *table, const char *name, size_t length, uint32_t hash) {
+    // Returns the slot holding name, or the empty slot where it would be inserted
+    size_t mask = table->slot_count - 1;
+    size_t slot = hash & mask;
+    size_t probes = 1;
+    while (table->slots[slot] != 0) {
+        const Symbol *symbol = &table->symbols[table->slots[slot] - 1];
+        if (symbol->hash == hash && symbol->name_length == length &&
+            memcmp(table->names + symbol->name_offset, name, length) == 0) {
+            STATS_PROBES(probes);
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+        probes++;
+    }
+    STATS_PROBES(probes);
+    return slot;
+}
+
+static void grow_slots(SymbolTable *table) {
+    size_t new_count = table->slot_count * 2;
+    uint32_t *new_slots = (uint32_t *)calloc(new_count, sizeof(uint32_t));
+    STATS_ALLOC(new_count * sizeof(uint32_t));
+    if (!new_slots) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    free(table->slots);
+    table->slots = new_slots;
+    table->slot_count = new_count;
+
+    size_t mask = new_count - 1;
+    for (size_t i = 0; i < table->size; i++) {
+        size_t slot = table->symbols[i].hash & mask;
+        while (table->slots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        table->slots[slot] = (uint32_t)(i + 1);
+    }
+}
+
+static size_t lookup(const SymbolTable *table, const char *name, size_t length, uint32_t hash) {
+    size_t slot = find_slot(table, name, length, hash);
+    if (table->slots[slot] == 0 || table->symbols[table->slots[slot] - 1].address == SYMBOL_UNDEFINED) {
+        return SYMBOL_NOT_FOUND;
+    }
+    return table->slots[slot] - 1;
+}
+
+static void insert(SymbolTable *table, size_t slot, const char *name, size_t length, uint32_t hash, int address) {
+    // slot must be the empty slot returned by find_slot for this name
+    if (table->size >= table->capacity) {
+        size_t new_capacity = table->capacity * 2;
+        Symbol *new_symbols = (Symbol *)realloc(table->symbols, new_capacity * sizeof(Symbol));
+        STATS_ALLOC(new_capacity * sizeof(Symbol));
+        if (!new_symbols) {
+            fprintf(stderr, "Memory reallocation failed\n");
+            exit(1);
+        }
+        table->symbols = new_symbols;
+        table->capacity = new_capacity;
+    }
+
+    if (table->names_size + length + 1 > table->names_capacity) {
+        size_t new_capacity = table->names_capacity * 2;
+        while (table->names_size + length + 1 > new_capacity) {
+            new_capacity *= 2;
+        }
+        char *new_names = (char *)realloc(table->names, new_capacity);
+        STATS_ALLOC(new_capacity);
+        if (!new_names) {
+            fprintf(stderr, "Memory allocation for symbol name failed\n");
+            exit(1);
+        }
+        table->names = new_names;
+        table->names_capacity = new_capacity;
+    }
+
+    Symbol *symbol = &table->symbols[table->size];
+    symbol->name_offset = table->names_size;
+    symbol->name_length = (uint32_t)length;
+    symbol->hash = hash;
+    symbol->address = address;
+    symbol->variable = false;
+    memcpy(table->names + table->names_size, name, length);
+    table->names[table->names_size + length] = '\0';
+    table->names_size += length + 1;
+    table->size++;
+    table->slots[slot] = (uint32_t)table->size;
+
+    // Keep the load factor at or below one half
+    if (table->size * 2 > table->slot_count) {
+        grow_slots(table);
+    }
+}
+
 void symbol_table_init(SymbolTable *table, size_t initial_capacity) {
+    if (initial_capacity == 0) {
+        initial_capacity = 1;
+    }
     table->symbols = (Symbol *)malloc(initial_capacity * sizeof(Symbol));
-    if (!table->symbols) {
+    table->slot_count = round_up_pow2(initial_capacity * 2);
+    table->slots = (uint32_t *)calloc(table->slot_count, sizeof(uint32_t));
+    table->names_capacity = initial_capacity * 8;
+    table->names = (char *)malloc(table->names_capacity);
+    STATS_ADD(allocations, 3);
+    STATS_ADD(bytes_allocated, initial_capacity * sizeof(Symbol) + table->slot_count * sizeof(uint32_t) +
+                               table->names_capacity);
+    if (!table->symbols || !table->slots || !table->names) {
         fprintf(stderr, "Memory allocation failed\n");
         exit(1);
     }
     table->size = 0;
     table->capacity = initial_capacity;
+    table->names_size = 0;
+}
+
+const char* symbol_table_name(const SymbolTable *table, size_t index) {
+    return table->names + table->symbols[index].name_offset;
 }
 
 void symbol_table_print(SymbolTable *table) {
     printf("Symbol Table:\n");
     printf("-------------------\n");
     for (size_t i = 0; i < table->size; i++) {
-        printf("%s -> %d\n", table->symbols[i].name, table->symbols[i].address);
+        printf("%s -> %d\n", symbol_table_name(table, i), table->symbols[i].address);
     }
     printf("-------------------\n");
 }
 
 void symbol_table_free(SymbolTable *table) {
-    for (size_t i = 0; i < table->size; i++) {
-        free((void *)table->symbols[i].name);
-    }
     free(table->symbols);
+    free(table->slots);
+    free(table->names);
     table->symbols = NULL;
+    table->slots = NULL;
+    table->names = NULL;
     table->size = 0;
     table->capacity = 0;
+    table->slot_count = 0;
+    table->names_size = 0;
+    table->names_capacity = 0;
 }
 
-bool symbol_table_contains(SymbolTable *table, const char *name) {
-    for (size_t i = 0; i < table->size; i++) {
-        if (strcmp(table->symbols[i].name, name) == 0) {
-            return true;
-        }
+static void *reserve(void *buffer, size_t *capacity, size_t needed, size_t element_size) {
+    if (needed <= *capacity) {
+        return buffer;
     }
-    return false;
+    void *grown = realloc(buffer, needed * element_size);
+    STATS_ALLOC(needed * element_size);
+    if (!grown) {
+        fprintf(stderr, "Memory reallocation failed\n");
+        exit(1);
+    }
+    *capacity = needed;
+    return grown;
 }
 
-bool symbol_table_get_address(SymbolTable *table, const char *name, int *address) {
-    for (size_t i = 0; i < table->size; i++) {
-        if (strcmp(table->symbols[i].name, name) == 0) {
-            *address = table->symbols[i].address;
-            return true;
+void symbol_table_copy(SymbolTable *table, const SymbolTable *src) {
+    table->symbols = (Symbol *)reserve(table->symbols, &table->capacity, src->capacity, sizeof(Symbol));
+    table->names = (char *)reserve(table->names, &table->names_capacity, src->names_capacity, 1);
+    if (table->slot_count != src->slot_count) {
+        free(table->slots);
+        table->slots = (uint32_t *)malloc(src->slot_count * sizeof(uint32_t));
+        STATS_ALLOC(src->slot_count * sizeof(uint32_t));
+        if (!table->slots) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
         }
+        table->slot_count = src->slot_count;
     }
-    return false;
+
+    memcpy(table->symbols, src->symbols, src->size * sizeof(Symbol));
+    memcpy(table->names, src->names, src->names_size);
+    memcpy(table->slots, src->slots, src->slot_count * sizeof(uint32_t));
+    table->size = src->size;
+    table->names_size = src->names_size;
 }
 
-bool symbol_table_add(SymbolTable *table, const char *name, int address) {
-    if (symbol_table_contains(table, name)) {
+bool symbol_table_contains(SymbolTable *table, const char *name) {
+    size_t length = strlen(name);
+    return lookup(table, name, length, hash_name(name, length)) != SYMBOL_NOT_FOUND;
+}
+
+bool symbol_table_get_address(SymbolTable *table, const char *name, int *address) {
+    size_t length = strlen(name);
+    size_t index = lookup(table, name, length, hash_name(name, length));
+    if (index == SYMBOL_NOT_FOUND) {
         return false;
     }
+    *address = table->symbols[index].address;
+    return true;
+}
 
-    if (table->size >= table->capacity) {
-        size_t new_capacity = table->capacity * 2;
-        Symbol *new_symbols = (Symbol *)realloc(table->symbols, new_capacity * sizeof(Symbol));
-        if (!new_symbols) {
-            fprintf(stderr, "Memory reallocation failed\n");
-            exit(1);
+bool symbol_table_add(SymbolTable *table, const char *name, int address) {
+    size_t length = strlen(name);
+    uint32_t hash = hash_name(name, length);
+    size_t slot = find_slot(table, name, length, hash);
+    if (table->slots[slot] != 0) {
+        Symbol *symbol = &table->symbols[table->slots[slot] - 1];
+        if (symbol->address != SYMBOL_UNDEFINED) {
+            return false;
         }
-        table->symbols = new_symbols;
-        table->capacity = new_capacity;
+        symbol->address = address;
+        return true;
     }
+    insert(table, slot, name, length, hash, address);
+    return true;
+}
 
-    table->symbols[table->size].name = strdup(name);
-    if (!table->symbols[table->size].name) {
-        fprintf(stderr, "Memory allocation for symbol name failed\n");
-        exit(1);
+bool symbol_table_get_or_add(SymbolTable *table, const char *name, int new_address, int *address) {
+    size_t length = strlen(name);
+    uint32_t hash = hash_name(name, length);
+    size_t slot = find_slot(table, name, length, hash);
+    if (table->slots[slot] != 0) {
+        Symbol *symbol = &table->symbols[table->slots[slot] - 1];
+        if (symbol->address == SYMBOL_UNDEFINED) {
+            symbol->address = new_address;
+            *address = new_address;
+            return true;
+        }
+        *address = symbol->address;
+        return false;
     }
-    table->symbols[table->size].address = address;
-    table->size++;
+    insert(table, slot, name, length, hash, new_address);
+    *address = new_address;
+    return true;
+}
 
+bool symbol_table_lookup(const SymbolTable *table, const char *name, size_t length, int *address) {
+    size_t index = lookup(table, name, length, hash_name(name, length));
+    if (index == SYMBOL_NOT_FOUND) {
+        return false;
+    }
+    *address = table->symbols[index].address;
     return true;
-}
\ No newline at end of file
+}
+
+size_t symbol_table_find(const SymbolTable *table, const char *name, size_t length) {
+    return lookup(table, name, length, hash_name(name, length));
+}
+
+size_t symbol_table_intern(SymbolTable *table, const char *name, size_t length) {
+    uint32_t hash = hash_name(name, length);
+    size_t slot = find_slot(table, name, length, hash);
+    if (table->slots[slot] != 0) {
+        return table->slots[slot] - 1;
+    }
+    insert(table, slot, name, length, hash, SYMBOL_UNDEFINED);
+    return table->size - 1;
+}
@@ -1,9 +1,25 @@
 #include "utils.h"
+#include "stats.h"
+#include "scan.h"
+#include "output.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
-char* append_strings(const char*a, const char* b) {
+// Allocating helpers return heap memory that the caller frees; the allocations are counted
+// for --stats
+
+static void* util_alloc(size_t size) {
+    STATS_ALLOC(size);
+    return malloc(size);
+}
+
+static void* util_resize(void* ptr, size_t new_size) {
+    STATS_ALLOC(new_size);
+    return realloc(ptr, new_size);
+}
+
+char* append_strings(const char* a, const char* b) {
 
   // String, String -> String
   // Appends string b to string a and returns a new allocated string
@@ -11,9 +27,10 @@ char* append_strings(const char*a, const char* b) {
   size_t len_a = strlen(a);
   size_t len_b = strlen(b);
 
-  char *result = malloc(len_a + len_b + 1);
-  strcpy(result, a);
-  strcat(result, b);
+  char *result = util_alloc(len_a + len_b + 1);
+  if (!result) return NULL;
+  memcpy(result, a, len_a);
+  memcpy(result + len_a, b, len_b + 1);
 
   return result;
 }
@@ -22,29 +39,39 @@ char* read_line(FILE *fp) {
 
   // FILE* -> String
   // Reads a line from the given file pointer and returns it as a newly allocated string
-  // Stops at newline or EOF, does not include the newline
+  // Stops at newline or EOF, does not include the newline (or the '\r' of a CRLF ending).
+  // Reads whole blocks with fgets rather than one character at a time.
 
     size_t size = 128;
     size_t len = 0;
-    char *buffer = malloc(size);
+    char *buffer = util_alloc(size);
     if (!buffer) return NULL;
 
-    int c;
-    while ((c = fgetc(fp)) != EOF) {
-        if (len + 1 >= size) {
-            size *= 2;
-            buffer = realloc(buffer, size);
-            if (!buffer) return NULL;
+    bool read_any = false;
+    while (fgets(buffer + len, (int)(size - len), fp)) {
+        read_any = true;
+        len += strlen(buffer + len);
+        if (len > 0 && buffer[len - 1] == '\n') {
+            len--;
+            break;
         }
-        if (c == '\n') break;
-        buffer[len++] = c;
+        if (len + 1 < size) break;      // end of file without a final newline
+
+        char *tmp = util_resize(buffer, size * 2);
+        if (!tmp) {
+            free(buffer);
+            return NULL;
+        }
+        buffer = tmp;
+        size *= 2;
     }
 
-    if (len == 0 && c == EOF) {
+    if (!read_any) {
         free(buffer);
         return NULL;
     }
 
+    if (len > 0 && buffer[len - 1] == '\r') len--;
     buffer[len] = '\0';
     return buffer;
 }
@@ -52,36 +79,19 @@ char* read_line(FILE *fp) {
 char* clear_line(char *line) {
 
   // String -> String
-  // Removes spaces and comments from a line and returns a newly allocated cleaned string
+  // Removes whitespace (spaces, tabs and carriage returns) and comments from a line and
+  // returns a newly allocated cleaned string. Only the first line of the text is kept.
 
-    size_t size = 128;
-    size_t len = 0;
+    LineScan scan;
+    scan_select()(line, line + strlen(line), &scan);
+    size_t line_len = scan.stop - line;
 
-    char* buffer = malloc(size);
+    char* buffer = util_alloc(line_len - scan.spaces + 1);
     if (!buffer) return NULL;
 
-    int i = 0;
-    while(i != strlen(line)) {
-
-        if(line[i] == '/') break; // stop at comment start
-
-        if (len + 1 >= size) {
-            size *= 2;
-            char *tmp = realloc(buffer, size);
-            if (!tmp) {
-                free(buffer);
-                return NULL;
-            }
-            buffer = tmp;
-        }
-
-        if (line[i] != ' ') {
-            buffer[len++] = line[i];
-        }
-
-        i++;
-    }
-
+    size_t len = line_len;
+    if (scan.spaces) len = scan_compact(line, scan.stop, buffer);
+    else memcpy(buffer, line, line_len);
     buffer[len] = '\0';
     return buffer;
 }
@@ -91,36 +101,27 @@ char* convert_to_binary(char* num) {
   // String -> String
   // Converts a decimal number string to its binary representation as a newly allocated string
 
-    int int_num = strtol(num, NULL, 10);
-    if(int_num == 0) {
-        char* result = malloc(2 * sizeof(char));
-        strcpy(result, "0");
+    long int_num = strtol(num, NULL, 10);
+    if (int_num < 0) {     // negative numbers give an empty string
+        char* result = util_alloc(1);
+        if (result) result[0] = '\0';
         return result;
     }
 
-    size_t size = 64;
-    char* buffer = malloc(size);
-    int i = 0;
-
-    while (int_num > 0) {
-
-        if((i + 1) >= size) {
-            size *= 2;
-            char* tmp = realloc(buffer, size);
-            if (!tmp) {
-                free(buffer);
-                return NULL;
-            }
-            buffer = tmp;
-        } 
-
-        buffer[i++] = (int_num % 2) + '0';
-        int_num = int_num / 2;
+    // Format the whole number 16 bits at a time with the output kernel, then skip the
+    // leading zeros (keeping one digit for zero)
+    unsigned long value = (unsigned long)int_num;
+    char digits[sizeof(long) * 8];
+    for (size_t chunk = 0; chunk < sizeof(digits) / 16; chunk++) {
+        format_hack_word((uint16_t)(value >> (sizeof(digits) - 16 * (chunk + 1))), digits + 16 * chunk);
     }
-    buffer[i++] = '\0';
+    size_t start = value ? (size_t)__builtin_clzl(value) : sizeof(digits) - 1;
 
-    char* result = reverse_string(buffer);
-    free(buffer);
+    size_t len = sizeof(digits) - start;
+    char* result = util_alloc(len + 1);
+    if (!result) return NULL;
+    memcpy(result, digits + start, len);
+    result[len] = '\0';
 
     return result;
 }
@@ -130,12 +131,14 @@ char* reverse_string(char* str) {
   // String -> String
   // Returns a newly allocated string which is the reverse of the input string
 
-    char* reversed = malloc(strlen(str) + 1);
+    size_t len = strlen(str);
+    char* reversed = util_alloc(len + 1);
+    if (!reversed) return NULL;
 
-    for(int j = 0; j <= strlen(str); ++j) {
-        reversed[j] = str[strlen(str) - j - 1];
+    for (size_t j = 0; j < len; ++j) {
+        reversed[j] = str[len - j - 1];
     }
-    reversed[strlen(str)] = '\0';
+    reversed[len] = '\0';
 
     return reversed;
 }
@@ -147,21 +150,18 @@ char* pad_left(char* num, int total_len) {
 
     int len = strlen(num);
     if (len >= total_len) {
-        char* copy = malloc(len + 1);
-        strcpy(copy, num);
+        char* copy = util_alloc(len + 1);
+        if (copy) memcpy(copy, num, len + 1);
         return copy;
     }
 
-    char* padded = malloc(total_len + 1);
+    char* padded = util_alloc(total_len + 1);
+    if (!padded) return NULL;
     int pad_len = total_len - len;
 
-    for (int i = 0; i < pad_len; i++) {
-        padded[i] = '0';
-    }
-
-    strcpy(padded + pad_len, num);
-    padded[total_len] = '\0';
-    return padded;  
+    memset(padded, '0', pad_len);
+    memcpy(padded + pad_len, num, len + 1);
+    return padded;
 }
 
 int string_search(const char* str, char c) {
@@ -169,11 +169,9 @@ int string_search(const char* str, char c) {
   // String, char -> int
   // Returns the index of character c in str, or -1 if not found
 
-    size_t len = strlen(str);
-    for(int i = 0; i < len; ++i) {
-        if (str[i] == c) return i;
-    }
-    return -1;
+    const char* found = strchr(str, c);
+    if (!found || c == '\0') return -1;
+    return found - str;
 }
 
 char* substring(const char* str, size_t start, size_t end) {
@@ -187,10 +185,10 @@ char* substring(const char* str, size_t start, size_t end) {
     if (end < start) end = start;
 
     size_t new_len = end - start;
-    char *result = malloc(new_len + 1);
+    char *result = util_alloc(new_len + 1);
     if (!result) return NULL;
 
-    strncpy(result, str + start, new_len);
+    memcpy(result, str + start, new_len);
     result[new_len] = '\0';
     return result;
 }
@@ -200,8 +198,34 @@ char* int_to_string(int num) {
   // int -> String
   // Converts an integer to a newly allocated string representation
 
-    int length = snprintf(NULL, 0,"%d", num);
-    char* str = malloc(length + 1);
-    snprintf(str, length + 1, "%d", num);
+    char digits[16];
+    int length = snprintf(digits, sizeof(digits), "%d", num);
+    char* str = util_alloc(length + 1);
+    if (str) memcpy(str, digits, length + 1);
     return str;
-}
\ No newline at end of file
+}
+
+void word_to_binary(uint16_t word, char* out) {
+
+  // uint16_t, char* -> void
+  // Writes the 16 binary digits of word followed by a NUL terminator into out
+
+    format_hack_word(word, out);
+    out[16] = '\0';
+}
+
+void* grow_array(void* array, size_t* capacity, size_t element_size) {
+
+  // void*, size_t*, size_t -> void*
+  // Doubles the capacity of a dynamic array, exiting if memory runs out
+
+    size_t new_capacity = *capacity ? *capacity * 2 : 1024;
+    void* grown = realloc(array, new_capacity * element_size);
+    STATS_ALLOC(new_capacity * element_size);
+    if (!grown) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return grown;
+}
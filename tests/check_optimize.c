@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "hack_asm.h"
+#include "emulator.h"
+
+// Checks that -O does not change what a program computes (make check). Every program is
+// assembled with and without the optimizer and run on the emulator until it halts; the
+// final RAM must be identical, and the optimizer must have removed something, or the case
+// would not exercise it. The programs target the patterns the optimizer reasons about:
+// labels between loads, conditional jumps next to unconditional ones, and dest fields that
+// write A together with memory.
+
+#define STEP_LIMIT 1000000
+
+typedef struct OptimizeCase{
+  const char* name;
+  const char* source;
+} OptimizeCase;
+
+static const OptimizeCase cases[] = {
+  { "label between loads",
+    // (BACK) is reached with A = R8 by falling through and with A = LOOP by the jump, so the
+    // @R8 after it is not a reload of the value A holds
+    "@R8\n@R8\nM=1\n"
+    "(BACK)\n@R8\nM=M+1\n"
+    "@R9\nM=M+1\nD=M\n@3\nD=D-A\n"
+    "@LOOP\n(LOOP)\n@BACK\nD;JLT\n"
+    "@R10\n(MIDDLE)\n@R11\nM=1\n"
+    "(END)\n@END\n0;JMP\n" },
+  { "conditional and unconditional jumps",
+    // Only the code after 0;JMP and D;JMP is unreachable; after a conditional jump, taken or
+    // not, execution can continue
+    "@R1\nD=M\n@SKIP\nD;JEQ\n@R2\nM=1\n"
+    "(SKIP)\n@R3\nM=1\n@R1\nD=M\n@TAKEN\nD;JNE\n@R4\nM=1\n"
+    "(TAKEN)\n@R5\nM=1\n@OVER\n0;JMP\n@R6\nM=1\n@R7\nM=1\n"
+    "(OVER)\n@R8\nM=1\nD=1\n@AGAIN\nD;JMP\n@R9\nM=1\n"
+    "(AGAIN)\n@R10\nM=M+1\nD=M\n@2\nD=D-A\n@OVER\nD;JLT\n@R11\nM=D\n"
+    "(END)\n@END\n0;JMP\n@R12\nM=1\n" },
+  { "A written by dest",
+    // AM=, AMD= and A= change A, so the @SP after them is a real load, while the @SP after
+    // D=M, which leaves A alone, is redundant
+    "@256\nD=A\n@SP\nM=D\n"
+    "@7\nD=A\n@SP\nAM=M+1\nA=A-1\nM=D\n"
+    "@8\nD=A\n@SP\nAM=M+1\nA=A-1\nM=D\n"
+    "@SP\nAM=M-1\nD=M\n@SP\nA=M-1\nM=D+M\n"
+    "@SP\nD=M\n@SP\nAMD=M+1\n@SP\nM=D\n"
+    "@R13\nD=A\n@R13\nA=D+1\n@R13\nM=D\n"
+    "(END)\n@END\n0;JMP\n" },
+  { "return addresses and variables",
+    // Label addresses taken as data move with -O, so the return address is cleared before
+    // the RAM is compared; variables keep their addresses
+    "@counter\nM=1\n@limit\nD=A\n@limit\nM=D\n@RETURN\nD=A\n@R15\nM=D\n@FUNCTION\n0;JMP\n"
+    "(RETURN)\n@R15\nM=0\n@counter\nD=M\n@limit\nM=D+M\n@END\n0;JMP\n"
+    "(FUNCTION)\n@counter\nM=M+1\n@counter\nM=M+1\n@R15\nA=M\n0;JMP\n@counter\nM=0\n"
+    "(END)\n@END\n0;JMP\n" },
+};
+
+static bool run_program(const uint16_t* words, size_t count, uint16_t* ram) {
+
+  // Array, size_t, Array -> bool
+  // Runs the program until it halts and copies its RAM out; false when it did not halt
+
+  HackCpu cpu;
+  if (!hack_cpu_init(&cpu, words, count)) return false;
+  hack_cpu_run(&cpu, STEP_LIMIT, NULL);
+  bool halted = cpu.halted;
+  memcpy(ram, cpu.ram, HACK_RAM_SIZE * sizeof(uint16_t));
+  hack_cpu_free(&cpu);
+  return halted;
+}
+
+static bool check_case(HackAsmContext* ctx, const OptimizeCase* test, uint16_t* plain_ram, uint16_t* optimized_ram) {
+
+  // HackAsmContext*, OptimizeCase*, Array, Array -> bool
+  // Assembles and runs the case both ways and compares the results
+
+  const uint16_t* words;
+  size_t count;
+  HackAsmError err;
+  size_t len = strlen(test->source);
+
+  hack_asm_ctx_set_optimize(ctx, false);
+  if (!hack_asm_assemble_buffer(ctx, test->source, len, &words, &count, &err)) {
+    fprintf(stderr, "%s: Line %zu: %s\n", test->name, err.line, err.message);
+    return false;
+  }
+  // The words belong to the context, which the next call reuses
+  bool plain_halted = run_program(words, count, plain_ram);
+  size_t plain_count = count;
+
+  hack_asm_ctx_set_optimize(ctx, true);
+  if (!hack_asm_assemble_buffer(ctx, test->source, len, &words, &count, &err)) {
+    fprintf(stderr, "%s (-O): Line %zu: %s\n", test->name, err.line, err.message);
+    return false;
+  }
+  bool optimized_halted = run_program(words, count, optimized_ram);
+
+  if (!plain_halted || !optimized_halted) {
+    fprintf(stderr, "%s: did not halt within %d instructions%s\n", test->name, STEP_LIMIT,
+            plain_halted ? " with -O" : "");
+    return false;
+  }
+  if (count >= plain_count) {
+    fprintf(stderr, "%s: -O removed nothing (%zu words)\n", test->name, count);
+    return false;
+  }
+  for (size_t address = 0; address < HACK_RAM_SIZE; address++) {
+    if (plain_ram[address] != optimized_ram[address]) {
+      fprintf(stderr, "%s: RAM[%zu] is %u with -O, %u without\n", test->name, address,
+              optimized_ram[address], plain_ram[address]);
+      return false;
+    }
+  }
+  printf("optimize: %-40s %2zu -> %2zu words, RAM identical\n", test->name, plain_count, count);
+  return true;
+}
+
+int main(void) {
+
+  // void -> int
+  // Runs every case and exits non-zero when any of them fails
+
+  HackAsmContext* ctx = hack_asm_ctx_create();
+  uint16_t* plain_ram = malloc(HACK_RAM_SIZE * sizeof(uint16_t));
+  uint16_t* optimized_ram = malloc(HACK_RAM_SIZE * sizeof(uint16_t));
+  if (!ctx || !plain_ram || !optimized_ram) {
+    fprintf(stderr, "Memory allocation failed\n");
+    return 1;
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    if (!check_case(ctx, &cases[i], plain_ram, optimized_ram)) ok = false;
+  }
+
+  free(plain_ram);
+  free(optimized_ram);
+  hack_asm_ctx_destroy(ctx);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "scan.h"
+
+// Cross-checks every SIMD line scanner against the scalar one (make check). Crafted lines
+// with CRLF endings, tabs, lone and doubled '/' and every length around the 16- and 32-byte
+// block sizes are placed at each alignment of a 64-byte window and scanned, once with unrelated bytes after the text and once ending flush against an
+// unreadable page, so the vector loops, their scalar tails and the end bound are all
+// exercised. A random text then covers every start offset and tail length.
+
+#define WINDOW 64
+
+typedef struct Checker{
+  const ScanVariant* variants;
+  size_t variant_count;
+  size_t checks;
+  size_t failures;
+} Checker;
+
+static void compare_at(Checker* checker, const char* line, const char* end, const char* text, const char* what) {
+
+  // Checker*, String, String, String, String -> void
+  // Scans [line, end) with every variant and reports any that disagrees with the scalar one
+
+  LineScan expected;
+  checker->variants[0].scan(line, end, &expected);
+  for (size_t v = 1; v < checker->variant_count; v++) {
+    if (!checker->variants[v].available) continue;
+    LineScan actual;
+    checker->variants[v].scan(line, end, &actual);
+    checker->checks++;
+    if (actual.end == expected.end && actual.stop == expected.stop && actual.spaces == expected.spaces) continue;
+    if (checker->failures++ < 10) {
+      fprintf(stderr, "scanner %s differs from scalar (%s) at offset %zu of \"", checker->variants[v].name,
+              what, (size_t)(line - text));
+      for (const char* c = text; c < end; c++) {
+        if (*c == '\n') fputs("\\n", stderr);
+        else if (*c == '\r') fputs("\\r", stderr);
+        else if (*c == '\t') fputs("\\t", stderr);
+        else fputc(*c, stderr);
+      }
+      fprintf(stderr, "\": end %+td/%+td, stop %+td/%+td, spaces %zu/%zu\n", actual.end - line, expected.end - line,
+              actual.stop - line, expected.stop - line, actual.spaces, expected.spaces);
+    }
+  }
+}
+
+static void check_text(Checker* checker, const char* text, size_t len, size_t starts, char* window, char* guarded) {
+
+  // Checker*, String, size_t, size_t, char*, char* -> void
+  // Scans text from each of its first starts positions at every alignment. guarded points
+  // just below an inaccessible page.
+
+  for (size_t align = 0; align < WINDOW; align++) {
+    // Bytes after the end that would change the result if a variant read them
+    char* copy = window + align;
+    memcpy(copy, text, len);
+    memset(copy + len, '/', WINDOW);
+    copy[len + 1] = '\n';
+    for (size_t start = 0; start <= len && start < starts; start++) {
+      compare_at(checker, copy + start, copy + len, copy, "text followed by more bytes");
+    }
+
+    char* flush = guarded - len - align;
+    memcpy(flush, text, len);
+    memset(flush + len, ' ', align);
+    for (size_t start = 0; start <= len && start < starts; start++) {
+      compare_at(checker, flush + start, flush + len + align, flush, "text ending at an unreadable page");
+    }
+  }
+}
+
+static void check_crafted(Checker* checker, char* window, char* guarded) {
+
+  // Checker*, char*, char* -> void
+  // Fixed edge cases from every position, then lines of every length up to 70 bytes with one
+  // special byte moved through every position; moving the byte already covers the offsets
+  // that starting later would
+
+  static const char* cases[] = {
+    "", "\n", "\n\n", "\r\n", "\r", "\r\r\r\n", "/", "//", "/\n", "//\n", "a/", "a/\n", "  /  \n",
+    "D=M\n", "D=M\r\n", "D=M", "\tD=M\t// tab\r\n", "  M = D + M  // spaced\r\n", "@SP // a / b // c\n",
+    "(LOOP)\r\n@LOOP\r\n0;JMP\r\n", "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\tAM=M-1\n",
+    "// only a comment without a newline", "   \t \r \t   \r\n   \t\n",
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    check_text(checker, cases[i], strlen(cases[i]), SIZE_MAX, window, guarded);
+  }
+
+  static const char specials[] = { '\n', '/', '\r', '\t', ' ' };
+  char line[72];
+  for (size_t len = 1; len <= 70; len++) {
+    for (size_t s = 0; s < sizeof(specials); s++) {
+      for (size_t pos = 0; pos < len; pos++) {
+        for (size_t i = 0; i < len; i++) line[i] = i % 3 == 0 ? ' ' : 'D';
+        line[pos] = specials[s];
+        check_text(checker, line, len, 1, window, guarded);
+      }
+    }
+  }
+}
+
+static void check_random(Checker* checker) {
+
+  // Checker* -> void
+  // Lines of 0 to 80 bytes drawn from an alphabet rich in the bytes the scanner looks for,
+  // scanned from every byte with several lengths
+
+  enum { TEXT_SIZE = 1 << 16 };
+  static const char alphabet[] = "DAM=;+-!@01JGTEQ/ \t\r";
+  char* text = malloc(TEXT_SIZE);
+  if (!text) {
+    fprintf(stderr, "Memory allocation failed\n");
+    exit(1);
+  }
+  uint32_t state = 12345;
+  size_t until_newline = 0;
+  for (size_t i = 0; i < TEXT_SIZE; i++) {
+    state = state * 1103515245u + 12345u;
+    if (until_newline == 0) {
+      text[i] = '\n';
+      until_newline = (state >> 16) % 81;
+    } else {
+      text[i] = alphabet[(state >> 16) % (sizeof(alphabet) - 1)];
+      until_newline--;
+    }
+  }
+
+  for (size_t start = 0; start < TEXT_SIZE; start++) {
+    for (size_t length = 0; length <= 80 && start + length <= TEXT_SIZE; length += 7) {
+      const char* end = length == 0 ? text + TEXT_SIZE : text + start + length;
+      compare_at(checker, text + start, end, text + start, "random text");
+    }
+  }
+  free(text);
+}
+
+int main(void) {
+
+  // void -> int
+  // Runs every check and exits non-zero on any difference
+
+  Checker checker = { NULL, 0, 0, 0 };
+  checker.variants = scan_variants(&checker.variant_count);
+
+  // Two pages, the second made unreadable
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  char* pages = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (pages == MAP_FAILED || mprotect(pages + page, page, PROT_NONE) != 0) {
+    perror("Error mapping guard page");
+    return 1;
+  }
+  static char window[4 * WINDOW + 128];
+
+  check_crafted(&checker, window, pages + page);
+  check_random(&checker);
+  munmap(pages, 2 * page);
+
+  printf("scan:");
+  for (size_t v = 0; v < checker.variant_count; v++) {
+    printf(" %s%s", checker.variants[v].name, checker.variants[v].available ? "" : " (unavailable)");
+  }
+  printf("; %zu comparisons, %zu differences\n", checker.checks, checker.failures);
+  return checker.failures == 0 ? 0 : 1;
+}